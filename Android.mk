@@ -9,16 +9,31 @@ LOCAL_PATH := $(call my-dir)
 # Build nfcd
 include $(CLEAR_VARS)
 
-NFC_VENDOR := BROADCOM
+# BROADCOM, or SIMULATOR to run against the simulated RF field in src/simulator.
+NFC_VENDOR ?= BROADCOM
+
+# 0: no tracing, 1: NFA callbacks and service events, 2: also LLCP and IPC I/O.
+# See src/NfcTrace.h; kill -USR1 dumps the trace.
+NFC_TRACE_LEVEL ?= 1
 
 LOCAL_SRC_FILES := \
     src/nfcd.cpp \
     src/NfcService.cpp \
+    src/NfcEventQueue.cpp \
+    src/NfcEvent.cpp \
     src/NfcIpcSocket.cpp \
     src/IpcSocketListener.cpp \
     src/NfcUtil.cpp \
+    src/NfcStats.cpp \
+    src/NfcCounters.cpp \
+    src/NfcTrace.cpp \
     src/MessageHandler.cpp \
     src/SessionId.cpp \
+    src/NfcWorkerPool.cpp \
+    src/NfcTagWorker.cpp \
+    src/PresenceCheckScheduler.cpp \
+    src/TapLatencyTracker.cpp \
+    src/ParcelReader.cpp \
     src/P2pLinkManager.cpp \
     src/snep/SnepServer.cpp \
     src/snep/SnepClient.cpp \
@@ -35,6 +50,7 @@ BROADCOM_SRC_FILES := \
     src/broadcom/NfcSecureElement.cpp \
     src/broadcom/P2pDevice.cpp \
     src/broadcom/NfcTagManager.cpp \
+    src/broadcom/NdefCache.cpp \
     src/broadcom/Mutex.cpp \
     src/broadcom/CondVar.cpp \
     src/broadcom/PowerSwitch.cpp \
@@ -43,15 +59,30 @@ BROADCOM_SRC_FILES := \
     src/broadcom/Pn544Interop.cpp \
     src/broadcom/IntervalTimer.cpp
 
+SIMULATOR_SRC_FILES := \
+    src/simulator/NfcManager.cpp \
+    src/simulator/NfcTagManager.cpp \
+    src/simulator/LlcpSocket.cpp \
+    src/simulator/LlcpServiceSocket.cpp \
+    src/simulator/P2pDevice.cpp \
+    src/simulator/SimulatedField.cpp \
+    src/simulator/SimulatedLink.cpp
+
 INTERFACE_SRC_FILES := \
     src/interface/DeviceHost.cpp \
     src/interface/NdefMessage.cpp \
+    src/interface/NdefParser.cpp \
+    src/interface/NdefStreamDecoder.cpp \
     src/interface/NdefRecord.cpp
 
 ifeq ($(NFC_VENDOR),BROADCOM)
 LOCAL_SRC_FILES += $(BROADCOM_SRC_FILES)
 endif
 
+ifeq ($(NFC_VENDOR),SIMULATOR)
+LOCAL_SRC_FILES += $(SIMULATOR_SRC_FILES)
+endif
+
 LOCAL_SRC_FILES += $(INTERFACE_SRC_FILES)
 
 LOCAL_C_INCLUDES += \
@@ -82,6 +113,14 @@ LOCAL_C_INCLUDES += \
     $(VOB_COMPONENTS)/gki/common
 endif
 
+ifeq ($(NFC_VENDOR),SIMULATOR)
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/src/simulator \
+    $(LOCAL_PATH)/src/interface \
+    $(LOCAL_PATH)/src/snep \
+    $(LOCAL_PATH)/src/handover
+endif
+
 LOCAL_SHARED_LIBRARIES += \
     libicuuc \
     libnativehelper \
@@ -102,6 +141,11 @@ LOCAL_MODULE_TAGS := optional
 
 LOCAL_CFLAGS := -DDEBUG -DPLATFORM_ANDROID -DSTDC_HEADERS=1 -DHAVE_SYS_TYPES_H=1 -DHAVE_SYS_STAT_H=1 -DHAVE_STDLIB_H=1 -DHAVE_STRING_H=1 -DHAVE_MEMORY_H=1 -DHAVE_STRINGS_H=1 -DHAVE_INTTYPES_H=1 -DHAVE_STDINT_H=1 -DHAVE_UNISTD_H=1 -DHAVE_DLFCN_H=1 -DSILENT=1 -DNO_SIGNALS=1 -DNO_EXECUTE_PERMISSION=1 -D_GNU_SOURCE -D_REENTRANT -DUSE_MMAP -DUSE_MUNMAP -D_FILE_OFFSET_BITS=64 -DNO_UNALIGNED_ACCESS
 
+LOCAL_CFLAGS += -DNFC_TRACE_LEVEL=$(NFC_TRACE_LEVEL)
+
 include $(BUILD_EXECUTABLE)
 
+# Benchmarks, tests and fuzz targets.
+include $(LOCAL_PATH)/tests/Android.mk
+
 #endif #} TARGET_PROVIDES_NFCD
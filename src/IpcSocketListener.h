@@ -7,7 +7,13 @@
 
 class IpcSocketListener {
 public:
-  virtual void onConnected() = 0;
+  /**
+   * A new IPC client connected.
+   *
+   * @param  clientId Identifier of the client, used to route messages to it.
+   * @return          None.
+   */
+  virtual void onConnected(int clientId) = 0;
   virtual ~IpcSocketListener() = 0;
 };
 
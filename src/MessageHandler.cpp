@@ -3,6 +3,9 @@
  * You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include "MessageHandler.h"
+
+#include <stdlib.h>
+
 #include "NfcService.h"
 #include "NfcIpcSocket.h"
 #include "NfcUtil.h"
@@ -12,19 +15,106 @@
 #include "NfcDebug.h"
 
 #define MAJOR_VERSION (1)
-#define MINOR_VERSION (7)
+#define MINOR_VERSION (10)
 
 using android::Parcel;
 
-void MessageHandler::notifyInitialized(Parcel& parcel)
+// Entries are indexed by type; the constructor checks that every type has
+// exactly one entry.
+const MessageHandler::RequestEntry MessageHandler::sRequestTable[] = {
+  { NFC_REQUEST_CONFIG, "CONFIG",
+    &MessageHandler::handleConfigRequest, NFC_THREAD_IPC, 1000 },
+  { NFC_REQUEST_CONNECT, "CONNECT",
+    &MessageHandler::handleConnectRequest, NFC_THREAD_IPC, 1000 },
+  { NFC_REQUEST_CLOSE, "CLOSE",
+    &MessageHandler::handleCloseRequest, NFC_THREAD_IPC, 1000 },
+  { NFC_REQUEST_GET_DETAILS, "GET_DETAILS",
+    &MessageHandler::handleReadNdefDetailRequest, NFC_THREAD_IPC, 1000 },
+  { NFC_REQUEST_READ_NDEF, "READ_NDEF",
+    &MessageHandler::handleReadNdefRequest, NFC_THREAD_IPC, 1000 },
+  { NFC_REQUEST_WRITE_NDEF, "WRITE_NDEF",
+    &MessageHandler::handleWriteNdefRequest, NFC_THREAD_IPC, 5000 },
+  { NFC_REQUEST_MAKE_NDEF_READ_ONLY, "MAKE_NDEF_READ_ONLY",
+    &MessageHandler::handleMakeNdefReadonlyRequest, NFC_THREAD_IPC, 1000 },
+  { NFC_REQUEST_GET_STATS, "GET_STATS",
+    &MessageHandler::handleGetStatsRequest, NFC_THREAD_IPC, 1000 },
+};
+
+// GENERAL is also sent from the IPC thread, when a request is refused.
+const MessageHandler::EncoderEntry MessageHandler::sResponseTable[] = {
+  { NFC_RESPONSE_GENERAL, "GENERAL",
+    &MessageHandler::handleResponse, NFC_THREAD_ANY, false },
+  { NFC_RESPONSE_CONFIG, "CONFIG",
+    &MessageHandler::handleConfigResponse, NFC_THREAD_SERVICE, false },
+  { NFC_RESPONSE_READ_NDEF_DETAILS, "READ_NDEF_DETAILS",
+    &MessageHandler::handleReadNdefDetailResponse, NFC_THREAD_SERVICE, false },
+  { NFC_RESPONSE_READ_NDEF, "READ_NDEF",
+    &MessageHandler::handleReadNdefResponse, NFC_THREAD_SERVICE, false },
+  { NFC_RESPONSE_STATS, "STATS",
+    &MessageHandler::handleStatsResponse, NFC_THREAD_IPC, false },
+};
+
+// INITIALIZED is only sent to the client that just connected. TECH_DISCOVERED
+// is also sent from the SNEP server thread when a peer pushes a message.
+const MessageHandler::EncoderEntry MessageHandler::sNotificationTable[] = {
+  { NFC_NOTIFICATION_INITIALIZED, "INITIALIZED",
+    &MessageHandler::notifyInitialized, NFC_THREAD_SERVICE, false },
+  { NFC_NOTIFICATION_TECH_DISCOVERED, "TECH_DISCOVERED",
+    &MessageHandler::notifyTechDiscovered, NFC_THREAD_ANY, true },
+  { NFC_NOTIFICATION_TECH_LOST, "TECH_LOST",
+    &MessageHandler::notifyTechLost, NFC_THREAD_SERVICE, true },
+};
+
+MessageHandler::MessageHandler(NfcService* service)
+ : mSocket(NULL)
+ , mService(service)
+{
+  NFC_STATIC_ASSERT(sizeof(sRequestTable) / sizeof(sRequestTable[0]) ==
+                    NFC_REQUEST_END, request_table_complete);
+  NFC_STATIC_ASSERT(sizeof(sResponseTable) / sizeof(sResponseTable[0]) ==
+                    NFC_RESPONSE_END - NFC_RESPONSE_GENERAL, response_table_complete);
+  NFC_STATIC_ASSERT(sizeof(sNotificationTable) / sizeof(sNotificationTable[0]) ==
+                    NFC_NOTIFICATION_END - NFC_NOTIFICATION_INITIALIZED, notification_table_complete);
+
+  // Entries must be in enum order so that lookup is a plain index.
+  for (int i = 0; i < NFC_REQUEST_END; i++) {
+    if (sRequestTable[i].type != i) {
+      ALOGE("%s: request table out of order at %d", FUNC, i);
+      abort();
+    }
+  }
+  for (int i = 0; i < NFC_RESPONSE_END - NFC_RESPONSE_GENERAL; i++) {
+    if (sResponseTable[i].type != NFC_RESPONSE_GENERAL + i) {
+      ALOGE("%s: response table out of order at %d", FUNC, i);
+      abort();
+    }
+  }
+  for (int i = 0; i < NFC_NOTIFICATION_END - NFC_NOTIFICATION_INITIALIZED; i++) {
+    if (sNotificationTable[i].type != NFC_NOTIFICATION_INITIALIZED + i) {
+      ALOGE("%s: notification table out of order at %d", FUNC, i);
+      abort();
+    }
+  }
+}
+
+void MessageHandler::checkThread(NfcThread expected, const char* name)
+{
+  bool isServiceThread = NfcService::isServiceThread();
+  if ((expected == NFC_THREAD_SERVICE && !isServiceThread) ||
+      (expected == NFC_THREAD_IPC && isServiceThread)) {
+    ALOGW("%s: %s handled on unexpected thread", FUNC, name);
+  }
+}
+
+bool MessageHandler::notifyInitialized(Parcel& parcel, void* data)
 {
   parcel.writeInt32(0); // status
   parcel.writeInt32(MAJOR_VERSION);
   parcel.writeInt32(MINOR_VERSION);
-  sendResponse(parcel);
+  return true;
 }
 
-void MessageHandler::notifyTechDiscovered(Parcel& parcel, void* data)
+bool MessageHandler::notifyTechDiscovered(Parcel& parcel, void* data)
 {
   TechDiscoveredEvent *event = reinterpret_cast<TechDiscoveredEvent*>(data);
 
@@ -38,103 +128,128 @@ void MessageHandler::notifyTechDiscovered(Parcel& parcel, void* data)
   memcpy(dest, event->techList, event->techCount);
   parcel.writeInt32(event->ndefMsgCount);
   sendNdefMsg(parcel, event->ndefMsg);
-  sendResponse(parcel);
+  return true;
 }
 
-void MessageHandler::notifyTechLost(Parcel& parcel)
+bool MessageHandler::notifyTechLost(Parcel& parcel, void* data)
 {
   parcel.writeInt32(SessionId::getCurrentId());
-  sendResponse(parcel);
+  return true;
 }
 
-void MessageHandler::processRequest(const uint8_t* data, size_t dataLen)
+void MessageHandler::processRequest(int clientId, const uint8_t* data, size_t dataLen)
 {
-  Parcel parcel;
-  int32_t sizeLe, size, request;
-  uint32_t status;
+  NfcRequestOrigin origin(clientId);
+  // The request is decoded in place; data is only valid during this call.
+  ParcelReader parcel(data, dataLen);
+  int32_t request;
+  int status;
 
-  ALOGD("%s enter data=%p, dataLen=%d", FUNC, data, dataLen);
-  parcel.setData((uint8_t*)data, dataLen);
+  ALOGD("%s enter client=%d data=%p, dataLen=%u", FUNC, clientId, data, (unsigned)dataLen);
   status = parcel.readInt32(&request);
   if (status != 0) {
-    ALOGE("Invalid request block");
+    ALOGE("%s: invalid request block", FUNC);
+    processResponse(origin, NFC_RESPONSE_GENERAL, NFC_ERROR_INVALID_REQUEST, NULL);
     return;
   }
 
-  switch (request) {
-    case NFC_REQUEST_CONFIG:
-      handleConfigRequest(parcel);
-      break;
-    case NFC_REQUEST_GET_DETAILS:
-      handleReadNdefDetailRequest(parcel);
-      break;
-    case NFC_REQUEST_READ_NDEF:
-      handleReadNdefRequest(parcel);
-      break;
-    case NFC_REQUEST_WRITE_NDEF:
-      handleWriteNdefRequest(parcel);
-      break;
-    case NFC_REQUEST_CONNECT:
-      handleConnectRequest(parcel);
-      break;
-    case NFC_REQUEST_CLOSE:
-      handleCloseRequest(parcel);
-      break;
-    case NFC_REQUEST_MAKE_NDEF_READ_ONLY:
-      handleMakeNdefReadonlyRequest(parcel);
-      break;
-    default:
-      ALOGE("Unhandled Request %d", request);
-      break;
+  if (request & NFC_MESSAGE_TOKEN_FLAG) {
+    int32_t token;
+    if (parcel.readInt32(&token) != 0) {
+      ALOGE("%s: missing request token", FUNC);
+      processResponse(origin, NFC_RESPONSE_GENERAL, NFC_ERROR_INVALID_REQUEST, NULL);
+      return;
+    }
+    request &= ~NFC_MESSAGE_TOKEN_FLAG;
+    origin.hasToken = true;
+    origin.token = token;
+  }
+
+  if (request < 0 || request >= NFC_REQUEST_END) {
+    ALOGE("%s: unhandled request %d", FUNC, request);
+    processResponse(origin, NFC_RESPONSE_GENERAL, NFC_ERROR_NOT_SUPPORTED, NULL);
+    return;
+  }
+
+  const RequestEntry& entry = sRequestTable[request];
+  NfcDispatchStats& stats = mRequestStats[request];
+  checkThread(entry.thread, entry.name);
+
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
+  NfcErrorCode error = (this->*entry.decode)(parcel, origin);
+  if (error != NFC_ERROR_SUCCESS) {
+    ALOGE("%s: request %s refused, error %d", FUNC, entry.name, error);
+    processResponse(origin, NFC_RESPONSE_GENERAL, error, NULL);
+  }
+  uint64_t elapsed = NfcUtil::getMonotonicTimeUs() - start;
+
+  __sync_fetch_and_add(&stats.calls, 1);
+  stats.latency.record(elapsed);
+  if (elapsed > entry.budgetUs) {
+    __sync_fetch_and_add(&stats.overBudget, 1);
+    ALOGW("%s: request %s took %llu us", FUNC, entry.name, (unsigned long long)elapsed);
   }
 }
 
-void MessageHandler::processResponse(NfcResponseType response, NfcErrorCode error, void* data)
+void MessageHandler::processResponse(const NfcRequestOrigin& origin, NfcResponseType response,
+                                     NfcErrorCode error, void* data)
 {
-  ALOGD("%s enter response=%d", FUNC, response);
+  ALOGD("%s enter response=%d client=%d", FUNC, response, origin.clientId);
+  if (response < NFC_RESPONSE_GENERAL || response >= NFC_RESPONSE_END) {
+    ALOGE("Not implement");
+    return;
+  }
+
+  const EncoderEntry& entry = sResponseTable[response - NFC_RESPONSE_GENERAL];
+  NfcDispatchStats& stats = mResponseStats[response - NFC_RESPONSE_GENERAL];
+  checkThread(entry.thread, entry.name);
+
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
   Parcel parcel;
-  parcel.writeInt32(response);
-  parcel.writeInt32(error);
-
-  switch (response) {
-    case NFC_RESPONSE_CONFIG:
-      handleConfigResponse(parcel, data);
-      break;
-    case NFC_RESPONSE_READ_NDEF_DETAILS:
-      handleReadNdefDetailResponse(parcel, data);
-      break;
-    case NFC_RESPONSE_READ_NDEF:
-      handleReadNdefResponse(parcel, data);
-      break;
-    case NFC_RESPONSE_GENERAL:
-      handleResponse(parcel);
-      break;
-    default:
-      ALOGE("Not implement");
-      break;
+  if (origin.hasToken) {
+    parcel.writeInt32(response | NFC_MESSAGE_TOKEN_FLAG);
+    parcel.writeInt32(error);
+    parcel.writeInt32(origin.token);
+  } else {
+    parcel.writeInt32(response);
+    parcel.writeInt32(error);
+  }
+
+  if ((this->*entry.encode)(parcel, data)) {
+    sendResponse(origin, parcel);
   }
+
+  __sync_fetch_and_add(&stats.calls, 1);
+  stats.latency.record(NfcUtil::getMonotonicTimeUs() - start);
 }
 
 void MessageHandler::processNotification(NfcNotificationType notification, void* data)
 {
   ALOGD("processNotificaton notification=%d", notification);
+  if (notification < NFC_NOTIFICATION_INITIALIZED || notification >= NFC_NOTIFICATION_END) {
+    ALOGE("Not implement");
+    return;
+  }
+
+  const EncoderEntry& entry = sNotificationTable[notification - NFC_NOTIFICATION_INITIALIZED];
+  NfcDispatchStats& stats = mNotificationStats[notification - NFC_NOTIFICATION_INITIALIZED];
+  checkThread(entry.thread, entry.name);
+
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
   Parcel parcel;
   parcel.writeInt32(notification);
 
-  switch (notification) {
-    case NFC_NOTIFICATION_INITIALIZED :
-      notifyInitialized(parcel);
-      break;
-    case NFC_NOTIFICATION_TECH_DISCOVERED:
-      notifyTechDiscovered(parcel, data);
-      break;
-    case NFC_NOTIFICATION_TECH_LOST:
-      notifyTechLost(parcel);
-      break;
-    default:
-      ALOGE("Not implement");
-      break;
+  if ((this->*entry.encode)(parcel, data)) {
+    if (entry.isBroadcast) {
+      sendNotification(parcel);
+    } else {
+      // Addressed notifications carry the NfcRequestOrigin of the receiver.
+      sendResponse(*reinterpret_cast<NfcRequestOrigin*>(data), parcel);
+    }
   }
+
+  __sync_fetch_and_add(&stats.calls, 1);
+  stats.latency.record(NfcUtil::getMonotonicTimeUs() - start);
 }
 
 void MessageHandler::setOutgoingSocket(NfcIpcSocket* socket)
@@ -142,12 +257,17 @@ void MessageHandler::setOutgoingSocket(NfcIpcSocket* socket)
   mSocket = socket;
 }
 
-void MessageHandler::sendResponse(Parcel& parcel)
+void MessageHandler::sendResponse(const NfcRequestOrigin& origin, Parcel& parcel)
+{
+  mSocket->writeToOutgoingQueue(origin.clientId, const_cast<uint8_t*>(parcel.data()), parcel.dataSize());
+}
+
+void MessageHandler::sendNotification(Parcel& parcel)
 {
-  mSocket->writeToOutgoingQueue(const_cast<uint8_t*>(parcel.data()), parcel.dataSize());
+  mSocket->broadcastToOutgoingQueue(const_cast<uint8_t*>(parcel.data()), parcel.dataSize());
 }
 
-bool MessageHandler::handleConfigRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleConfigRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
   // TODO, what does NFC_POWER_FULL mean
   // - OFF -> ON?
@@ -158,76 +278,81 @@ bool MessageHandler::handleConfigRequest(Parcel& parcel)
     case NFC_POWER_OFF: // Fall through.
     case NFC_POWER_FULL:
       value = powerLevel == NFC_POWER_FULL;
-      return mService->handleEnableRequest(value);
+      return mService->handleEnableRequest(value, origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
     case NFC_POWER_LOW:
       value = powerLevel == NFC_POWER_LOW;
-      return mService->handleEnterLowPowerRequest(value);
+      return mService->handleEnterLowPowerRequest(value, origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
+    case NFC_POWER_NO_OP:
+      return mService->handleConfigRequest(powerLevel, origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
   }
-  return false;
 
+  ALOGE("%s: invalid power level %d", FUNC, powerLevel);
+  return NFC_ERROR_INVALID_REQUEST;
 }
 
-bool MessageHandler::handleReadNdefDetailRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleReadNdefDetailRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
   int sessionId = parcel.readInt32();
   //TODO check SessionId
-  return mService->handleReadNdefDetailRequest();
+  return mService->handleReadNdefDetailRequest(origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
 }
 
-bool MessageHandler::handleReadNdefRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleReadNdefRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
   int sessionId = parcel.readInt32();
   //TODO check SessionId
-  return mService->handleReadNdefRequest();
+  return mService->handleReadNdefRequest(origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
 }
 
-bool MessageHandler::handleWriteNdefRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleWriteNdefRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
-  NdefMessagePdu ndefMessagePdu;
-  NdefMessage* ndefMessage = new NdefMessage();
-
   int sessionId = parcel.readInt32();
   //TODO check SessionId
 
+  // Each record takes at least four int32 fields, which bounds numRecords
+  // before anything is allocated for it.
   uint32_t numRecords = parcel.readInt32();
-  ndefMessagePdu.numRecords = numRecords;
-  ndefMessagePdu.records = new NdefRecordPdu[numRecords];
+  if (numRecords > parcel.dataAvail() / (4 * sizeof(int32_t))) {
+    ALOGE("%s: invalid number of records %u", FUNC, numRecords);
+    return NFC_ERROR_INVALID_REQUEST;
+  }
 
+  // The record PDUs only point into the request frame. The single copy of
+  // type, id and payload is made by convertNdefPduToNdefMessage, into the
+  // NdefMessage handed over to the service thread.
+  std::vector<NdefRecordPdu> records(numRecords);
   for (uint32_t i = 0; i < numRecords; i++) {
-    ndefMessagePdu.records[i].tnf = parcel.readInt32();
-
-    uint32_t typeLength = parcel.readInt32();
-    ndefMessagePdu.records[i].typeLength = typeLength;
-    ndefMessagePdu.records[i].type = new uint8_t[typeLength];
-    const void* data = parcel.readInplace(typeLength);
-    memcpy(ndefMessagePdu.records[i].type, data, typeLength);
-
-    uint32_t idLength = parcel.readInt32();
-    ndefMessagePdu.records[i].idLength = idLength;
-    ndefMessagePdu.records[i].id = new uint8_t[idLength];
-    data = parcel.readInplace(idLength);
-    memcpy(ndefMessagePdu.records[i].id, data, idLength);
-
-    uint32_t payloadLength = parcel.readInt32();
-    ndefMessagePdu.records[i].payloadLength = payloadLength;
-    ndefMessagePdu.records[i].payload = new uint8_t[payloadLength];
-    data = parcel.readInplace(payloadLength);
-    memcpy(ndefMessagePdu.records[i].payload, data, payloadLength);
-  }
+    NdefRecordPdu& record = records[i];
+    record.tnf = parcel.readInt32();
 
-  NfcUtil::convertNdefPduToNdefMessage(ndefMessagePdu, ndefMessage);
+    record.typeLength = parcel.readInt32();
+    record.type = const_cast<uint8_t*>(parcel.readInplace(record.typeLength));
 
-  for (uint32_t i = 0; i < numRecords; i++) {
-    delete[] ndefMessagePdu.records[i].type;
-    delete[] ndefMessagePdu.records[i].id;
-    delete[] ndefMessagePdu.records[i].payload;
+    record.idLength = parcel.readInt32();
+    record.id = const_cast<uint8_t*>(parcel.readInplace(record.idLength));
+
+    record.payloadLength = parcel.readInt32();
+    record.payload = const_cast<uint8_t*>(parcel.readInplace(record.payloadLength));
+
+    if ((record.typeLength && !record.type) ||
+        (record.idLength && !record.id) ||
+        (record.payloadLength && !record.payload)) {
+      ALOGE("%s: truncated NDEF record %u", FUNC, i);
+      return NFC_ERROR_INVALID_REQUEST;
+    }
   }
-  delete[] ndefMessagePdu.records;
 
-  return mService->handleWriteNdefRequest(ndefMessage);
+  NdefMessagePdu ndefMessagePdu;
+  ndefMessagePdu.numRecords = numRecords;
+  ndefMessagePdu.records = numRecords ? &records[0] : NULL;
+
+  NdefMessage* ndefMessage = new NdefMessage();
+  NfcUtil::convertNdefPduToNdefMessage(ndefMessagePdu, ndefMessage);
+
+  return mService->handleWriteNdefRequest(ndefMessage, origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
 }
 
-bool MessageHandler::handleConnectRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleConnectRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
   int sessionId = parcel.readInt32();
   //TODO check SessionId
@@ -235,25 +360,39 @@ bool MessageHandler::handleConnectRequest(Parcel& parcel)
   //TODO should only read 1 octet here.
   int32_t techType = parcel.readInt32();
   ALOGD("%s techType=%d", FUNC, techType);
-  mService->handleConnect(techType);
-  return true;
+  return mService->handleConnectRequest(techType, origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
 }
 
-bool MessageHandler::handleCloseRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleCloseRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
-  mService->handleCloseRequest();
-  return true;
+  return mService->handleCloseRequest(origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
 }
 
-bool MessageHandler::handleMakeNdefReadonlyRequest(Parcel& parcel)
+NfcErrorCode MessageHandler::handleMakeNdefReadonlyRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
 {
-  mService->handleMakeNdefReadonlyRequest();
-  return true;
+  return mService->handleMakeNdefReadonlyRequest(origin) ? NFC_ERROR_SUCCESS : NFC_ERROR_BUSY;
+}
+
+// Answered on the IPC thread; the statistics can be read from any thread
+// and should not wait behind tag operations queued on the service thread.
+NfcErrorCode MessageHandler::handleGetStatsRequest(ParcelReader& parcel, const NfcRequestOrigin& origin)
+{
+  NfcStatsSnapshot snapshot;
+  mService->getStats(snapshot);
+
+  NfcIpcStats ipcStats;
+  mSocket->getStats(ipcStats);
+  snapshot.counters[NFC_STATS_IPC_MESSAGES_QUEUED] = ipcStats.messagesQueued;
+  snapshot.counters[NFC_STATS_IPC_MESSAGES_SENT] = ipcStats.messagesSent;
+  snapshot.counters[NFC_STATS_IPC_PENDING_BYTES] = ipcStats.pendingBytes;
+  snapshot.counters[NFC_STATS_IPC_MAX_PENDING_BYTES] = ipcStats.maxPendingBytes;
+  snapshot.counters[NFC_STATS_IPC_CLIENTS_DROPPED] = ipcStats.clientsDropped;
+  processResponse(origin, NFC_RESPONSE_STATS, NFC_ERROR_SUCCESS, &snapshot);
+  return NFC_ERROR_SUCCESS;
 }
 
 bool MessageHandler::handleConfigResponse(Parcel& parcel, void* data)
 {
-  sendResponse(parcel);
   return true;
 }
 
@@ -263,6 +402,11 @@ bool MessageHandler::handleReadNdefDetailResponse(Parcel& parcel, void* data)
 
   parcel.writeInt32(SessionId::getCurrentId());
 
+  // An error response carries the session only.
+  if (!ndefDetail) {
+    return true;
+  }
+
   bool isReadOnly = ndefDetail->isReadOnly;
   bool canBeMadeReadOnly = ndefDetail->canBeMadeReadOnly;
 
@@ -271,8 +415,6 @@ bool MessageHandler::handleReadNdefDetailResponse(Parcel& parcel, void* data)
   memcpy(dest, params, sizeof(params));
 
   parcel.writeInt32(ndefDetail->maxSupportedLength);
-
-  sendResponse(parcel);
   return true;
 }
 
@@ -282,16 +424,75 @@ bool MessageHandler::handleReadNdefResponse(Parcel& parcel, void* data)
 
   parcel.writeInt32(SessionId::getCurrentId());
 
+  // Writes nothing for the NULL message of an error response.
   sendNdefMsg(parcel, ndef);
-  sendResponse(parcel);
+  return true;
+}
 
+static void writeHistogram(Parcel& parcel, NfcLatencyHistogram& histogram)
+{
+  int numBuckets = NFC_LATENCY_BUCKETS;
+  while (numBuckets > 0 && histogram.getBucket(numBuckets - 1) == 0) {
+    numBuckets--;
+  }
+
+  parcel.writeInt32(histogram.getCount());
+  parcel.writeInt32(numBuckets);
+  for (int i = 0; i < numBuckets; i++) {
+    parcel.writeInt32(histogram.getBucket(i));
+  }
+}
+
+static void writeDispatchStats(Parcel& parcel, int type, NfcDispatchStats& stats)
+{
+  parcel.writeInt32(type);
+  parcel.writeInt32(stats.calls);
+  parcel.writeInt32(stats.overBudget);
+  writeHistogram(parcel, stats.latency);
+}
+
+bool MessageHandler::handleStatsResponse(Parcel& parcel, void* data)
+{
+  NfcStatsSnapshot* snapshot = reinterpret_cast<NfcStatsSnapshot*>(data);
+
+  parcel.writeInt32(NFC_STATS_COUNTER_END);
+  for (int i = 0; i < NFC_STATS_COUNTER_END; i++) {
+    parcel.writeInt32(snapshot->counters[i]);
+  }
+
+  parcel.writeInt32(NFC_STATS_HISTOGRAM_END);
+  for (int i = 0; i < NFC_STATS_HISTOGRAM_END; i++) {
+    writeHistogram(parcel, *snapshot->histograms[i]);
+  }
+
+  // Dispatch tables, in the order of NfcStatsDispatchTable.
+  parcel.writeInt32(NFC_STATS_DISPATCH_END);
+
+  parcel.writeInt32(NFC_REQUEST_END);
+  for (int i = 0; i < NFC_REQUEST_END; i++) {
+    writeDispatchStats(parcel, i, mRequestStats[i]);
+  }
+
+  parcel.writeInt32(NFC_RESPONSE_END - NFC_RESPONSE_GENERAL);
+  for (int i = 0; i < NFC_RESPONSE_END - NFC_RESPONSE_GENERAL; i++) {
+    writeDispatchStats(parcel, NFC_RESPONSE_GENERAL + i, mResponseStats[i]);
+  }
+
+  parcel.writeInt32(NFC_NOTIFICATION_END - NFC_NOTIFICATION_INITIALIZED);
+  for (int i = 0; i < NFC_NOTIFICATION_END - NFC_NOTIFICATION_INITIALIZED; i++) {
+    writeDispatchStats(parcel, NFC_NOTIFICATION_INITIALIZED + i, mNotificationStats[i]);
+  }
+
+  parcel.writeInt32(MSG_END);
+  for (int i = 0; i < MSG_END; i++) {
+    writeDispatchStats(parcel, i, mService->getEventStats((NfcEventType)i));
+  }
   return true;
 }
 
-bool MessageHandler::handleResponse(Parcel& parcel)
+bool MessageHandler::handleResponse(Parcel& parcel, void* data)
 {
   parcel.writeInt32(SessionId::getCurrentId());
-  sendResponse(parcel);
   return true;
 }
 
@@ -331,9 +532,6 @@ bool MessageHandler::sendNdefMsg(Parcel& parcel, NdefMessage* ndef)
     parcel.writeInt32(payloadLength);
     dest = parcel.writeInplace(payloadLength);
     memcpy(dest, &record.mPayload.front(), payloadLength);
-    for (uint32_t j = 0; j < payloadLength; j++) {
-      ALOGD("mPayload %d = %u", j, record.mPayload[j]);
-    }
   }
 
   return true;
@@ -8,40 +8,96 @@
 #include <stdio.h>
 #include "NfcGonkMessage.h"
 #include "TagTechnology.h"
+#include "NfcEvent.h"
+#include "ParcelReader.h"
+#include "NfcStats.h"
 #include <binder/Parcel.h>
 
 class NfcIpcSocket;
 class NfcService;
 class NdefMessage;
 
+/**
+ * Thread a dispatch table entry is expected to run on.
+ */
+typedef enum {
+  NFC_THREAD_ANY,
+  NFC_THREAD_IPC,
+  NFC_THREAD_SERVICE,
+} NfcThread;
+
 class MessageHandler {
 public:
-  MessageHandler(NfcService* service): mService(service) {};
-  void processRequest(const uint8_t* data, size_t length);
-  void processResponse(NfcResponseType response, NfcErrorCode error, void* data);
+  MessageHandler(NfcService* service);
+  void processRequest(int clientId, const uint8_t* data, size_t length);
+  void processResponse(const NfcRequestOrigin& origin, NfcResponseType response,
+                       NfcErrorCode error, void* data);
   void processNotification(NfcNotificationType notification, void* data);
 
   void setOutgoingSocket(NfcIpcSocket* socket);
 
 private:
-  void notifyInitialized(android::Parcel& parcel);
-  void notifyTechDiscovered(android::Parcel& parcel, void* data);
-  void notifyTechLost(android::Parcel& parcel);
-
-  bool handleConfigRequest(android::Parcel& parcel);
-  bool handleReadNdefDetailRequest(android::Parcel& parcel);
-  bool handleReadNdefRequest(android::Parcel& parcel);
-  bool handleWriteNdefRequest(android::Parcel& parcel);
-  bool handleConnectRequest(android::Parcel& parcel);
-  bool handleCloseRequest(android::Parcel& parcel);
-  bool handleMakeNdefReadonlyRequest(android::Parcel& parcel);
+  /**
+   * @return NFC_ERROR_SUCCESS if the request was handed over or answered.
+   *         Anything else is sent back in a NFC_RESPONSE_GENERAL.
+   */
+  typedef NfcErrorCode (MessageHandler::*RequestDecoder)(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  typedef bool (MessageHandler::*MessageEncoder)(android::Parcel& parcel, void* data);
+
+  /**
+   * Requests are decoded on the IPC thread and handed to NfcService.
+   */
+  struct RequestEntry {
+    NfcRequestType type;
+    const char* name;
+    RequestDecoder decode;
+    NfcThread thread;
+    uint32_t budgetUs;
+  };
+
+  /**
+   * Responses and notifications are encoded into a parcel and then sent,
+   * either to the requesting client or to every client.
+   */
+  struct EncoderEntry {
+    int type;
+    const char* name;
+    MessageEncoder encode;
+    NfcThread thread;
+    bool isBroadcast;
+  };
+
+  static const RequestEntry sRequestTable[];
+  static const EncoderEntry sResponseTable[];
+  static const EncoderEntry sNotificationTable[];
+
+  NfcDispatchStats mRequestStats[NFC_REQUEST_END];
+  NfcDispatchStats mResponseStats[NFC_RESPONSE_END - NFC_RESPONSE_GENERAL];
+  NfcDispatchStats mNotificationStats[NFC_NOTIFICATION_END - NFC_NOTIFICATION_INITIALIZED];
+
+  void checkThread(NfcThread expected, const char* name);
+
+  bool notifyInitialized(android::Parcel& parcel, void* data);
+  bool notifyTechDiscovered(android::Parcel& parcel, void* data);
+  bool notifyTechLost(android::Parcel& parcel, void* data);
+
+  NfcErrorCode handleConfigRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleReadNdefDetailRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleReadNdefRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleWriteNdefRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleConnectRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleCloseRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleMakeNdefReadonlyRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
+  NfcErrorCode handleGetStatsRequest(ParcelReader& parcel, const NfcRequestOrigin& origin);
 
   bool handleConfigResponse(android::Parcel& parcel, void* data);
   bool handleReadNdefDetailResponse(android::Parcel& parcel, void* data);
   bool handleReadNdefResponse(android::Parcel& parcel, void* data);
-  bool handleResponse(android::Parcel& parcel);
+  bool handleStatsResponse(android::Parcel& parcel, void* data);
+  bool handleResponse(android::Parcel& parcel, void* data);
 
-  void sendResponse(android::Parcel& parcel);
+  void sendResponse(const NfcRequestOrigin& origin, android::Parcel& parcel);
+  void sendNotification(android::Parcel& parcel);
 
   bool sendNdefMsg(android::Parcel& parcel, NdefMessage* ndef);
 
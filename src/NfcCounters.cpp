@@ -0,0 +1,44 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcCounters.h"
+
+#include "NfcThreadBlocks.h"
+
+/**
+ * Counters of one thread.
+ */
+struct NfcCounterBlock {
+  NfcCounterBlock* next;
+  volatile int isOwned;
+  volatile uint32_t values[NFC_STATS_COUNTER_END];
+  uint32_t remainderUs[NFC_STATS_COUNTER_END];  // Of addTimeUs().
+};
+
+typedef NfcThreadBlocks<NfcCounterBlock> NfcCounterBlocks;
+
+void NfcCounters::add(NfcStatsCounter counter, uint32_t value)
+{
+  bool isAttached;
+  NfcCounterBlock* block = NfcCounterBlocks::get(isAttached);
+  block->values[counter] += value;
+}
+
+void NfcCounters::addTimeUs(NfcStatsCounter counter, uint64_t us)
+{
+  bool isAttached;
+  NfcCounterBlock* block = NfcCounterBlocks::get(isAttached);
+  uint64_t total = block->remainderUs[counter] + us;
+  block->values[counter] += (uint32_t)(total / 1000);
+  block->remainderUs[counter] = (uint32_t)(total % 1000);
+}
+
+uint32_t NfcCounters::get(NfcStatsCounter counter)
+{
+  uint32_t sum = 0;
+  for (NfcCounterBlock* block = NfcCounterBlocks::first(); block; block = block->next) {
+    sum += block->values[counter];
+  }
+  return sum;
+}
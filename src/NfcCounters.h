@@ -0,0 +1,58 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcCounters_h
+#define mozilla_nfcd_NfcCounters_h
+
+#include <stdint.h>
+
+#include "NfcGonkMessage.h"
+#include "NfcStats.h"
+
+/**
+ * Event counters reported by NFC_REQUEST_GET_STATS.
+ *
+ * Every thread counts into a block of its own with plain increments, so
+ * counting takes no lock and no atomic operation. Reading sums up the
+ * blocks of all threads, past and present.
+ */
+class NfcCounters {
+public:
+  /**
+   * Add to a counter on behalf of the calling thread.
+   *
+   * @param  counter Counter.
+   * @param  value   Amount to add.
+   * @return         None.
+   */
+  static void add(NfcStatsCounter counter, uint32_t value);
+
+  static void increment(NfcStatsCounter counter) { add(counter, 1); }
+
+  /**
+   * Add a duration to a counter of milliseconds. What is left below a
+   * millisecond is carried over to the next call of the thread, so short
+   * durations add up instead of being dropped.
+   *
+   * @param  counter Counter, in milliseconds.
+   * @param  us      Duration in microseconds.
+   * @return         None.
+   */
+  static void addTimeUs(NfcStatsCounter counter, uint64_t us);
+
+  /**
+   * @return Sum of a counter over all threads.
+   */
+  static uint32_t get(NfcStatsCounter counter);
+};
+
+/**
+ * Contents of NFC_RESPONSE_STATS.
+ */
+struct NfcStatsSnapshot {
+  uint32_t counters[NFC_STATS_COUNTER_END];
+  NfcLatencyHistogram* histograms[NFC_STATS_HISTOGRAM_END];
+};
+
+#endif // mozilla_nfcd_NfcCounters_h
@@ -11,4 +11,7 @@
 
 #define FUNC __PRETTY_FUNCTION__
 
+// Compile-time assertion; fails to build with a negative array size.
+#define NFC_STATIC_ASSERT(cond, name) typedef char static_assert_##name[(cond) ? 1 : -1]
+
 #endif
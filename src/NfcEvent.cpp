@@ -0,0 +1,63 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcEvent.h"
+
+#include <string.h>
+
+#include "NfcDebug.h"
+
+NfcEvent::NfcEvent(NfcEventType type)
+ : mType(type)
+ , mIsPooled(false)
+{
+  memset(&mPayload, 0, sizeof(mPayload));
+}
+
+NfcEventPool::NfcEventPool(uint32_t capacity)
+ : mEvents(NULL)
+ , mFreeList(capacity, false)
+ , mHeapFallbackCount(0)
+{
+  mEvents = new NfcEvent[capacity];
+  for (uint32_t i = 0; i < capacity; i++) {
+    mEvents[i].mIsPooled = true;
+    mFreeList.push(&mEvents[i]);
+  }
+}
+
+NfcEventPool::~NfcEventPool()
+{
+  delete [] mEvents;
+}
+
+NfcEvent* NfcEventPool::obtain(NfcEventType type)
+{
+  NfcEvent* event = mFreeList.pop();
+  if (!event) {
+    __sync_fetch_and_add(&mHeapFallbackCount, 1);
+    ALOGW("%s: event pool exhausted, msg=%d", FUNC, type);
+    event = new NfcEvent();
+  }
+
+  event->mType = type;
+  memset(&event->mPayload, 0, sizeof(event->mPayload));
+  event->mOrigin = NfcRequestOrigin();
+  return event;
+}
+
+void NfcEventPool::recycle(NfcEvent* event)
+{
+  if (!event) {
+    return;
+  }
+
+  if (!event->mIsPooled) {
+    delete event;
+    return;
+  }
+
+  event->mType = MSG_UNDEFINED;
+  mFreeList.push(event);
+}
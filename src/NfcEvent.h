@@ -0,0 +1,154 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcEvent_h
+#define mozilla_nfcd_NfcEvent_h
+
+#include <stdint.h>
+
+#include "NfcEventQueue.h"
+
+class INfcTag;
+class IP2pDevice;
+class NdefMessage;
+struct NfcTagOp;
+
+typedef enum {
+  MSG_UNDEFINED = 0,
+  MSG_LLCP_LINK_ACTIVATION,
+  MSG_LLCP_LINK_DEACTIVATION,
+  MSG_TAG_DISCOVERED,
+  MSG_TAG_LOST,
+  MSG_SE_FIELD_ACTIVATED,
+  MSG_SE_FIELD_DEACTIVATED,
+  MSG_SE_NOTIFY_TRANSACTION_LISTENERS,
+  MSG_READ_NDEF_DETAIL,
+  MSG_READ_NDEF,
+  MSG_WRITE_NDEF,
+  MSG_CLOSE,
+  MSG_SOCKET_CONNECTED,
+  MSG_PUSH_NDEF,
+  MSG_NDEF_TAG_LIST,
+  MSG_CONFIG,
+  MSG_MAKE_NDEF_READONLY,
+  MSG_LOW_POWER,
+  MSG_ENABLE,
+  MSG_CONNECT,
+  MSG_TAG_OP_COMPLETE,
+  // Not an event. Keep it last.
+  MSG_END
+} NfcEventType;
+
+/**
+ * Identifies the IPC client that sent a request, and the token the client
+ * attached to it if any, so that the response can be routed back to it.
+ */
+struct NfcRequestOrigin {
+  NfcRequestOrigin() : clientId(-1), hasToken(false), token(0) {}
+  NfcRequestOrigin(int id) : clientId(id), hasToken(false), token(0) {}
+
+  int clientId;
+  bool hasToken;
+  uint32_t token;
+};
+
+/**
+ * An event handled by the NfcService thread.
+ *
+ * The payload is stored inline. Which member is valid depends on the event
+ * type:
+ *   MSG_LLCP_LINK_ACTIVATION/DEACTIVATION : P2P device.
+ *   MSG_TAG_DISCOVERED                    : tag.
+ *   MSG_WRITE_NDEF/MSG_PUSH_NDEF          : NDEF message, owned by the handler.
+ *   MSG_LOW_POWER/MSG_ENABLE              : flag.
+ *   MSG_CONNECT                           : technology.
+ *   MSG_TAG_OP_COMPLETE                   : finished tag operation.
+ *
+ * Events posted on behalf of an IPC request also carry the request's origin.
+ */
+class NfcEvent {
+public:
+  NfcEvent(NfcEventType type = MSG_UNDEFINED);
+
+  NfcEventType getType() { return mType; }
+
+  INfcTag* getTag() { return mPayload.tag; }
+  void setTag(INfcTag* tag) { mPayload.tag = tag; }
+
+  IP2pDevice* getP2pDevice() { return mPayload.device; }
+  void setP2pDevice(IP2pDevice* device) { mPayload.device = device; }
+
+  NdefMessage* getNdefMessage() { return mPayload.ndef; }
+  void setNdefMessage(NdefMessage* ndef) { mPayload.ndef = ndef; }
+
+  bool getFlag() { return mPayload.flag; }
+  void setFlag(bool flag) { mPayload.flag = flag; }
+
+  int getValue() { return mPayload.value; }
+  void setValue(int value) { mPayload.value = value; }
+
+  NfcTagOp* getTagOp() { return mPayload.tagOp; }
+  void setTagOp(NfcTagOp* op) { mPayload.tagOp = op; }
+
+  const NfcRequestOrigin& getOrigin() { return mOrigin; }
+  void setOrigin(const NfcRequestOrigin& origin) { mOrigin = origin; }
+
+private:
+  friend class NfcEventPool;
+
+  NfcEventType mType;
+  bool mIsPooled;
+
+  union {
+    INfcTag* tag;
+    IP2pDevice* device;
+    NdefMessage* ndef;
+    bool flag;
+    int value;
+    NfcTagOp* tagOp;
+  } mPayload;
+
+  NfcRequestOrigin mOrigin;
+};
+
+/**
+ * Fixed-capacity pool of NfcEvent objects.
+ *
+ * Free events are kept in a lock-free ring, so obtain() and recycle() can be
+ * called from any thread without touching the heap. If the pool runs dry,
+ * obtain() falls back to the heap and recycle() frees those events again.
+ */
+class NfcEventPool {
+public:
+  NfcEventPool(uint32_t capacity);
+  ~NfcEventPool();
+
+  /**
+   * Get an event with an empty payload.
+   *
+   * @param  type Type of the event.
+   * @return      The event. Never NULL.
+   */
+  NfcEvent* obtain(NfcEventType type);
+
+  /**
+   * Give an event back once it has been handled.
+   *
+   * @param  event Event obtained from this pool.
+   * @return       None.
+   */
+  void recycle(NfcEvent* event);
+
+  /**
+   * @return Number of events allocated on the heap because the pool was empty.
+   */
+  uint32_t getHeapFallbackCount() { return mHeapFallbackCount; }
+
+private:
+  NfcEvent* mEvents;
+  NfcEventQueue mFreeList;
+  volatile uint32_t mHeapFallbackCount;
+};
+
+#endif // mozilla_nfcd_NfcEvent_h
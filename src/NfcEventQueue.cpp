@@ -0,0 +1,163 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcEventQueue.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "NfcCounters.h"
+#include "NfcUtil.h"
+#include "NfcDebug.h"
+
+static inline uint32_t loadAcquire(volatile uint32_t* ptr)
+{
+  uint32_t value = *ptr;
+  __sync_synchronize();
+  return value;
+}
+
+static inline void storeRelease(volatile uint32_t* ptr, uint32_t value)
+{
+  __sync_synchronize();
+  *ptr = value;
+}
+
+NfcEventQueue::NfcEventQueue(uint32_t capacity, bool wakeup)
+ : mCells(NULL)
+ , mMask(0)
+ , mWakeup(wakeup)
+ , mEventFd(-1)
+ , mEnqueuePos(0)
+ , mDequeuePos(0)
+ , mMaxDepth(0)
+ , mFullCount(0)
+{
+  uint32_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  mMask = size - 1;
+  mCells = new Cell[size];
+  for (uint32_t i = 0; i < size; i++) {
+    mCells[i].mSequence = i;
+    mCells[i].mEvent = NULL;
+  }
+
+  if (!mWakeup) {
+    return;
+  }
+
+  mEventFd = eventfd(0, 0);
+  if (mEventFd < 0) {
+    ALOGE("%s: eventfd failed: %s", FUNC, strerror(errno));
+  }
+}
+
+NfcEventQueue::~NfcEventQueue()
+{
+  if (mEventFd >= 0) {
+    close(mEventFd);
+  }
+  delete [] mCells;
+}
+
+bool NfcEventQueue::push(NfcEvent* event)
+{
+  Cell* cell;
+  uint32_t pos = mEnqueuePos;
+
+  while (true) {
+    cell = &mCells[pos & mMask];
+    int32_t diff = (int32_t)(loadAcquire(&cell->mSequence) - pos);
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&mEnqueuePos, pos, pos + 1)) {
+        break;
+      }
+    } else if (diff < 0) {
+      __sync_fetch_and_add(&mFullCount, 1);
+      return false;
+    }
+    pos = mEnqueuePos;
+  }
+
+  cell->mEvent = event;
+  storeRelease(&cell->mSequence, pos + 1);
+
+  uint32_t depth = pos + 1 - mDequeuePos;
+  uint32_t maxDepth = mMaxDepth;
+  while (depth > maxDepth) {
+    if (__sync_bool_compare_and_swap(&mMaxDepth, maxDepth, depth)) {
+      break;
+    }
+    maxDepth = mMaxDepth;
+  }
+
+  if (!mWakeup) {
+    return true;
+  }
+
+  // Signal after publishing, so that a consumer woken up by this write is
+  // guaranteed to see the event.
+  uint64_t one = 1;
+  if (write(mEventFd, &one, sizeof(one)) != sizeof(one)) {
+    ALOGE("%s: eventfd write failed: %s", FUNC, strerror(errno));
+  }
+  return true;
+}
+
+NfcEvent* NfcEventQueue::pop()
+{
+  Cell* cell;
+  uint32_t pos = mDequeuePos;
+
+  while (true) {
+    cell = &mCells[pos & mMask];
+    int32_t diff = (int32_t)(loadAcquire(&cell->mSequence) - (pos + 1));
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&mDequeuePos, pos, pos + 1)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Empty, or a producer claimed the slot but has not published yet;
+      // its eventfd write will wake us up again.
+      return NULL;
+    }
+    pos = mDequeuePos;
+  }
+
+  NfcEvent* event = cell->mEvent;
+  cell->mEvent = NULL;
+  storeRelease(&cell->mSequence, pos + mMask + 1);
+  return event;
+}
+
+bool NfcEventQueue::wait()
+{
+  uint64_t count;
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
+  ssize_t ret;
+
+  do {
+    ret = read(mEventFd, &count, sizeof(count));
+  } while (ret < 0 && errno == EINTR);
+
+  NfcCounters::increment(NFC_STATS_EVENT_QUEUE_WAITS);
+  NfcCounters::addTimeUs(NFC_STATS_EVENT_QUEUE_WAIT_TIME_MS,
+                         NfcUtil::getMonotonicTimeUs() - start);
+
+  if (ret != sizeof(count)) {
+    ALOGE("%s: eventfd read failed: %s", FUNC, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+uint32_t NfcEventQueue::getDepth()
+{
+  return mEnqueuePos - mDequeuePos;
+}
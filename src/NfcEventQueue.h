@@ -0,0 +1,103 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcEventQueue_h
+#define mozilla_nfcd_NfcEventQueue_h
+
+#include <stdint.h>
+
+class NfcEvent;
+
+#define NFC_CACHE_LINE_SIZE 64
+
+/**
+ * Bounded multi-producer/single-consumer queue of NfcEvent pointers.
+ *
+ * Producers (NFA callback thread, IPC thread, presence-check threads) push
+ * without taking a lock; the NfcService thread is the only consumer. Each slot
+ * carries a sequence number so a producer can claim a slot with a single
+ * compare-and-swap on the enqueue position. The consumer sleeps on an eventfd
+ * which producers signal after publishing an event.
+ *
+ * Dequeuing claims slots with a compare-and-swap as well, so a queue created
+ * without wakeup can also serve as a lock-free free list.
+ */
+class NfcEventQueue {
+public:
+  /**
+   * @param capacity Maximum number of queued events, rounded up to a power
+   *                 of two.
+   * @param wakeup   Whether push() signals an eventfd for wait().
+   */
+  NfcEventQueue(uint32_t capacity, bool wakeup = true);
+  ~NfcEventQueue();
+
+  /**
+   * @return True if the eventfd used for wakeup was created.
+   */
+  bool isValid() { return !mWakeup || mEventFd >= 0; }
+
+  /**
+   * Queue an event and wake up the consumer. Safe to call from any thread.
+   *
+   * @param  event Event to be queued.
+   * @return       False if the queue is full.
+   */
+  bool push(NfcEvent* event);
+
+  /**
+   * Dequeue the oldest event.
+   *
+   * @return The event, or NULL if the queue is empty.
+   */
+  NfcEvent* pop();
+
+  /**
+   * Block until at least one push happened since the last wait. The blocked
+   * time is counted in NFC_STATS_EVENT_QUEUE_WAIT_TIME_MS.
+   *
+   * @return False if waiting on the eventfd failed.
+   */
+  bool wait();
+
+  /**
+   * @return Number of events currently queued.
+   */
+  uint32_t getDepth();
+
+  /**
+   * @return Highest number of events ever queued at once.
+   */
+  uint32_t getMaxDepth() { return mMaxDepth; }
+
+  /**
+   * @return Number of push attempts rejected because the queue was full.
+   */
+  uint32_t getFullCount() { return mFullCount; }
+
+private:
+  struct Cell {
+    volatile uint32_t mSequence;
+    NfcEvent* mEvent;
+  };
+
+  Cell* mCells;
+  uint32_t mMask;
+  bool mWakeup;
+  int mEventFd;
+
+  // Producer and consumer positions live on separate cache lines so that
+  // producers claiming slots do not keep invalidating the consumer's line.
+  char mPad0[NFC_CACHE_LINE_SIZE];
+  volatile uint32_t mEnqueuePos;
+  char mPad1[NFC_CACHE_LINE_SIZE - sizeof(uint32_t)];
+  volatile uint32_t mDequeuePos;
+  char mPad2[NFC_CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+  // Statistics.
+  volatile uint32_t mMaxDepth;
+  volatile uint32_t mFullCount;
+};
+
+#endif // mozilla_nfcd_NfcEventQueue_h
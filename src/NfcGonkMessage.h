@@ -30,7 +30,26 @@ extern "C" {
  *
  * Except Parcel size is encoded in Big-Endian, other data will be encoded in
  * Little-Endian.
+ *
+ * Request tokens (since version 1.8):
+ *    If NFC_MESSAGE_TOKEN_FLAG is set in the request type, the request type is
+ *    followed by 4 bytes of a client-chosen token. The response then carries
+ *    NFC_MESSAGE_TOKEN_FLAG in its response type and echoes the token right
+ *    after the error code. This lets a client have several requests in flight
+ *    and match each response to its request. Clients must only set the flag
+ *    if NfcNotificationInitialized reports version 1.8 or later.
+ *
+ * Statistics (since version 1.9):
+ *    NFC_REQUEST_GET_STATS returns the runtime counters and latency
+ *    histograms of nfcd in NfcStatsResponse. Since version 1.10 it also
+ *    returns the call counts and latencies of every request, response,
+ *    notification and internal event type.
+ */
+
+/**
+ * Flag in request and response types indicating a request token follows.
  */
+#define NFC_MESSAGE_TOKEN_FLAG 0x10000
 
 /**
  * Message types sent from NFCC (NFC Controller)
@@ -45,6 +64,10 @@ typedef enum {
  */
 typedef enum {
   NFC_ERROR_SUCCESS = 0,
+  NFC_ERROR_BUSY = 1,
+  NFC_ERROR_IO = 2,
+  NFC_ERROR_INVALID_REQUEST = 3,  // Malformed request, answered in NFC_RESPONSE_GENERAL.
+  NFC_ERROR_NOT_SUPPORTED = 4,    // Unknown request type, answered in NFC_RESPONSE_GENERAL.
 //TODO Error Code
 } NfcErrorCode;
 
@@ -181,6 +204,157 @@ typedef struct {
   NdefMessagePdu ndef;
 } NfcNdefReadWritePdu;
 
+/**
+ * Counters of NfcStatsResponse. Unless noted otherwise they count events
+ * since nfcd started and wrap around at 2^32.
+ */
+typedef enum {
+  NFC_STATS_TAPS = 0,               // Tags discovered.
+  // Discovered tags reporting each NfcTechnology, in the order of NfcTechnology.
+  NFC_STATS_TECH_NDEF,
+  NFC_STATS_TECH_NDEF_WRITABLE,
+  NFC_STATS_TECH_NDEF_FORMATABLE,
+  NFC_STATS_TECH_P2P,
+  NFC_STATS_TECH_NFCA,
+  NFC_STATS_TECH_NFCB,
+  NFC_STATS_TECH_NFCF,
+  NFC_STATS_TECH_NFCV,
+  NFC_STATS_TECH_ISO_DEP,
+  NFC_STATS_TECH_MIFARE_CLASSIC,
+  NFC_STATS_TECH_MIFARE_ULTRALIGHT,
+  NFC_STATS_TECH_BARCODE,
+  NFC_STATS_NDEF_READS,             // NDEF messages read from tags.
+  NFC_STATS_NDEF_READ_BYTES,        // Type, id and payload bytes of them.
+  NFC_STATS_NDEF_WRITES,            // NDEF messages written to tags.
+  NFC_STATS_NDEF_WRITE_BYTES,
+  NFC_STATS_NDEF_WRITE_FAILURES,
+  NFC_STATS_PRESENCE_CHECKS,
+  NFC_STATS_PRESENCE_FAILURES,      // Presence checks that found the tag gone.
+  NFC_STATS_SNEP_REQUESTS_SERVED,   // Requests answered by the SNEP servers.
+  NFC_STATS_SNEP_PUTS,              // PUT requests sent by SNEP clients.
+  NFC_STATS_HANDOVER_REQUESTS_SERVED,
+  NFC_STATS_HANDOVER_REQUESTS,      // Handover requests sent.
+  NFC_STATS_LLCP_CONGESTION_WAITS,  // LLCP sends that waited for the remote.
+  NFC_STATS_LLCP_TIMEOUTS,          // LLCP sends and receives that timed out.
+  NFC_STATS_EVENT_QUEUE_DEPTH,      // Current value.
+  NFC_STATS_EVENT_QUEUE_MAX_DEPTH,  // Highest value.
+  NFC_STATS_EVENT_QUEUE_FULL,       // Posts that found the queue full and retried.
+  NFC_STATS_IPC_BYTES_IN,
+  NFC_STATS_IPC_BYTES_OUT,
+  NFC_STATS_NDEF_CACHE_HITS,        // NDEF of read-only tags served without a read.
+  NFC_STATS_NDEF_CACHE_MISSES,
+  NFC_STATS_NDEF_CACHE_EXPIRATIONS, // Misses due to an entry past its TTL.
+  NFC_STATS_PRESENCE_RF_TIME_MS,    // Time spent waiting for presence checks.
+  NFC_STATS_NDEF_PROBE_CONNECTS,    // RF operations done to find the NDEF of tags.
+  NFC_STATS_NDEF_PROBE_CHECKS,
+  NFC_STATS_NDEF_PROBE_READS,
+  NFC_STATS_NDEF_PROBE_RF_TIME_MS,  // Time spent waiting for them.
+  NFC_STATS_EVENT_QUEUE_WAITS,      // Times the NfcService thread waited for an event.
+  NFC_STATS_EVENT_QUEUE_WAIT_TIME_MS, // Time it spent waiting, i.e. idle.
+  NFC_STATS_EVENT_POOL_HEAP_FALLBACKS, // Events allocated because the pool was empty.
+  NFC_STATS_IPC_MESSAGES_QUEUED,    // Responses and notifications queued for clients.
+  NFC_STATS_IPC_MESSAGES_SENT,
+  NFC_STATS_IPC_PENDING_BYTES,      // Current value, queued but not written yet.
+  NFC_STATS_IPC_MAX_PENDING_BYTES,  // Highest value.
+  NFC_STATS_IPC_CLIENTS_DROPPED,    // Clients closed for exceeding the high-water mark.
+  NFC_STATS_WORKER_TASKS_SUBMITTED, // LLCP connections handed to the worker pool.
+  NFC_STATS_WORKER_TASKS_REJECTED,  // Connections refused because the pool was saturated.
+  NFC_STATS_WORKER_TASKS_COMPLETED,
+  NFC_STATS_WORKER_BUSY,            // Current value, workers serving a connection.
+  NFC_STATS_WORKER_PENDING,         // Current value, connections waiting for a worker.
+
+  /**
+   * Not a counter. Keep it last.
+   */
+  NFC_STATS_COUNTER_END
+} NfcStatsCounter;
+
+/**
+ * Latency histograms of NfcStatsResponse.
+ */
+typedef enum {
+  NFC_STATS_HISTOGRAM_NDEF_READ = 0,  // NFC_REQUEST_READ_NDEF.
+  NFC_STATS_HISTOGRAM_NDEF_WRITE,     // NFC_REQUEST_WRITE_NDEF.
+  NFC_STATS_HISTOGRAM_TAP,            // RF activation until TECH_DISCOVERED is sent.
+  NFC_STATS_HISTOGRAM_TAG_REMOVAL,    // Last successful presence check until TECH_LOST.
+
+  /**
+   * Not a histogram. Keep it last.
+   */
+  NFC_STATS_HISTOGRAM_END
+} NfcStatsHistogram;
+
+typedef struct {
+  /**
+   * Number of samples.
+   */
+  uint32_t count;
+
+  /**
+   * Bucket 0 counts samples below 1us, bucket i samples in [2^(i-1), 2^i) us.
+   * Trailing empty buckets are left out.
+   */
+  uint32_t numBuckets;
+  uint32_t* buckets;
+} NfcStatsHistogramPdu;
+
+/**
+ * Dispatch tables of NfcStatsResponse.
+ */
+typedef enum {
+  NFC_STATS_DISPATCH_REQUEST = 0,   // Decoding of each NfcRequestType.
+  NFC_STATS_DISPATCH_RESPONSE,      // Encoding and sending of each NfcResponseType.
+  NFC_STATS_DISPATCH_NOTIFICATION,  // Same for each NfcNotificationType.
+  NFC_STATS_DISPATCH_EVENT,         // Internal events of the nfcd service thread.
+
+  /**
+   * Not a table. Keep it last.
+   */
+  NFC_STATS_DISPATCH_END
+} NfcStatsDispatchTable;
+
+typedef struct {
+  /**
+   * Message type of the entry. The types of NFC_STATS_DISPATCH_EVENT are
+   * internal to nfcd; they are only meant for diagnostics.
+   */
+  uint32_t type;
+  uint32_t calls;
+
+  /**
+   * Calls that took longer than the budget of the type. Always 0 for
+   * responses and notifications, which have no budget.
+   */
+  uint32_t overBudget;
+  NfcStatsHistogramPdu latency;
+} NfcStatsDispatchPdu;
+
+typedef struct {
+  uint32_t numEntries;
+  NfcStatsDispatchPdu* entries;
+} NfcStatsDispatchTablePdu;
+
+typedef struct {
+  /**
+   * Indexed by NfcStatsCounter. A newer nfcd may send more counters than
+   * a client knows of; the client skips them.
+   */
+  uint32_t numCounters;
+  uint32_t* counters;
+
+  /**
+   * Indexed by NfcStatsHistogram.
+   */
+  uint32_t numHistograms;
+  NfcStatsHistogramPdu* histograms;
+
+  /**
+   * Indexed by NfcStatsDispatchTable. Since version 1.10.
+   */
+  uint32_t numDispatchTables;
+  NfcStatsDispatchTablePdu* dispatchTables;
+} NfcStatsResponse;
+
 typedef enum {
   /**
    * NFC_REQUEST_CONFIG
@@ -268,6 +442,24 @@ typedef enum {
    * response is NULL.
    */
   NFC_REQUEST_MAKE_NDEF_READ_ONLY = 6,
+
+  /**
+   * NFC_REQUEST_GET_STATS
+   *
+   * Get the runtime statistics of nfcd. Answered without waiting for
+   * pending tag operations.
+   *
+   * data is NULL.
+   *
+   * response is NfcStatsResponse.
+   */
+  NFC_REQUEST_GET_STATS = 7,
+
+  /**
+   * Not a request. Keep it last; nfcd uses it to check that every request
+   * type is handled.
+   */
+  NFC_REQUEST_END
 } NfcRequestType;
 
 typedef enum {
@@ -278,6 +470,13 @@ typedef enum {
   NFC_RESPONSE_READ_NDEF_DETAILS = 1002,
 
   NFC_RESPONSE_READ_NDEF = 1003,
+
+  NFC_RESPONSE_STATS = 1004,
+
+  /**
+   * Not a response. Keep it last.
+   */
+  NFC_RESPONSE_END
 } NfcResponseType;
 
 typedef struct {
@@ -326,6 +525,11 @@ typedef enum {
    * previously discovered with NFC_NOTIFICATION_TECH_DISCOVERED.
    */
   NFC_NOTIFICATION_TECH_LOST = 2002,
+
+  /**
+   * Not a notification. Keep it last.
+   */
+  NFC_NOTIFICATION_END
 } NfcNotificationType;
 
 #ifdef __cplusplus
@@ -2,32 +2,94 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this file,
  * You can obtain one at http://mozilla.org/MPL/2.0/. */
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <poll.h>
 #include <pwd.h>
 #include <netinet/in.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <linux/prctl.h>
 #include <cutils/sockets.h>
 #include <cutils/record_stream.h>
 #include <unistd.h>
+#include <deque>
 #include <queue>
 #include <string>
+#include <vector>
 
 #include "IpcSocketListener.h"
 #include "NfcIpcSocket.h"
 #include "MessageHandler.h"
 #include "NfcDebug.h"
+#include "NfcTrace.h"
+#include "NfcCounters.h"
+#include "TapLatencyTracker.h"
 
 #define NFCD_SOCKET_NAME "nfcd"
 #define MAX_COMMAND_BYTES (8 * 1024)
+#define MAX_CLIENTS 64
+#define MAX_EPOLL_EVENTS 16
+// Maximum number of queued messages handed to a single writev().
+#define MAX_WRITE_MESSAGES 16
+#define DEFAULT_HIGH_WATER_MARK (256 * 1024)
 
 using android::Parcel;
 
-static int nfcdRw;
+/**
+ * A message waiting to be written to a client.
+ */
+struct NfcIpcMessage {
+  uint32_t mHeader; // Length of mBody, big-endian.
+  std::vector<uint8_t> mBody;
+  uint32_t mTapId;  // Tag tap notified by this message, 0 if none.
+};
+
+/**
+ * State of one connected IPC client.
+ */
+class NfcIpcClient {
+public:
+  NfcIpcClient(int id, int fd)
+   : mId(id)
+   , mFd(fd)
+   , mRs(record_stream_new(fd, MAX_COMMAND_BYTES))
+   , mSendOffset(0)
+   , mQueuedBytes(0)
+   , mIsWaitingForOut(false)
+   , mIsBroken(false)
+   , mIsClosed(false)
+  {
+  }
+
+  ~NfcIpcClient()
+  {
+    while (!mOutgoing.empty()) {
+      delete mOutgoing.front();
+      mOutgoing.pop_front();
+    }
+    record_stream_free(mRs);
+    close(mFd);
+  }
+
+  int mId;
+  int mFd;
+  RecordStream* mRs;
+
+  // Members below are protected by NfcIpcSocket::mMutex.
+  std::deque<NfcIpcMessage*> mOutgoing;
+  size_t mSendOffset;      // Bytes of mOutgoing.front() already written.
+  size_t mQueuedBytes;     // Bytes in mOutgoing not written yet.
+  bool mIsWaitingForOut;   // EPOLLOUT is enabled for this client.
+  bool mIsBroken;          // Client exceeded the high-water mark; close it.
+
+  // Only used by the IPC thread.
+  bool mIsClosed;          // Closed; freed once the current epoll batch is done.
+};
 
 MessageHandler* NfcIpcSocket::sMsgHandler = NULL;
 
@@ -43,11 +105,22 @@ NfcIpcSocket* NfcIpcSocket::Instance() {
 }
 
 NfcIpcSocket::NfcIpcSocket()
+ : mListener(NULL)
+ , mEpollFd(-1)
+ , mWakeupFd(-1)
+ , mNextClientId(0)
+ , mHighWaterMark(DEFAULT_HIGH_WATER_MARK)
 {
+  pthread_mutex_init(&mMutex, NULL);
+  memset(&mStats, 0, sizeof(mStats));
 }
 
 NfcIpcSocket::~NfcIpcSocket()
 {
+  if (mWakeupFd >= 0) {
+    close(mWakeupFd);
+  }
+  pthread_mutex_destroy(&mMutex);
 }
 
 void NfcIpcSocket::initialize(MessageHandler* msgHandler)
@@ -62,6 +135,11 @@ void NfcIpcSocket::initSocket()
   mSleep_spec.tv_nsec = 500 * 1000;
   mSleep_spec_rem.tv_sec = 0;
   mSleep_spec_rem.tv_nsec = 0;
+
+  mWakeupFd = eventfd(0, 0);
+  if (mWakeupFd < 0) {
+    ALOGE("eventfd failed errno:%d", errno);
+  }
 }
 
 int NfcIpcSocket::getListenSocket() {
@@ -71,7 +149,7 @@ int NfcIpcSocket::getListenSocket() {
     return -1;
   }
 
-  if (listen(nfcdConn, 4) != 0) {
+  if (listen(nfcdConn, MAX_CLIENTS) != 0) {
     return -1;
   }
   return nfcdConn;
@@ -81,78 +159,233 @@ void NfcIpcSocket::setSocketListener(IpcSocketListener* listener) {
   mListener = listener;
 }
 
+void NfcIpcSocket::setHighWaterMark(size_t bytes)
+{
+  pthread_mutex_lock(&mMutex);
+  mHighWaterMark = bytes;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void NfcIpcSocket::getStats(NfcIpcStats& stats)
+{
+  pthread_mutex_lock(&mMutex);
+  stats = mStats;
+  pthread_mutex_unlock(&mMutex);
+}
+
 void NfcIpcSocket::loop()
 {
-  bool connected = false;
-  int nfcdConn = -1;
-  int ret;
+  int nfcdConn;
+
+  while ((nfcdConn = getListenSocket()) < 0) {
+    nanosleep(&mSleep_spec, &mSleep_spec_rem);
+  }
+
+  if (fcntl(nfcdConn, F_SETFL, O_NONBLOCK) < 0) {
+    ALOGE("Error setting O_NONBLOCK on listen socket errno:%d", errno);
+  }
+
+  mEpollFd = epoll_create(MAX_EPOLL_EVENTS);
+  if (mEpollFd < 0) {
+    ALOGE("epoll_create failed errno:%d", errno);
+    return;
+  }
+
+  // The listen socket is registered with a NULL pointer, the wakeup eventfd
+  // with a pointer to mWakeupFd and clients with their NfcIpcClient object.
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, nfcdConn, &ev) < 0) {
+    ALOGE("epoll_ctl on listen socket failed errno:%d", errno);
+    return;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = &mWakeupFd;
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeupFd, &ev) < 0) {
+    ALOGE("epoll_ctl on wakeup fd failed errno:%d", errno);
+    return;
+  }
 
   while(1) {
-    struct sockaddr_un peeraddr;
-    socklen_t socklen = sizeof (peeraddr);
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int count = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ALOGE("epoll_wait failed errno:%d", errno);
+      break;
+    }
 
-    if (!connected) {
-      nfcdConn = getListenSocket();
-      if (nfcdConn < 0) {
-        nanosleep(&mSleep_spec, &mSleep_spec_rem);
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.ptr == NULL) {
+        acceptClients(nfcdConn);
         continue;
       }
+
+      if (events[i].data.ptr == &mWakeupFd) {
+        uint64_t value;
+        if (read(mWakeupFd, &value, sizeof(value)) != sizeof(value)) {
+          ALOGE("Failed to read wakeup fd errno:%d", errno);
+        }
+        flushClients();
+        continue;
+      }
+
+      // An earlier event of this batch may have closed the client already.
+      NfcIpcClient* client = reinterpret_cast<NfcIpcClient*>(events[i].data.ptr);
+      if (client->mIsClosed) {
+        continue;
+      }
+      if (events[i].events & EPOLLOUT) {
+        pthread_mutex_lock(&mMutex);
+        bool ok = flushClientLocked(client);
+        pthread_mutex_unlock(&mMutex);
+        if (!ok) {
+          closeClient(client);
+          continue;
+        }
+      }
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        readClient(client);
+      }
     }
 
-    nfcdRw = accept(nfcdConn, (struct sockaddr*)&peeraddr, &socklen);
+    freeClosedClients();
+  }
+
+  close(mEpollFd);
+  mEpollFd = -1;
+}
+
+void NfcIpcSocket::acceptClients(int listenFd)
+{
+  while (true) {
+    struct sockaddr_un peeraddr;
+    socklen_t socklen = sizeof (peeraddr);
+
+    int fd = accept(listenFd, (struct sockaddr*)&peeraddr, &socklen);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        ALOGE("Error on accept() errno:%d", errno);
+      }
+      return;
+    }
 
-    if (nfcdRw < 0 ) {
-      ALOGE("Error on accept() errno:%d", errno);
-      /* start listening for new connections again */
+    pthread_mutex_lock(&mMutex);
+    size_t numClients = mClients.size();
+    pthread_mutex_unlock(&mMutex);
+    if (numClients >= MAX_CLIENTS) {
+      ALOGE("Too many clients, rejecting connection");
+      close(fd);
       continue;
     }
 
-    ret = fcntl(nfcdRw, F_SETFL, O_NONBLOCK);
-    if (ret < 0) {
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
       ALOGE ("Error setting O_NONBLOCK errno:%d", errno);
     }
 
-    ALOGD("Socket connected");
-    connected = true;
+    NfcIpcClient* client = new NfcIpcClient(mNextClientId++, fd);
 
-    RecordStream *rs = record_stream_new(nfcdRw, MAX_COMMAND_BYTES);
-
-    mListener->onConnected();
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      ALOGE("epoll_ctl on client socket failed errno:%d", errno);
+      delete client;
+      continue;
+    }
 
-    struct pollfd fds[1];
-    fds[0].fd = nfcdRw;
-    fds[0].events = POLLIN;
-    fds[0].revents = 0;
+    pthread_mutex_lock(&mMutex);
+    mClients[client->mId] = client;
+    pthread_mutex_unlock(&mMutex);
 
-    while(connected) {
-      poll(fds, 1, -1);
-      if(fds[0].revents > 0) {
-        fds[0].revents = 0;
+    ALOGD("Socket connected, client=%d", client->mId);
+    mListener->onConnected(client->mId);
+  }
+}
 
-        void* data;
-        size_t dataLen;
-        int ret = record_stream_get_next(rs, &data, &dataLen);
-        ALOGD(" %d of bytes to be sent... data=%p ret=%d", dataLen, data, ret);
-        if (ret == 0 && data == NULL) {
-          // end-of-stream
-          break;
-        } else if (ret < 0) {
-          break;
-        }
-        writeToIncomingQueue((uint8_t*)data, dataLen);
+void NfcIpcSocket::readClient(NfcIpcClient* client)
+{
+  while (true) {
+    void* data;
+    size_t dataLen;
+    int ret = record_stream_get_next(client->mRs, &data, &dataLen);
+    if (ret == 0 && data == NULL) {
+      // end-of-stream
+      break;
+    } else if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Wait for the rest of the record.
+        return;
       }
+      ALOGE("Error reading from client %d errno:%d", client->mId, errno);
+      break;
     }
-    record_stream_free(rs);
-    close(nfcdRw);
+    ALOGD(" %d of bytes to be sent... data=%p ret=%d", dataLen, data, ret);
+    NFC_TRACE_IO(NFC_TRACE_IPC_READ, NFC_TRACE_INSTANT, client->mId, dataLen);
+    NfcCounters::add(NFC_STATS_IPC_BYTES_IN, sizeof(uint32_t) + dataLen);
+    writeToIncomingQueue(client->mId, (uint8_t*)data, dataLen);
   }
 
-  return;
+  closeClient(client);
+}
+
+void NfcIpcSocket::closeClient(NfcIpcClient* client)
+{
+  if (client->mIsClosed) {
+    return;
+  }
+
+  ALOGD("Socket disconnected, client=%d", client->mId);
+
+  epoll_ctl(mEpollFd, EPOLL_CTL_DEL, client->mFd, NULL);
+
+  // Once removed from mClients no other thread can reach the client.
+  pthread_mutex_lock(&mMutex);
+  mClients.erase(client->mId);
+  mStats.pendingBytes -= client->mQueuedBytes;
+  pthread_mutex_unlock(&mMutex);
+
+  // Later events of the current epoll batch may still point to the client,
+  // so it is only freed once the batch is done.
+  client->mIsClosed = true;
+  mClosedClients.push_back(client);
+}
+
+void NfcIpcSocket::freeClosedClients()
+{
+  for (size_t i = 0; i < mClosedClients.size(); i++) {
+    delete mClosedClients[i];
+  }
+  mClosedClients.clear();
 }
 
 // Write NFC data to Gecko
-// Outgoing queue contain the data should be send to gecko
-// TODO check thread, this should run on the NfcService thread.
-void NfcIpcSocket::writeToOutgoingQueue(uint8_t* data, size_t dataLen)
+// Messages are queued per client here and written out by the IPC thread.
+void NfcIpcSocket::writeToOutgoingQueue(int clientId, uint8_t* data, size_t dataLen)
+{
+  ALOGD("%s enter, client=%d, data=%p, dataLen=%d", __func__, clientId, data, dataLen);
+
+  if (data == NULL || dataLen == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  std::map<int, NfcIpcClient*>::iterator it = mClients.find(clientId);
+  if (it != mClients.end()) {
+    queueMessageLocked(it->second, data, dataLen);
+  } else {
+    ALOGE("Client %d is gone, dropping message", clientId);
+  }
+  pthread_mutex_unlock(&mMutex);
+
+  wakeup();
+}
+
+void NfcIpcSocket::broadcastToOutgoingQueue(uint8_t* data, size_t dataLen)
 {
   ALOGD("%s enter, data=%p, dataLen=%d", __func__, data, dataLen);
 
@@ -160,35 +393,171 @@ void NfcIpcSocket::writeToOutgoingQueue(uint8_t* data, size_t dataLen)
     return;
   }
 
-  size_t writeOffset = 0;
-  int written = 0;
+  pthread_mutex_lock(&mMutex);
+  for (std::map<int, NfcIpcClient*>::iterator it = mClients.begin();
+       it != mClients.end(); ++it) {
+    queueMessageLocked(it->second, data, dataLen);
+  }
+  pthread_mutex_unlock(&mMutex);
 
-  size_t size = __builtin_bswap32(dataLen);
-  write(nfcdRw, (void*)&size, sizeof(uint32_t));
+  wakeup();
+}
 
-  ALOGD("Writing %d bytes to gecko ", dataLen);
-  while (writeOffset < dataLen) {
+void NfcIpcSocket::queueMessageLocked(NfcIpcClient* client, uint8_t* data, size_t dataLen)
+{
+  if (client->mIsBroken) {
+    return;
+  }
+
+  size_t size = sizeof(uint32_t) + dataLen;
+  if (client->mQueuedBytes + size > mHighWaterMark) {
+    // The client stopped reading. Dropping single messages would leave it
+    // with a corrupt view of the protocol, so disconnect it instead.
+    ALOGE("Client %d exceeded high-water mark (%u bytes queued), closing",
+          client->mId, (unsigned)client->mQueuedBytes);
+    client->mIsBroken = true;
+    mStats.clientsDropped++;
+    return;
+  }
+
+  NfcIpcMessage* msg = new NfcIpcMessage();
+  msg->mHeader = __builtin_bswap32(dataLen);
+  msg->mBody.assign(data, data + dataLen);
+  msg->mTapId = TapLatencyTracker::Instance()->onMessageQueued();
+  client->mOutgoing.push_back(msg);
+  client->mQueuedBytes += size;
+
+  mStats.messagesQueued++;
+  mStats.pendingBytes += size;
+  if (mStats.pendingBytes > mStats.maxPendingBytes) {
+    mStats.maxPendingBytes = mStats.pendingBytes;
+  }
+}
+
+void NfcIpcSocket::wakeup()
+{
+  uint64_t one = 1;
+  if (write(mWakeupFd, &one, sizeof(one)) != sizeof(one)) {
+    ALOGE("Failed to wake up IPC thread errno:%d", errno);
+  }
+}
+
+void NfcIpcSocket::flushClients()
+{
+  std::vector<NfcIpcClient*> broken;
+
+  pthread_mutex_lock(&mMutex);
+  for (std::map<int, NfcIpcClient*>::iterator it = mClients.begin();
+       it != mClients.end(); ++it) {
+    NfcIpcClient* client = it->second;
+    if (client->mIsBroken) {
+      broken.push_back(client);
+      continue;
+    }
+    // Clients waiting for EPOLLOUT are flushed when the socket drains.
+    if (client->mIsWaitingForOut) {
+      continue;
+    }
+    if (!flushClientLocked(client)) {
+      broken.push_back(client);
+    }
+  }
+  pthread_mutex_unlock(&mMutex);
+
+  for (size_t i = 0; i < broken.size(); i++) {
+    closeClient(broken[i]);
+  }
+}
+
+bool NfcIpcSocket::flushClientLocked(NfcIpcClient* client)
+{
+  if (client->mIsBroken) {
+    return false;
+  }
+
+  while (!client->mOutgoing.empty()) {
+    // Header and body of several messages go out in a single writev().
+    struct iovec iov[MAX_WRITE_MESSAGES * 2];
+    int iovCount = 0;
+    size_t offset = client->mSendOffset;
+
+    for (std::deque<NfcIpcMessage*>::iterator it = client->mOutgoing.begin();
+         it != client->mOutgoing.end() && iovCount < MAX_WRITE_MESSAGES * 2; ++it) {
+      NfcIpcMessage* msg = *it;
+      if (offset < sizeof(uint32_t)) {
+        iov[iovCount].iov_base = reinterpret_cast<uint8_t*>(&msg->mHeader) + offset;
+        iov[iovCount].iov_len = sizeof(uint32_t) - offset;
+        iovCount++;
+        offset = 0;
+      } else {
+        offset -= sizeof(uint32_t);
+      }
+      iov[iovCount].iov_base = &msg->mBody[offset];
+      iov[iovCount].iov_len = msg->mBody.size() - offset;
+      iovCount++;
+      offset = 0;
+    }
+
+    ssize_t written;
     do {
-      written = write (nfcdRw, data + writeOffset, dataLen - writeOffset);
+      written = writev(client->mFd, iov, iovCount);
     } while (written < 0 && errno == EINTR);
 
-    if (written >= 0) {
-      writeOffset += written;
-    } else {
+    if (written < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
       ALOGE("Response: unexpected error on write errno:%d", errno);
-      break;
+      return false;
+    }
+
+    NFC_TRACE_IO(NFC_TRACE_IPC_WRITE, NFC_TRACE_INSTANT, client->mId, written);
+    NfcCounters::add(NFC_STATS_IPC_BYTES_OUT, written);
+    mStats.pendingBytes -= written;
+    client->mQueuedBytes -= written;
+
+    size_t remaining = written;
+    while (remaining > 0) {
+      NfcIpcMessage* msg = client->mOutgoing.front();
+      size_t left = sizeof(uint32_t) + msg->mBody.size() - client->mSendOffset;
+      if (remaining < left) {
+        client->mSendOffset += remaining;
+        break;
+      }
+      remaining -= left;
+      client->mSendOffset = 0;
+      client->mOutgoing.pop_front();
+      if (msg->mTapId) {
+        TapLatencyTracker::Instance()->onMessageWritten(msg->mTapId);
+      }
+      delete msg;
+      mStats.messagesSent++;
     }
   }
+
+  // Only ask for EPOLLOUT while there is something left to write.
+  bool needOut = !client->mOutgoing.empty();
+  if (needOut != client->mIsWaitingForOut) {
+    struct epoll_event ev;
+    ev.events = needOut ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = client;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, client->mFd, &ev) < 0) {
+      ALOGE("epoll_ctl on client socket failed errno:%d", errno);
+      return false;
+    }
+    client->mIsWaitingForOut = needOut;
+  }
+  return true;
 }
 
 // Write Gecko data to NFC
 // Incoming queue contains
 // TODO check thread, this should run on top of main thread of nfcd.
-void NfcIpcSocket::writeToIncomingQueue(uint8_t* data, size_t dataLen)
+void NfcIpcSocket::writeToIncomingQueue(int clientId, uint8_t* data, size_t dataLen)
 {
-  ALOGD("%s enter, data=%p, dataLen=%d", __func__, data, dataLen);
+  ALOGD("%s enter, client=%d, data=%p, dataLen=%d", __func__, clientId, data, dataLen);
 
   if (data != NULL && dataLen > 0) {
-    sMsgHandler->processRequest(data, dataLen);
+    sMsgHandler->processRequest(clientId, data, dataLen);
   }
 }
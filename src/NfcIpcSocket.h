@@ -7,10 +7,25 @@
 
 #include <pthread.h>
 #include <time.h>
+#include <map>
+#include <vector>
 #include <binder/Parcel.h>
 
 class MessageHandler;
 class IpcSocketListener;
+class NfcIpcClient;
+
+/**
+ * Counters of the outgoing message queues, summed over all clients. They are
+ * reported by NFC_REQUEST_GET_STATS and wrap around at 2^32 like the others.
+ */
+struct NfcIpcStats {
+  uint32_t messagesQueued;
+  uint32_t messagesSent;
+  uint32_t pendingBytes;     // Queued but not written yet.
+  uint32_t maxPendingBytes;
+  uint32_t clientsDropped;   // Clients closed for exceeding the high-water mark.
+};
 
 class NfcIpcSocket{
 private:
@@ -25,8 +40,43 @@ public:
 
   void setSocketListener(IpcSocketListener* lister);
 
-  void writeToOutgoingQueue(uint8_t *data, size_t dataLen);
-  void writeToIncomingQueue(uint8_t *data, size_t dataLen);
+  /**
+   * Set the maximum number of bytes that may be queued for one client. A
+   * client that does not read fast enough to stay below it is disconnected.
+   *
+   * @param  bytes High-water mark in bytes.
+   * @return       None.
+   */
+  void setHighWaterMark(size_t bytes);
+
+  /**
+   * Get a snapshot of the outgoing queue counters.
+   *
+   * @param  stats Filled with the counters.
+   * @return       None.
+   */
+  void getStats(NfcIpcStats& stats);
+
+  /**
+   * Send a message to one client.
+   *
+   * @param  clientId Client to send to, as passed to onConnected().
+   * @param  data     Message to send.
+   * @param  dataLen  Length of the message.
+   * @return          None.
+   */
+  void writeToOutgoingQueue(int clientId, uint8_t *data, size_t dataLen);
+
+  /**
+   * Send a message to every connected client.
+   *
+   * @param  data    Message to send.
+   * @param  dataLen Length of the message.
+   * @return         None.
+   */
+  void broadcastToOutgoingQueue(uint8_t *data, size_t dataLen);
+
+  void writeToIncomingQueue(int clientId, uint8_t *data, size_t dataLen);
 
 private:
   NfcIpcSocket();
@@ -38,8 +88,33 @@ private:
 
   IpcSocketListener* mListener;
 
+  int mEpollFd;
+  int mWakeupFd;
+  int mNextClientId;
+
+  // mClients is modified by the IPC thread and read by the threads sending
+  // responses and notifications. mClients, the clients' outgoing queues,
+  // mHighWaterMark and mStats are protected by mMutex.
+  pthread_mutex_t mMutex;
+  std::map<int, NfcIpcClient*> mClients;
+  size_t mHighWaterMark;
+  NfcIpcStats mStats;
+
+  // Clients closed during the current epoll batch. Only used by the IPC thread.
+  std::vector<NfcIpcClient*> mClosedClients;
+
   void initSocket();
   int getListenSocket();
+
+  void acceptClients(int listenFd);
+  void readClient(NfcIpcClient* client);
+  void closeClient(NfcIpcClient* client);
+  void freeClosedClients();
+
+  void queueMessageLocked(NfcIpcClient* client, uint8_t* data, size_t dataLen);
+  void wakeup();
+  void flushClients();
+  bool flushClientLocked(NfcIpcClient* client);
 };
 
 #endif // mozilla_nfcd_NfcIpcSocket_h
@@ -3,7 +3,7 @@
  * You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
 #include <stdlib.h>
 
 #include "MessageHandler.h"
@@ -15,56 +15,94 @@
 #include "NfcService.h"
 #include "NfcUtil.h"
 #include "NfcDebug.h"
+#include "NdefMessage.h"
+#include "NdefRecord.h"
+#include "NfcEvent.h"
+#include "NfcTagWorker.h"
+#include "NfcTrace.h"
+#include "NfcWorkerPool.h"
 #include "P2pLinkManager.h"
+#include "PresenceCheckScheduler.h"
+#include "TapLatencyTracker.h"
 
 using namespace android;
 
-typedef enum {
-  MSG_UNDEFINED = 0,
-  MSG_LLCP_LINK_ACTIVATION,
-  MSG_LLCP_LINK_DEACTIVATION,
-  MSG_TAG_DISCOVERED,
-  MSG_TAG_LOST,
-  MSG_SE_FIELD_ACTIVATED,
-  MSG_SE_FIELD_DEACTIVATED,
-  MSG_SE_NOTIFY_TRANSACTION_LISTENERS,
-  MSG_READ_NDEF_DETAIL,
-  MSG_READ_NDEF,
-  MSG_WRITE_NDEF,
-  MSG_CLOSE,
-  MSG_SOCKET_CONNECTED,
-  MSG_PUSH_NDEF,
-  MSG_NDEF_TAG_LIST,
-  MSG_CONFIG,
-  MSG_MAKE_NDEF_READONLY,
-  MSG_LOW_POWER,
-  MSG_ENABLE,
-} NfcEventType;
-
-class NfcEvent {
-public:
-  NfcEvent (NfcEventType type) :mType(type) {}
-
-  NfcEventType getType() { return mType; }
-
-  int arg1;
-  int arg2;
-  void* obj;
-
-private:
-  NfcEventType mType;
-};
-
 static pthread_t thread_id;
-static sem_t thread_sem;
+
+// Upper bound of pending events; producers back off when it is reached.
+#define EVENT_QUEUE_CAPACITY 256
+// Slots IPC requests may not take. Vendor callbacks always find room then,
+// rather than spinning behind a client that floods requests.
+#define EVENT_QUEUE_VENDOR_RESERVE 32
+
+// When set, tap latency percentiles are written to this file on disable.
+#define TAP_LATENCY_REPORT_ENV "NFCD_TAP_LATENCY_REPORT"
 
 NfcService* NfcService::sInstance = NULL;
 NfcManager* NfcService::sNfcManager = NULL;
 
+// Indexed by event type. Events flagged allowedInP2p are expected while an
+// LLCP link is up; anything else arriving then is logged.
+const NfcService::EventEntry NfcService::sEventTable[] = {
+  { MSG_UNDEFINED, "UNDEFINED", NULL, true, 0 },
+  { MSG_LLCP_LINK_ACTIVATION, "LLCP_LINK_ACTIVATION",
+    &NfcService::handleLlcpLinkActivation, true, 100000 },
+  { MSG_LLCP_LINK_DEACTIVATION, "LLCP_LINK_DEACTIVATION",
+    &NfcService::handleLlcpLinkDeactivation, true, 100000 },
+  { MSG_TAG_DISCOVERED, "TAG_DISCOVERED",
+    &NfcService::handleTagDiscovered, false, 10000 },
+  { MSG_TAG_LOST, "TAG_LOST",
+    &NfcService::handleTagLost, false, 10000 },
+  { MSG_SE_FIELD_ACTIVATED, "SE_FIELD_ACTIVATED", NULL, true, 0 },
+  { MSG_SE_FIELD_DEACTIVATED, "SE_FIELD_DEACTIVATED", NULL, true, 0 },
+  { MSG_SE_NOTIFY_TRANSACTION_LISTENERS, "SE_NOTIFY_TRANSACTION_LISTENERS", NULL, true, 0 },
+  { MSG_READ_NDEF_DETAIL, "READ_NDEF_DETAIL",
+    &NfcService::handleReadNdefDetailResponse, false, 10000 },
+  { MSG_READ_NDEF, "READ_NDEF",
+    &NfcService::handleReadNdefResponse, false, 10000 },
+  { MSG_WRITE_NDEF, "WRITE_NDEF",
+    &NfcService::handleWriteNdefResponse, true, 1000000 },
+  { MSG_CLOSE, "CLOSE",
+    &NfcService::handleCloseResponse, false, 100000 },
+  { MSG_SOCKET_CONNECTED, "SOCKET_CONNECTED",
+    &NfcService::handleSocketConnected, true, 10000 },
+  { MSG_PUSH_NDEF, "PUSH_NDEF",
+    &NfcService::handlePushNdefResponse, true, 1000000 },
+  { MSG_NDEF_TAG_LIST, "NDEF_TAG_LIST", NULL, false, 0 },
+  { MSG_CONFIG, "CONFIG",
+    &NfcService::handleConfigResponse, true, 10000 },
+  { MSG_MAKE_NDEF_READONLY, "MAKE_NDEF_READONLY",
+    &NfcService::handleMakeNdefReadonlyResponse, false, 10000 },
+  { MSG_LOW_POWER, "LOW_POWER",
+    &NfcService::handleEnterLowPowerResponse, true, 500000 },
+  { MSG_ENABLE, "ENABLE",
+    &NfcService::handleEnableResponse, true, 2000000 },
+  { MSG_CONNECT, "CONNECT",
+    &NfcService::handleConnectResponse, false, 10000 },
+  { MSG_TAG_OP_COMPLETE, "TAG_OP_COMPLETE",
+    &NfcService::handleTagOpComplete, true, 100000 },
+};
+
 NfcService::NfcService()
  : mIsEnabled(false)
+ , mIsLlcpActive(false)
+ , mQueue(EVENT_QUEUE_CAPACITY)
+ , mEventPool(EVENT_QUEUE_CAPACITY)
 {
+  NFC_STATIC_ASSERT(sizeof(sEventTable) / sizeof(sEventTable[0]) == MSG_END,
+                    event_table_complete);
+
+  for (int i = 0; i < MSG_END; i++) {
+    if (sEventTable[i].type != i) {
+      ALOGE("%s: event table out of order at %d", FUNC, i);
+      abort();
+    }
+  }
+
   mP2pLinkManager = new P2pLinkManager(this);
+
+  // Created here, before the vendor and IPC threads start reporting to it.
+  TapLatencyTracker::Instance();
 }
 
 NfcService::~NfcService()
@@ -81,8 +119,8 @@ static void *serviceThreadFunc(void *arg)
 
 void NfcService::initialize(NfcManager* pNfcManager, MessageHandler* msgHandler)
 {
-  if (sem_init(&thread_sem, 0, 0) == -1) {
-    ALOGE("%s: init_nfc_service Semaphore creation failed", FUNC);
+  if (!mQueue.isValid()) {
+    ALOGE("%s: init_nfc_service event queue creation failed", FUNC);
     abort();
   }
 
@@ -98,83 +136,97 @@ void NfcService::initialize(NfcManager* pNfcManager, MessageHandler* msgHandler)
 void NfcService::notifyLlcpLinkActivated(IP2pDevice* pDevice)
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_LLCP_LINK_ACTIVATION);
-  event->obj = reinterpret_cast<void*>(pDevice);
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_LLCP_LINK_ACTIVATION);
+  event->setP2pDevice(pDevice);
+  NfcService::Instance()->postEvent(event);
 }
 
 void NfcService::notifyLlcpLinkDeactivated(IP2pDevice* pDevice)
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_LLCP_LINK_DEACTIVATION);
-  event->obj = reinterpret_cast<void*>(pDevice);
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_LLCP_LINK_DEACTIVATION);
+  event->setP2pDevice(pDevice);
+  NfcService::Instance()->postEvent(event);
+}
+
+/**
+ * @return Type, id and payload bytes of all records of an NDEF message.
+ */
+static uint32_t getNdefSize(NdefMessage* ndef)
+{
+  uint32_t size = 0;
+  for (size_t i = 0; i < ndef->mRecords.size(); i++) {
+    NdefRecord& record = ndef->mRecords[i];
+    size += record.mType.size() + record.mId.size() + record.mPayload.size();
+  }
+  return size;
 }
 
 void NfcService::notifyTagDiscovered(INfcTag* pTag)
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_TAG_DISCOVERED);
-  event->obj = reinterpret_cast<void*>(pTag);
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcCounters::increment(NFC_STATS_TAPS);
+  TapLatencyTracker::Instance()->onDiscovered(pTag);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_TAG_DISCOVERED);
+  event->setTag(pTag);
+  NfcService::Instance()->postEvent(event);
+}
+
+void NfcService::notifyTagOpComplete(NfcTagOp* op)
+{
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_TAG_OP_COMPLETE);
+  event->setTagOp(op);
+  NfcService::Instance()->postEvent(event);
 }
 
 void NfcService::notifyTagLost()
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_TAG_LOST);
-  event->obj = NULL;
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_TAG_LOST);
+  NfcService::Instance()->postEvent(event);
 }
 
 void NfcService::notifySEFieldActivated()
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_SE_FIELD_ACTIVATED);
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_SE_FIELD_ACTIVATED);
+  NfcService::Instance()->postEvent(event);
 }
 
 void NfcService::notifySEFieldDeactivated()
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_SE_FIELD_DEACTIVATED);
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_SE_FIELD_DEACTIVATED);
+  NfcService::Instance()->postEvent(event);
 }
 
 void NfcService::notifySETransactionListeners()
 {
   ALOGD("%s: enter", FUNC);
-  NfcEvent *event = new NfcEvent(MSG_SE_NOTIFY_TRANSACTION_LISTENERS);
-  NfcService::Instance()->mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = NfcService::Instance()->mEventPool.obtain(MSG_SE_NOTIFY_TRANSACTION_LISTENERS);
+  NfcService::Instance()->postEvent(event);
 }
 
 void NfcService::handleLlcpLinkDeactivation(NfcEvent* event)
 {
   ALOGD("%s: enter", FUNC);
 
-  void* pDevice = event->obj;
-  IP2pDevice* pIP2pDevice = reinterpret_cast<IP2pDevice*>(pDevice);
+  IP2pDevice* pIP2pDevice = event->getP2pDevice();
 
   if (pIP2pDevice->getMode() == NfcDepEndpoint::MODE_P2P_TARGET) {
     pIP2pDevice->disconnect();
   }
 
+  mIsLlcpActive = false;
   mP2pLinkManager->onLlcpDeactivated();
   mMsgHandler->processNotification(NFC_NOTIFICATION_TECH_LOST, NULL);
+  PresenceCheckScheduler::Instance()->onTechLostNotified();
 }
 
 void NfcService::handleLlcpLinkActivation(NfcEvent* event)
 {
   ALOGD("%s: enter", FUNC);
-  void* pDevice = event->obj;
-  IP2pDevice* pIP2pDevice = reinterpret_cast<IP2pDevice*>(pDevice);
+  IP2pDevice* pIP2pDevice = event->getP2pDevice();
 
   if (pIP2pDevice->getMode() == NfcDepEndpoint::MODE_P2P_TARGET ||
       pIP2pDevice->getMode() == NfcDepEndpoint::MODE_P2P_INITIATOR) {
@@ -204,6 +256,7 @@ void NfcService::handleLlcpLinkActivation(NfcEvent* event)
     //stop();
   }
 
+  mIsLlcpActive = true;
   mP2pLinkManager->onLlcpActivated();
 
   TechDiscoveredEvent* data = new TechDiscoveredEvent();
@@ -218,30 +271,41 @@ void NfcService::handleLlcpLinkActivation(NfcEvent* event)
   ALOGD("%s: exit", FUNC);
 }
 
-static void *pollingThreadFunc(void *arg)
+void NfcService::handleTagDiscovered(NfcEvent* event)
 {
-  INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(arg);
-
-  // TODO : check if check tag presence here is correct
-  // For android. it use startPresenceChecking API in INfcTag.java
-  while (pINfcTag->presenceCheck()) {
-    sleep(1);
+  if (!mIsEnabled) {
+    ALOGW("%s: NFC is disabled, dropping tag", FUNC);
+    return;
   }
 
-  pINfcTag->disconnect();
+  INfcTag* pINfcTag = event->getTag();
+  TapLatencyTracker::Instance()->onDispatched(pINfcTag);
 
-  NfcService::Instance()->notifyTagLost();
-  return NULL;
+  // To get complete tag information, need to call read ndef first.
+  // In readNdef function, it will add NDEF related info in NfcTagManager.
+  NfcTagOp* op = new NfcTagOp(NFC_TAG_OP_DISCOVER, pINfcTag,
+                              &NfcService::handleTagDiscoveredComplete);
+  NfcTagWorker::Instance()->submit(op);
 }
 
-void NfcService::handleTagDiscovered(NfcEvent* event)
+void NfcService::handleTagDiscoveredComplete(NfcTagOp* op)
 {
-  void* pTag = event->obj;
-  INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(pTag);
+  INfcTag* pINfcTag = op->tag;
+  NdefMessage* pNdefMessage = op->ndef;
 
-  // To get complete tag information, need to call read ndef first.
-  // In readNdef function, it will add NDEF related info in NfcTagManager.
-  NdefMessage* pNdefMessage = pINfcTag->readNdef();
+  // NFC was disabled or the tag was lost meanwhile; neither notify the tag
+  // nor restart presence checks for it.
+  if (op->isCancelled) {
+    ALOGD("%s: tag session ended, dropping tag", FUNC);
+    delete pNdefMessage;
+    return;
+  }
+
+  TapLatencyTracker* tracker = TapLatencyTracker::Instance();
+  if (pNdefMessage) {
+    NfcCounters::increment(NFC_STATS_NDEF_READS);
+    NfcCounters::add(NFC_STATS_NDEF_READ_BYTES, getNdefSize(pNdefMessage));
+  }
 
   // Do the following after read ndef.
   std::vector<TagTechnology>& techList = pINfcTag->getTechList();
@@ -250,6 +314,9 @@ void NfcService::handleTagDiscovered(NfcEvent* event)
   uint8_t* gonkTechList = new uint8_t[techCount];
   for(int i = 0; i < techCount; i++) {
     gonkTechList[i] = (uint8_t)NfcUtil::convertTagTechToGonkFormat(techList[i]);
+    if (gonkTechList[i] <= NFC_TECH_BARCODE) {
+      NfcCounters::increment((NfcStatsCounter)(NFC_STATS_TECH_NDEF + gonkTechList[i]));
+    }
   }
 
   TechDiscoveredEvent* data = new TechDiscoveredEvent();
@@ -258,88 +325,135 @@ void NfcService::handleTagDiscovered(NfcEvent* event)
   data->techList = gonkTechList;
   data->ndefMsgCount = pNdefMessage ? 1 : 0;
   data->ndefMsg = pNdefMessage;
+  tracker->beginNotify(pINfcTag);
   mMsgHandler->processNotification(NFC_NOTIFICATION_TECH_DISCOVERED, data);
+  tracker->endNotify();
 
   delete gonkTechList;
   delete data;
+  delete pNdefMessage;
 
-  pthread_t tid;
-  pthread_create(&tid, NULL, pollingThreadFunc, pINfcTag);
+  PresenceCheckScheduler::Instance()->start(pINfcTag);
 }
 
 void NfcService::handleTagLost(NfcEvent* event)
 {
+  // A discovery still pending on the worker would otherwise notify the lost
+  // tag after TECH_LOST and restart presence checks on it.
+  NfcTagWorker::Instance()->cancelAll();
   mMsgHandler->processNotification(NFC_NOTIFICATION_TECH_LOST, NULL);
+  PresenceCheckScheduler::Instance()->onTechLostNotified();
 }
 
 void* NfcService::eventLoop()
 {
   ALOGD("%s: NFCService started", FUNC);
   while(true) {
-    if(sem_wait(&thread_sem)) {
-      ALOGE("%s: Failed to wait for semaphore", FUNC);
+    if (!mQueue.wait()) {
+      ALOGE("%s: Failed to wait for event queue", FUNC);
       abort();
     }
 
-    while (!mQueue.empty()) {
-      NfcEvent* event = *mQueue.begin();
-      mQueue.erase(mQueue.begin());
-      NfcEventType eventType = event->getType();
-
-      ALOGD("%s: NFCService msg=%d", FUNC, eventType);
-      switch(eventType) {
-        case MSG_LLCP_LINK_ACTIVATION:
-          handleLlcpLinkActivation(event);
-          break;
-        case MSG_LLCP_LINK_DEACTIVATION:
-          handleLlcpLinkDeactivation(event);
-          break;
-        case MSG_TAG_DISCOVERED:
-          handleTagDiscovered(event);
-          break;
-        case MSG_TAG_LOST:
-          handleTagLost(event);
-          break;
-        case MSG_CONFIG:
-          handleConfigResponse(event);
-          break;
-        case MSG_READ_NDEF_DETAIL:
-          handleReadNdefDetailResponse(event);
-        case MSG_READ_NDEF:
-          handleReadNdefResponse(event);
-          break;
-        case MSG_WRITE_NDEF:
-          handleWriteNdefResponse(event);
-          break;
-        case MSG_CLOSE:
-          handleCloseResponse(event);
-          break;
-        case MSG_SOCKET_CONNECTED:
-          mMsgHandler->processNotification(NFC_NOTIFICATION_INITIALIZED , NULL);
-          break;
-        case MSG_PUSH_NDEF:
-          handlePushNdefResponse(event);
-          break;
-        case MSG_MAKE_NDEF_READONLY:
-          handleMakeNdefReadonlyResponse(event);
-          break;
-        case MSG_LOW_POWER:
-          handleEnterLowPowerResponse(event);
-          break;
-        case MSG_ENABLE:
-          handleEnableResponse(event);
-          break;
-        default:
-          ALOGE("%s: NFCService bad message", FUNC);
-          abort();
-      }
+    NfcEvent* event;
+    while ((event = mQueue.pop()) != NULL) {
+      ALOGD("%s: NFCService msg=%d depth=%u", FUNC, event->getType(), mQueue.getDepth());
+      dispatchEvent(event);
 
-      //TODO delete event->data?
-      delete event;
+      // Payload ownership was taken by the handler.
+      mEventPool.recycle(event);
     }
   }
 }
 
+void NfcService::dispatchEvent(NfcEvent* event)
+{
+  NfcEventType eventType = event->getType();
+  if (eventType < 0 || eventType >= MSG_END) {
+    ALOGE("%s: NFCService bad message %d", FUNC, eventType);
+    abort();
+  }
+
+  const EventEntry& entry = sEventTable[eventType];
+  if (!entry.handle) {
+    ALOGW("%s: NFCService unhandled message %s", FUNC, entry.name);
+    return;
+  }
+
+  if (mIsLlcpActive && !entry.allowedInP2p) {
+    ALOGW("%s: %s handled while LLCP link is active", FUNC, entry.name);
+  }
+
+  NfcDispatchStats& stats = mEventStats[eventType];
+  NFC_TRACE_EVENT(NFC_TRACE_SERVICE_DISPATCH, NFC_TRACE_BEGIN, eventType, mQueue.getDepth());
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
+  (this->*entry.handle)(event);
+  uint64_t elapsed = NfcUtil::getMonotonicTimeUs() - start;
+  NFC_TRACE_EVENT(NFC_TRACE_SERVICE_DISPATCH, NFC_TRACE_FINISH, eventType, mQueue.getDepth());
+
+  __sync_fetch_and_add(&stats.calls, 1);
+  stats.latency.record(elapsed);
+  if (elapsed > entry.budgetUs) {
+    __sync_fetch_and_add(&stats.overBudget, 1);
+    ALOGW("%s: %s took %llu us", FUNC, entry.name, (unsigned long long)elapsed);
+  }
+}
+
+void NfcService::getStats(NfcStatsSnapshot& snapshot)
+{
+  for (int i = 0; i < NFC_STATS_COUNTER_END; i++) {
+    snapshot.counters[i] = NfcCounters::get((NfcStatsCounter)i);
+  }
+  snapshot.counters[NFC_STATS_EVENT_QUEUE_DEPTH] = mQueue.getDepth();
+  snapshot.counters[NFC_STATS_EVENT_QUEUE_MAX_DEPTH] = mQueue.getMaxDepth();
+  snapshot.counters[NFC_STATS_EVENT_QUEUE_FULL] = mQueue.getFullCount();
+  snapshot.counters[NFC_STATS_EVENT_POOL_HEAP_FALLBACKS] = mEventPool.getHeapFallbackCount();
+
+  NfcWorkerPoolStats poolStats;
+  NfcWorkerPool::Instance()->getStats(poolStats);
+  snapshot.counters[NFC_STATS_WORKER_TASKS_SUBMITTED] = poolStats.submitted;
+  snapshot.counters[NFC_STATS_WORKER_TASKS_REJECTED] = poolStats.rejected;
+  snapshot.counters[NFC_STATS_WORKER_TASKS_COMPLETED] = poolStats.completed;
+  snapshot.counters[NFC_STATS_WORKER_BUSY] = poolStats.busyWorkers;
+  snapshot.counters[NFC_STATS_WORKER_PENDING] = poolStats.pendingTasks;
+
+  // The RF part of a request runs on the tag worker, not in its handler.
+  NfcTagWorker* worker = NfcTagWorker::Instance();
+  snapshot.histograms[NFC_STATS_HISTOGRAM_NDEF_READ] = &worker->getLatency(NFC_TAG_OP_READ_NDEF);
+  snapshot.histograms[NFC_STATS_HISTOGRAM_NDEF_WRITE] = &worker->getLatency(NFC_TAG_OP_WRITE_NDEF);
+  snapshot.histograms[NFC_STATS_HISTOGRAM_TAP] =
+    &TapLatencyTracker::Instance()->getLatency(TAP_STAGE_TOTAL);
+  snapshot.histograms[NFC_STATS_HISTOGRAM_TAG_REMOVAL] =
+    &PresenceCheckScheduler::Instance()->getRemovalLatency();
+}
+
+void NfcService::postEvent(NfcEvent* event)
+{
+  NFC_TRACE_EVENT(NFC_TRACE_SERVICE_POST, NFC_TRACE_INSTANT, event->getType(), mQueue.getDepth());
+
+  // The queue is bounded. If the service thread falls that far behind, make
+  // the producer wait for a free slot instead of dropping the event.
+  if (!mQueue.push(event)) {
+    ALOGW("%s: event queue full, msg=%d", FUNC, event->getType());
+    while (!mQueue.push(event)) {
+      sched_yield();
+    }
+  }
+}
+
+bool NfcService::postRequest(NfcEvent* event)
+{
+  // Only the IPC thread posts requests; vendor callbacks racing with this
+  // check land in the reserve.
+  if (mQueue.getDepth() >= EVENT_QUEUE_CAPACITY - EVENT_QUEUE_VENDOR_RESERVE) {
+    ALOGW("%s: event queue full, refusing msg=%d", FUNC, event->getType());
+    mEventPool.recycle(event);
+    return false;
+  }
+
+  postEvent(event);
+  return true;
+}
+
 NfcService* NfcService::Instance() {
     if (!sInstance)
         sInstance = new NfcService();
@@ -351,91 +465,129 @@ INfcManager* NfcService::getNfcManager()
   return reinterpret_cast<INfcManager*>(NfcService::sNfcManager);
 }
 
-bool NfcService::handleDisconnect()
+bool NfcService::isServiceThread()
 {
-  INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(sNfcManager->queryInterface(INTERFACE_TAG_MANAGER));
-  bool result = pINfcTag->disconnect();
-  return result;
+  return pthread_equal(pthread_self(), thread_id);
 }
 
-int NfcService::handleConnect(int technology)
+NfcTagOp* NfcService::newTagOp(NfcTagOpType type, const NfcRequestOrigin& origin,
+                               NfcTagOpCompletion complete)
 {
   INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(sNfcManager->queryInterface(INTERFACE_TAG_MANAGER));
-  int status = pINfcTag->connect(technology);
-  mMsgHandler->processResponse(NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS,  NULL);
-  return status;
+  NfcTagOp* op = new NfcTagOp(type, pINfcTag, complete);
+  op->origin = origin;
+  return op;
 }
 
-bool NfcService::handleConfigRequest(int powerLevel)
+void NfcService::handleTagOpComplete(NfcEvent* event)
 {
-  NfcEvent *event = new NfcEvent(MSG_CONFIG);
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
-  return true;
+  NfcTagOp* op = event->getTagOp();
+  NfcTagWorker::Instance()->checkCancelled(op);
+  (this->*op->complete)(op);
+  delete op;
 }
 
-bool NfcService::handleReadNdefDetailRequest()
+bool NfcService::handleConnectRequest(int technology, const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_READ_NDEF_DETAIL);
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
-  return true;
+  NfcEvent *event = mEventPool.obtain(MSG_CONNECT);
+  event->setOrigin(origin);
+  event->setValue(technology);
+  return postRequest(event);
+}
+
+void NfcService::handleConnectResponse(NfcEvent* event)
+{
+  NfcTagOp* op = newTagOp(NFC_TAG_OP_CONNECT, event->getOrigin(),
+                          &NfcService::handleConnectComplete);
+  op->technology = event->getValue();
+  NfcTagWorker::Instance()->submit(op);
+}
+
+void NfcService::handleConnectComplete(NfcTagOp* op)
+{
+  mMsgHandler->processResponse(op->origin, NFC_RESPONSE_GENERAL,
+                               op->result ? NFC_ERROR_SUCCESS : NFC_ERROR_IO, NULL);
+}
+
+bool NfcService::handleConfigRequest(int powerLevel, const NfcRequestOrigin& origin)
+{
+  NfcEvent *event = mEventPool.obtain(MSG_CONFIG);
+  event->setOrigin(origin);
+  return postRequest(event);
+}
+
+bool NfcService::handleReadNdefDetailRequest(const NfcRequestOrigin& origin)
+{
+  NfcEvent *event = mEventPool.obtain(MSG_READ_NDEF_DETAIL);
+  event->setOrigin(origin);
+  return postRequest(event);
 }
 
 void NfcService::handleConfigResponse(NfcEvent* event)
 {
-  mMsgHandler->processResponse(NFC_RESPONSE_CONFIG, NFC_ERROR_SUCCESS, NULL);
+  mMsgHandler->processResponse(event->getOrigin(), NFC_RESPONSE_CONFIG, NFC_ERROR_SUCCESS, NULL);
 }
 
 void NfcService::handleReadNdefDetailResponse(NfcEvent* event)
 {
-  INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(sNfcManager->queryInterface(INTERFACE_TAG_MANAGER));
-  NdefDetail* pNdefDetail = pINfcTag->readNdefDetail();
+  NfcTagWorker::Instance()->submit(newTagOp(NFC_TAG_OP_READ_NDEF_DETAIL, event->getOrigin(),
+                                            &NfcService::handleReadNdefDetailComplete));
+}
 
-  if (pNdefDetail != NULL) {
-    mMsgHandler->processResponse(NFC_RESPONSE_READ_NDEF_DETAILS, NFC_ERROR_SUCCESS, pNdefDetail);
-  } else {
-    //TODO can we notify null ndef detail?
-  }
+void NfcService::handleReadNdefDetailComplete(NfcTagOp* op)
+{
+  NdefDetail* pNdefDetail = op->ndefDetail;
+
+  // Failed or cancelled: answer anyway, the client may wait on its token.
+  mMsgHandler->processResponse(op->origin, NFC_RESPONSE_READ_NDEF_DETAILS,
+                               pNdefDetail ? NFC_ERROR_SUCCESS : NFC_ERROR_IO, pNdefDetail);
 
   delete pNdefDetail;
 }
 
-bool NfcService::handleReadNdefRequest()
+bool NfcService::handleReadNdefRequest(const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_READ_NDEF);
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
-  return true;
+  NfcEvent *event = mEventPool.obtain(MSG_READ_NDEF);
+  event->setOrigin(origin);
+  return postRequest(event);
 }
 
 void NfcService::handleReadNdefResponse(NfcEvent* event)
 {
-  INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(sNfcManager->queryInterface(INTERFACE_TAG_MANAGER));
-  NdefMessage* pNdefMessage = pINfcTag->readNdef();
+  NfcTagWorker::Instance()->submit(newTagOp(NFC_TAG_OP_READ_NDEF, event->getOrigin(),
+                                            &NfcService::handleReadNdefComplete));
+}
 
-  ALOGD("pNdefMessage=%p",pNdefMessage);
-  if (pNdefMessage != NULL) {
-    mMsgHandler->processResponse(NFC_RESPONSE_READ_NDEF, NFC_ERROR_SUCCESS, pNdefMessage);
-  } else {
-    //TODO can we notify null ndef?
+void NfcService::handleReadNdefComplete(NfcTagOp* op)
+{
+  NdefMessage* pNdefMessage = op->ndef;
+  if (pNdefMessage) {
+    NfcCounters::increment(NFC_STATS_NDEF_READS);
+    NfcCounters::add(NFC_STATS_NDEF_READ_BYTES, getNdefSize(pNdefMessage));
   }
 
+  ALOGD("pNdefMessage=%p",pNdefMessage);
+  mMsgHandler->processResponse(op->origin, NFC_RESPONSE_READ_NDEF,
+                               pNdefMessage ? NFC_ERROR_SUCCESS : NFC_ERROR_IO, pNdefMessage);
+
   delete pNdefMessage;
 }
 
-bool NfcService::handleWriteNdefRequest(NdefMessage* ndef)
+bool NfcService::handleWriteNdefRequest(NdefMessage* ndef, const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_WRITE_NDEF);
-  event->obj = ndef;
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = mEventPool.obtain(MSG_WRITE_NDEF);
+  event->setOrigin(origin);
+  event->setNdefMessage(ndef);
+  if (!postRequest(event)) {
+    delete ndef;
+    return false;
+  }
   return true;
 }
 
 void NfcService::handleWriteNdefResponse(NfcEvent* event)
 {
-  NdefMessage* ndef = reinterpret_cast<NdefMessage*>(event->obj);
+  NdefMessage* ndef = event->getNdefMessage();
 
   // Use single API wirte to send data.
   // nfcd check current connection is p2p or tag.
@@ -443,22 +595,40 @@ void NfcService::handleWriteNdefResponse(NfcEvent* event)
     if (mP2pLinkManager->isLlcpActive()) {
       mP2pLinkManager->push(*ndef);
     } else {
-      INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(sNfcManager->queryInterface(INTERFACE_TAG_MANAGER));
-      pINfcTag->writeNdef(*ndef);
+      // The tag worker owns the message until the completion.
+      NfcTagOp* op = newTagOp(NFC_TAG_OP_WRITE_NDEF, event->getOrigin(),
+                              &NfcService::handleWriteNdefComplete);
+      op->ndef = ndef;
+      NfcTagWorker::Instance()->submit(op);
+      return;
     }
   } else {
     ALOGE("%s: empty NDEF message", FUNC);
   }
 
   delete ndef;
-  mMsgHandler->processResponse(NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
+  mMsgHandler->processResponse(event->getOrigin(), NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
+}
+
+void NfcService::handleWriteNdefComplete(NfcTagOp* op)
+{
+  if (op->result) {
+    NfcCounters::increment(NFC_STATS_NDEF_WRITES);
+    NfcCounters::add(NFC_STATS_NDEF_WRITE_BYTES, getNdefSize(op->ndef));
+  } else {
+    NfcCounters::increment(NFC_STATS_NDEF_WRITE_FAILURES);
+  }
+
+  delete op->ndef;
+  mMsgHandler->processResponse(op->origin, NFC_RESPONSE_GENERAL,
+                               op->result ? NFC_ERROR_SUCCESS : NFC_ERROR_IO, NULL);
 }
 
-void NfcService::handleCloseRequest()
+bool NfcService::handleCloseRequest(const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_CLOSE);
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = mEventPool.obtain(MSG_CLOSE);
+  event->setOrigin(origin);
+  return postRequest(event);
 }
 
 void NfcService::handleCloseResponse(NfcEvent* event)
@@ -466,89 +636,100 @@ void NfcService::handleCloseResponse(NfcEvent* event)
   // TODO : If we call tag disconnect here, will keep trggering tag discover notification
   //        Need to check with DT what should we do here
 
-  mMsgHandler->processResponse(NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
+  mMsgHandler->processResponse(event->getOrigin(), NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
 }
 
-void NfcService::onConnected()
+void NfcService::onConnected(int clientId)
 {
-  NfcEvent *event = new NfcEvent(MSG_SOCKET_CONNECTED);
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
+  NfcEvent *event = mEventPool.obtain(MSG_SOCKET_CONNECTED);
+  event->setOrigin(NfcRequestOrigin(clientId));
+  postEvent(event);
 }
 
-bool NfcService::handlePushNdefRequest(NdefMessage* ndef)
+void NfcService::handleSocketConnected(NfcEvent* event)
 {
-  NfcEvent *event = new NfcEvent(MSG_PUSH_NDEF);
-  event->obj = ndef;
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
+  // INITIALIZED is addressed to the client that just connected only.
+  NfcRequestOrigin origin = event->getOrigin();
+  mMsgHandler->processNotification(NFC_NOTIFICATION_INITIALIZED, &origin);
+}
+
+bool NfcService::handlePushNdefRequest(NdefMessage* ndef, const NfcRequestOrigin& origin)
+{
+  NfcEvent *event = mEventPool.obtain(MSG_PUSH_NDEF);
+  event->setOrigin(origin);
+  event->setNdefMessage(ndef);
+  if (!postRequest(event)) {
+    delete ndef;
+    return false;
+  }
   return true;
 }
 
 void NfcService::handlePushNdefResponse(NfcEvent* event)
 {
-  NdefMessage* ndef = reinterpret_cast<NdefMessage*>(event->obj);
+  NdefMessage* ndef = event->getNdefMessage();
 
   mP2pLinkManager->push(*ndef);
 
   delete ndef;
-  mMsgHandler->processResponse(NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
+  mMsgHandler->processResponse(event->getOrigin(), NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
 }
 
-bool NfcService::handleMakeNdefReadonlyRequest()
+bool NfcService::handleMakeNdefReadonlyRequest(const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_MAKE_NDEF_READONLY);
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
-  return true;
+  NfcEvent *event = mEventPool.obtain(MSG_MAKE_NDEF_READONLY);
+  event->setOrigin(origin);
+  return postRequest(event);
 }
 
 void NfcService::handleMakeNdefReadonlyResponse(NfcEvent* event)
 {
-  INfcTag* pINfcTag = reinterpret_cast<INfcTag*>(sNfcManager->queryInterface(INTERFACE_TAG_MANAGER));
-  bool result = pINfcTag->makeReadOnly();
+  NfcTagWorker::Instance()->submit(newTagOp(NFC_TAG_OP_MAKE_READ_ONLY, event->getOrigin(),
+                                            &NfcService::handleMakeNdefReadonlyComplete));
+}
 
-  mMsgHandler->processResponse(NFC_RESPONSE_GENERAL, NFC_ERROR_SUCCESS, NULL);
+void NfcService::handleMakeNdefReadonlyComplete(NfcTagOp* op)
+{
+  mMsgHandler->processResponse(op->origin, NFC_RESPONSE_GENERAL,
+                               op->result ? NFC_ERROR_SUCCESS : NFC_ERROR_IO, NULL);
 }
 
-bool NfcService::handleEnterLowPowerRequest(bool enter)
+bool NfcService::handleEnterLowPowerRequest(bool enter, const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_LOW_POWER);
-  event->arg1 = enter;
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
-  return true;
+  NfcEvent *event = mEventPool.obtain(MSG_LOW_POWER);
+  event->setOrigin(origin);
+  event->setFlag(enter);
+  return postRequest(event);
 }
 
 void NfcService::handleEnterLowPowerResponse(NfcEvent* event)
 {
-  bool enter = event->arg1;
+  bool enter = event->getFlag();
   if (enter)
     sNfcManager->disableDiscovery();
   else
     sNfcManager->enableDiscovery();
 
-  mMsgHandler->processResponse(NFC_RESPONSE_CONFIG, NFC_ERROR_SUCCESS, NULL);
+  mMsgHandler->processResponse(event->getOrigin(), NFC_RESPONSE_CONFIG, NFC_ERROR_SUCCESS, NULL);
 }
 
-bool NfcService::handleEnableRequest(bool enable)
+bool NfcService::handleEnableRequest(bool enable, const NfcRequestOrigin& origin)
 {
-  NfcEvent *event = new NfcEvent(MSG_ENABLE);
-  event->arg1 = enable;
-  mQueue.push_back(event);
-  sem_post(&thread_sem);
-  return true;
+  NfcEvent *event = mEventPool.obtain(MSG_ENABLE);
+  event->setOrigin(origin);
+  event->setFlag(enable);
+  return postRequest(event);
 }
 
 void NfcService::handleEnableResponse(NfcEvent* event)
 {
-  bool enable = event->arg1;
+  bool enable = event->getFlag();
   if (enable) {
     enableNfc();
   } else {
     disableNfc();
   }
-  mMsgHandler->processResponse(NFC_RESPONSE_CONFIG, NFC_ERROR_SUCCESS, NULL);
+  mMsgHandler->processResponse(event->getOrigin(), NFC_RESPONSE_CONFIG, NFC_ERROR_SUCCESS, NULL);
 }
 
 void NfcService::enableNfc()
@@ -588,10 +769,23 @@ void NfcService::disableNfc()
 
   sNfcManager->disableDiscovery();
 
+  // Tag operations must not be inside NFA calls while the stack shuts down.
+  NfcTagWorker* worker = NfcTagWorker::Instance();
+  worker->cancelAll();
+  worker->waitIdle();
+  PresenceCheckScheduler::Instance()->cancelAll();
+
   sNfcManager->deinitialize();
 
   mIsEnabled = false;
 
+  TapLatencyTracker* tracker = TapLatencyTracker::Instance();
+  tracker->logSummary();
+  const char* reportPath = getenv(TAP_LATENCY_REPORT_ENV);
+  if (reportPath) {
+    tracker->writeReport(reportPath);
+  }
+
   ALOGD("%s: exit", FUNC);
 }
 
@@ -5,13 +5,15 @@
 #ifndef mozilla_nfcd_NfcService_h
 #define mozilla_nfcd_NfcService_h
 
-#include "utils/List.h"
 #include "IpcSocketListener.h"
 #include "NfcManager.h"
+#include "NfcEvent.h"
+#include "NfcStats.h"
+#include "NfcCounters.h"
+#include "NfcTagWorker.h"
 
 class NdefMessage;
 class MessageHandler;
-class NfcEvent;
 class INfcManager;
 class INfcTag;
 class IP2pDevice;
@@ -29,39 +31,70 @@ public:
   static void notifyLlcpLinkDeactivated(IP2pDevice* pDevice);
   static void notifyTagDiscovered(INfcTag* pTag);
   static void notifyTagLost();
+
+  /**
+   * Hand a finished NfcTagOp back to the NfcService thread.
+   *
+   * @param  op Operation run by NfcTagWorker.
+   * @return    None.
+   */
+  static void notifyTagOpComplete(NfcTagOp* op);
   static void notifySEFieldActivated();
   static void notifySEFieldDeactivated();
   static void notifySETransactionListeners();
 
-  static bool handleDisconnect();
+  /**
+   * @return True if called on the NfcService thread.
+   */
+  static bool isServiceThread();
+
+  NfcDispatchStats& getEventStats(NfcEventType type) { return mEventStats[type]; }
+
+  /**
+   * Collect the statistics reported by NFC_REQUEST_GET_STATS. May be
+   * called on any thread.
+   *
+   * @param  snapshot Filled with the current values.
+   * @return          None.
+   */
+  void getStats(NfcStatsSnapshot& snapshot);
 
   void* eventLoop();
 
   void handleTagDiscovered(NfcEvent* event);
+  void handleTagDiscoveredComplete(NfcTagOp* op);
+  void handleTagOpComplete(NfcEvent* event);
   void handleTagLost(NfcEvent* event);
   void handleLlcpLinkActivation(NfcEvent* event);
   void handleLlcpLinkDeactivation(NfcEvent* event);
-  int handleConnect(int technology);
-  bool handleConfigRequest(int powerLevel);
+  bool handleConnectRequest(int technology, const NfcRequestOrigin& origin);
+  void handleConnectResponse(NfcEvent* event);
+  void handleConnectComplete(NfcTagOp* op);
+  bool handleConfigRequest(int powerLevel, const NfcRequestOrigin& origin);
   void handleConfigResponse(NfcEvent* event);
-  bool handleReadNdefDetailRequest();
+  bool handleReadNdefDetailRequest(const NfcRequestOrigin& origin);
   void handleReadNdefDetailResponse(NfcEvent* event);
-  bool handleReadNdefRequest();
+  void handleReadNdefDetailComplete(NfcTagOp* op);
+  bool handleReadNdefRequest(const NfcRequestOrigin& origin);
   void handleReadNdefResponse(NfcEvent* event);
-  bool handleWriteNdefRequest(NdefMessage* ndef);
+  void handleReadNdefComplete(NfcTagOp* op);
+  bool handleWriteNdefRequest(NdefMessage* ndef, const NfcRequestOrigin& origin);
   void handleWriteNdefResponse(NfcEvent* event);
-  void handleCloseRequest();
+  void handleWriteNdefComplete(NfcTagOp* op);
+  bool handleCloseRequest(const NfcRequestOrigin& origin);
   void handleCloseResponse(NfcEvent* event);
-  bool handlePushNdefRequest(NdefMessage* ndef);
+  bool handlePushNdefRequest(NdefMessage* ndef, const NfcRequestOrigin& origin);
   void handlePushNdefResponse(NfcEvent* event);
-  bool handleMakeNdefReadonlyRequest();
+  bool handleMakeNdefReadonlyRequest(const NfcRequestOrigin& origin);
   void handleMakeNdefReadonlyResponse(NfcEvent* event);
-  bool handleEnterLowPowerRequest(bool enter);
+  void handleMakeNdefReadonlyComplete(NfcTagOp* op);
+  bool handleEnterLowPowerRequest(bool enter, const NfcRequestOrigin& origin);
   void handleEnterLowPowerResponse(NfcEvent* event);
-  bool handleEnableRequest(bool enable);
+  bool handleEnableRequest(bool enable, const NfcRequestOrigin& origin);
   void handleEnableResponse(NfcEvent* event);
 
-  void onConnected();
+  void onConnected(int clientId);
+  void handleSocketConnected(NfcEvent* event);
   void onP2pReceivedNdef(NdefMessage* ndef);
   void enableNfc();
   void disableNfc();
@@ -69,12 +102,63 @@ public:
 private:
   NfcService();
 
+  typedef void (NfcService::*EventHandler)(NfcEvent* event);
+
+  /**
+   * How the NfcService thread handles one type of event. Events without a
+   * handler are logged and dropped.
+   */
+  struct EventEntry {
+    NfcEventType type;
+    const char* name;
+    EventHandler handle;
+    bool allowedInP2p;
+    uint32_t budgetUs;
+  };
+
+  static const EventEntry sEventTable[];
+
+  void dispatchEvent(NfcEvent* event);
+
+  /**
+   * Create an operation on the current tag for an IPC request.
+   *
+   * @param  type     Operation.
+   * @param  origin   Origin of the request.
+   * @param  complete Handler of the result.
+   * @return          The operation, to be submitted to NfcTagWorker.
+   */
+  NfcTagOp* newTagOp(NfcTagOpType type, const NfcRequestOrigin& origin,
+                     NfcTagOpCompletion complete);
+
+  /**
+   * Queue an event to be handled by the NfcService thread.
+   *
+   * @param  event Event to be queued.
+   * @return       None.
+   */
+  void postEvent(NfcEvent* event);
+
+  /**
+   * Queue an event on behalf of an IPC request. Unlike postEvent(), this
+   * never waits: if the queue is nearly full, the event is recycled and the
+   * caller answers the request with NFC_ERROR_BUSY.
+   *
+   * @param  event Event to be queued. Its payload stays with the caller if
+   *               the request is refused.
+   * @return       False if the request was refused.
+   */
+  bool postRequest(NfcEvent* event);
+
   bool mIsEnabled;
+  bool mIsLlcpActive;
   static NfcService* sInstance;
   static NfcManager* sNfcManager;
-  android::List<NfcEvent*> mQueue;
+  NfcEventQueue mQueue;
+  NfcEventPool mEventPool;
   MessageHandler* mMsgHandler;
   P2pLinkManager* mP2pLinkManager;
+  NfcDispatchStats mEventStats[MSG_END];
 };
 
 #endif // mozilla_nfcd_NfcService_h
@@ -0,0 +1,58 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcStats.h"
+
+#include <string.h>
+
+NfcLatencyHistogram::NfcLatencyHistogram()
+ : mCount(0)
+{
+  memset((void*)mBuckets, 0, sizeof(mBuckets));
+}
+
+void NfcLatencyHistogram::record(uint64_t us)
+{
+  int index = 0;
+  while (us > 0 && index < NFC_LATENCY_BUCKETS - 1) {
+    us >>= 1;
+    index++;
+  }
+
+  __sync_fetch_and_add(&mBuckets[index], 1);
+  __sync_fetch_and_add(&mCount, 1);
+}
+
+uint64_t NfcLatencyHistogram::getBucketLimitUs(int index)
+{
+  return (uint64_t)1 << index;
+}
+
+uint64_t NfcLatencyHistogram::getPercentileUs(double percentile)
+{
+  uint32_t count = mCount;
+  if (count == 0) {
+    return 0;
+  }
+
+  // Rank of the sample we are looking for, 1-based.
+  double rank = percentile / 100 * count;
+  if (rank < 1) {
+    rank = 1;
+  }
+
+  uint32_t seen = 0;
+  for (int i = 0; i < NFC_LATENCY_BUCKETS; i++) {
+    uint32_t inBucket = mBuckets[i];
+    if (inBucket == 0 || seen + inBucket < rank) {
+      seen += inBucket;
+      continue;
+    }
+
+    uint64_t low = i == 0 ? 0 : getBucketLimitUs(i - 1);
+    uint64_t high = getBucketLimitUs(i);
+    return low + (uint64_t)((high - low) * ((rank - seen) / inBucket));
+  }
+  return getBucketLimitUs(NFC_LATENCY_BUCKETS - 1);
+}
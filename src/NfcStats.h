@@ -0,0 +1,67 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcStats_h
+#define mozilla_nfcd_NfcStats_h
+
+#include <stdint.h>
+
+#define NFC_LATENCY_BUCKETS 24
+
+/**
+ * Latency histogram with power-of-two buckets.
+ *
+ * Bucket 0 counts samples below 1us, bucket i counts samples in
+ * [2^(i-1), 2^i) us and the last bucket collects everything above. Samples
+ * are recorded with atomic increments, so any thread may record while
+ * others read.
+ */
+class NfcLatencyHistogram {
+public:
+  NfcLatencyHistogram();
+
+  /**
+   * Add a sample.
+   *
+   * @param  us Latency in microseconds.
+   * @return    None.
+   */
+  void record(uint64_t us);
+
+  uint32_t getCount() { return mCount; }
+  uint32_t getBucket(int index) { return mBuckets[index]; }
+
+  /**
+   * Get the upper bound of a bucket.
+   *
+   * @param  index Bucket index.
+   * @return       Upper bound in microseconds.
+   */
+  static uint64_t getBucketLimitUs(int index);
+
+  /**
+   * Estimate a percentile, interpolating linearly inside its bucket.
+   *
+   * @param  percentile Percentile in [0, 100], e.g. 99.9.
+   * @return            Latency in microseconds, 0 if there are no samples.
+   */
+  uint64_t getPercentileUs(double percentile);
+
+private:
+  volatile uint32_t mCount;
+  volatile uint32_t mBuckets[NFC_LATENCY_BUCKETS];
+};
+
+/**
+ * Statistics of one entry of a dispatch table.
+ */
+struct NfcDispatchStats {
+  NfcDispatchStats() : calls(0), overBudget(0) {}
+
+  volatile uint32_t calls;
+  volatile uint32_t overBudget; // Calls that took longer than the budget.
+  NfcLatencyHistogram latency;
+};
+
+#endif // mozilla_nfcd_NfcStats_h
@@ -0,0 +1,155 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcTagWorker.h"
+
+#include <stdlib.h>
+
+#include "INfcTag.h"
+#include "NdefMessage.h"
+#include "NfcService.h"
+#include "NfcUtil.h"
+#include "TapLatencyTracker.h"
+#include "NfcDebug.h"
+
+NfcTagWorker* NfcTagWorker::sInstance = NULL;
+
+NfcTagWorker* NfcTagWorker::Instance()
+{
+  if (!sInstance)
+    sInstance = new NfcTagWorker();
+  return sInstance;
+}
+
+NfcTagWorker::NfcTagWorker()
+ : mStarted(false)
+ , mIsBusy(false)
+ , mGeneration(0)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+}
+
+void NfcTagWorker::submit(NfcTagOp* op)
+{
+  pthread_mutex_lock(&mMutex);
+  if (!mStarted) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, workerThreadFunc, this) != 0) {
+      ALOGE("%s: pthread_create failed", FUNC);
+      abort();
+    }
+    pthread_detach(tid);
+    mStarted = true;
+  }
+
+  op->generation = mGeneration;
+  mOps.push_back(op);
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+}
+
+void NfcTagWorker::cancelAll()
+{
+  pthread_mutex_lock(&mMutex);
+  mGeneration++;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void NfcTagWorker::waitIdle()
+{
+  // Queued operations are not waited for: after cancelAll() they are
+  // skipped without touching the tag, and the worker may be stuck posting
+  // their completions to the NfcService queue this thread drains.
+  pthread_mutex_lock(&mMutex);
+  while (mIsBusy) {
+    pthread_cond_wait(&mCond, &mMutex);
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+bool NfcTagWorker::checkCancelled(NfcTagOp* op)
+{
+  pthread_mutex_lock(&mMutex);
+  op->isCancelled = op->generation != mGeneration;
+  pthread_mutex_unlock(&mMutex);
+  return op->isCancelled;
+}
+
+bool NfcTagWorker::run(NfcTagOp* op)
+{
+  INfcTag* tag = op->tag;
+
+  switch (op->type) {
+    case NFC_TAG_OP_DISCOVER:
+      // readNdef() also adds the NDEF technologies to the tag.
+      op->ndef = tag->readNdef();
+      TapLatencyTracker::Instance()->onNdefRead(tag);
+      op->result = true;
+      break;
+    case NFC_TAG_OP_CONNECT:
+      op->result = tag->connect(op->technology);
+      break;
+    case NFC_TAG_OP_READ_NDEF_DETAIL:
+      op->ndefDetail = tag->readNdefDetail();
+      op->result = op->ndefDetail != NULL;
+      break;
+    case NFC_TAG_OP_READ_NDEF:
+      op->ndef = tag->readNdef();
+      op->result = op->ndef != NULL;
+      break;
+    case NFC_TAG_OP_WRITE_NDEF:
+      op->result = tag->writeNdef(*op->ndef);
+      break;
+    case NFC_TAG_OP_MAKE_READ_ONLY:
+      op->result = tag->makeReadOnly();
+      break;
+    default:
+      ALOGE("%s: unknown operation %d", FUNC, op->type);
+      op->result = false;
+      break;
+  }
+  return op->result;
+}
+
+void* NfcTagWorker::workerThreadFunc(void* arg)
+{
+  pthread_setname_np(pthread_self(), "NFC tag");
+  NfcTagWorker* worker = reinterpret_cast<NfcTagWorker*>(arg);
+  worker->workerLoop();
+  return NULL;
+}
+
+void NfcTagWorker::workerLoop()
+{
+  pthread_mutex_lock(&mMutex);
+  while (true) {
+    while (mOps.empty()) {
+      pthread_cond_wait(&mCond, &mMutex);
+    }
+
+    NfcTagOp* op = mOps.front();
+    mOps.pop_front();
+    bool isCancelled = op->generation != mGeneration;
+    mIsBusy = !isCancelled;
+    pthread_mutex_unlock(&mMutex);
+
+    if (!isCancelled) {
+      uint64_t start = NfcUtil::getMonotonicTimeUs();
+      run(op);
+      mLatency[op->type].record(NfcUtil::getMonotonicTimeUs() - start);
+    }
+
+    // Idle before posting: posting may wait for room in the NfcService
+    // queue, while the NfcService thread may be in waitIdle().
+    pthread_mutex_lock(&mMutex);
+    mIsBusy = false;
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mMutex);
+
+    NfcService::notifyTagOpComplete(op);
+
+    pthread_mutex_lock(&mMutex);
+  }
+}
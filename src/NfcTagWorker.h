@@ -0,0 +1,148 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcTagWorker_h
+#define mozilla_nfcd_NfcTagWorker_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+
+#include "NfcEvent.h"
+#include "NfcStats.h"
+
+class INfcTag;
+class NdefDetail;
+class NdefMessage;
+class NfcService;
+
+typedef enum {
+  NFC_TAG_OP_DISCOVER = 0,     // readNdef() of a newly discovered tag.
+  NFC_TAG_OP_CONNECT,
+  NFC_TAG_OP_READ_NDEF_DETAIL,
+  NFC_TAG_OP_READ_NDEF,
+  NFC_TAG_OP_WRITE_NDEF,
+  NFC_TAG_OP_MAKE_READ_ONLY,
+  // Not an operation. Keep it last.
+  NFC_TAG_OP_END
+} NfcTagOpType;
+
+struct NfcTagOp;
+
+/**
+ * Handler of a finished NfcTagOp, called on the NfcService thread.
+ */
+typedef void (NfcService::*NfcTagOpCompletion)(NfcTagOp* op);
+
+/**
+ * An INfcTag operation and its result. Whatever the result, the
+ * completion is called exactly once; it owns ndef and ndefDetail then.
+ * An operation submitted before NfcTagWorker::cancelAll() completes with
+ * isCancelled set, and without having run if it was still queued.
+ */
+struct NfcTagOp {
+  NfcTagOp(NfcTagOpType aType, INfcTag* aTag, NfcTagOpCompletion aComplete)
+   : type(aType)
+   , tag(aTag)
+   , complete(aComplete)
+   , technology(0)
+   , ndef(NULL)
+   , ndefDetail(NULL)
+   , result(false)
+   , generation(0)
+   , isCancelled(false)
+  {
+  }
+
+  NfcTagOpType type;
+  INfcTag* tag;
+  NfcTagOpCompletion complete;
+  NfcRequestOrigin origin;   // Of the IPC request, if any.
+  int technology;            // In: NFC_TAG_OP_CONNECT.
+  NdefMessage* ndef;         // In: WRITE_NDEF. Out: DISCOVER, READ_NDEF.
+  NdefDetail* ndefDetail;    // Out: READ_NDEF_DETAIL.
+  bool result;
+  uint32_t generation;       // Of NfcTagWorker, when submitted.
+  bool isCancelled;          // Set before the completion is called.
+};
+
+/**
+ * Thread running INfcTag operations on behalf of the NfcService thread.
+ *
+ * The vendor INfcTag methods block until the NFCC answers. Handing them
+ * to this thread keeps the NfcService thread free for other events, such
+ * as a tag being lost, while an RF operation is pending. Operations run
+ * one at a time in submission order, as the NFCC serializes them anyway,
+ * and their completion is posted back to the NfcService queue.
+ */
+class NfcTagWorker {
+public:
+  static NfcTagWorker* Instance();
+
+  /**
+   * Queue an operation. Returns immediately.
+   *
+   * @param  op Operation; NfcService deletes it after its completion.
+   * @return    None.
+   */
+  void submit(NfcTagOp* op);
+
+  /**
+   * Cancel every operation submitted so far, e.g. because the tag session
+   * ends. Queued operations are skipped; all of them complete with
+   * isCancelled set.
+   *
+   * @return None.
+   */
+  void cancelAll();
+
+  /**
+   * Block until no operation is running on the tag. Call it after
+   * cancelAll(), so that nothing queued runs later either. Completions may
+   * still be pending.
+   *
+   * @return None.
+   */
+  void waitIdle();
+
+  /**
+   * Called on the NfcService thread before the completion of an operation.
+   *
+   * @param  op Finished operation.
+   * @return    True if cancelAll() was called after op was submitted; sets
+   *            op->isCancelled too.
+   */
+  bool checkCancelled(NfcTagOp* op);
+
+  /**
+   * Run an operation on the calling thread, blocking until it is done.
+   *
+   * @param  op Operation; op->result and the out members are set.
+   * @return    op->result.
+   */
+  static bool run(NfcTagOp* op);
+
+  /**
+   * @return Latency of the RF part of one type of operation.
+   */
+  NfcLatencyHistogram& getLatency(NfcTagOpType type) { return mLatency[type]; }
+
+private:
+  NfcTagWorker();
+
+  static NfcTagWorker* sInstance;
+  static void* workerThreadFunc(void* arg);
+
+  void workerLoop();
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  bool mStarted;
+  bool mIsBusy;            // An operation is running.
+  uint32_t mGeneration;    // Bumped by cancelAll().
+  std::deque<NfcTagOp*> mOps;
+  NfcLatencyHistogram mLatency[NFC_TAG_OP_END];
+};
+
+#endif // mozilla_nfcd_NfcTagWorker_h
@@ -0,0 +1,95 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcThreadBlocks_h
+#define mozilla_nfcd_NfcThreadBlocks_h
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Registry of per-thread blocks of type T, as used by NfcCounters and
+ * NfcTrace.
+ *
+ * Only the owning thread writes to its block. Blocks are kept in a
+ * lock-free list so any thread can read all of them. A block is handed to
+ * a new thread once its owner has exited and is never freed, so nothing
+ * written to it gets lost.
+ *
+ * T must have the members
+ *   T* next;
+ *   volatile int isOwned;
+ * and is created with new T(), which zeroes a POD type.
+ */
+template <class T>
+class NfcThreadBlocks {
+public:
+  /**
+   * Get the block of the calling thread, taking one over or creating one on
+   * first use.
+   *
+   * @param  isAttached Set to true if the block was just handed to the
+   *                    calling thread.
+   * @return            The block. Never NULL.
+   */
+  static T* get(bool& isAttached)
+  {
+    pthread_once(&sKeyOnce, createKey);
+    T* block = static_cast<T*>(pthread_getspecific(sKey));
+    if (block) {
+      isAttached = false;
+      return block;
+    }
+
+    for (block = sBlocks; block; block = block->next) {
+      if (__sync_bool_compare_and_swap(&block->isOwned, 0, 1)) {
+        break;
+      }
+    }
+
+    if (!block) {
+      block = new T();
+      block->isOwned = 1;
+      do {
+        block->next = sBlocks;
+      } while (!__sync_bool_compare_and_swap(&sBlocks, block->next, block));
+    }
+
+    pthread_setspecific(sKey, block);
+    isAttached = true;
+    return block;
+  }
+
+  /**
+   * @return First block of the list, following ->next reaches all of them.
+   */
+  static T* first() { return sBlocks; }
+
+private:
+  static void createKey()
+  {
+    pthread_key_create(&sKey, release);
+  }
+
+  static void release(void* arg)
+  {
+    T* block = static_cast<T*>(arg);
+    __sync_lock_release(&block->isOwned);
+  }
+
+  static pthread_key_t sKey;
+  static pthread_once_t sKeyOnce;
+  static T* volatile sBlocks;
+};
+
+template <class T>
+pthread_key_t NfcThreadBlocks<T>::sKey;
+
+template <class T>
+pthread_once_t NfcThreadBlocks<T>::sKeyOnce = PTHREAD_ONCE_INIT;
+
+template <class T>
+T* volatile NfcThreadBlocks<T>::sBlocks = NULL;
+
+#endif // mozilla_nfcd_NfcThreadBlocks_h
@@ -0,0 +1,223 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcTrace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "NfcThreadBlocks.h"
+#include "NfcUtil.h"
+#include "NfcDebug.h"
+
+// Records kept per thread; a power of two.
+#define NFC_TRACE_RING_SIZE 2048
+
+#define NFC_TRACE_DUMP_PATH "/data/nfc/nfcd_trace.json"
+// Overrides NFC_TRACE_DUMP_PATH.
+#define NFC_TRACE_DUMP_ENV "NFCD_TRACE_DUMP"
+#define NFC_TRACE_DUMP_SECS 10
+
+struct NfcTraceRecord {
+  uint64_t timeUs;
+  uint16_t event;
+  uint16_t phase;
+  uint32_t tid;
+  uint32_t arg0;
+  uint32_t arg1;
+};
+
+/**
+ * Ring of one thread. A buffer taken over from an exited thread keeps its
+ * records until they are overwritten.
+ */
+struct NfcTraceBuffer {
+  NfcTraceBuffer* next;
+  volatile int isOwned;
+  uint32_t tid;
+  volatile uint32_t head;  // Number of records written.
+  NfcTraceRecord records[NFC_TRACE_RING_SIZE];
+};
+
+struct NfcTraceEventInfo {
+  const char* name;
+  const char* arg0;  // NULL if unused.
+  const char* arg1;
+};
+
+static const NfcTraceEventInfo sEventInfo[NFC_TRACE_END] = {
+  { "nfa_dm_evt",       "event", NULL },
+  { "nfa_conn_evt",     "event", NULL },
+  { "nfa_p2p_evt",      "event", "server" },
+  { "service_post",     "type",  "depth" },
+  { "service_dispatch", "type",  "depth" },
+  { "llcp_send",        "bytes", "ok" },
+  { "llcp_receive",     "bytes", "ok" },
+  { "ipc_read",         "client", "bytes" },
+  { "ipc_write",        "client", "bytes" },
+};
+
+static const char sPhases[] = { 'i', 'B', 'E' };
+
+typedef NfcThreadBlocks<NfcTraceBuffer> NfcTraceBuffers;
+
+static NfcTraceBuffer* getBuffer()
+{
+  bool isAttached;
+  NfcTraceBuffer* buffer = NfcTraceBuffers::get(isAttached);
+  if (isAttached) {
+    buffer->tid = syscall(__NR_gettid);
+  }
+  return buffer;
+}
+
+void NfcTrace::record(NfcTraceEvent event, NfcTracePhase phase, uint32_t arg0, uint32_t arg1)
+{
+  NfcTraceBuffer* buffer = getBuffer();
+  uint32_t head = buffer->head;
+
+  NfcTraceRecord& record = buffer->records[head & (NFC_TRACE_RING_SIZE - 1)];
+  record.timeUs = NfcUtil::getMonotonicTimeUs();
+  record.event = event;
+  record.phase = phase;
+  record.tid = buffer->tid;
+  record.arg0 = arg0;
+  record.arg1 = arg1;
+
+  // Publish the record before a dump can see the new head.
+  __sync_synchronize();
+  buffer->head = head + 1;
+}
+
+static bool compareRecords(const NfcTraceRecord& a, const NfcTraceRecord& b)
+{
+  return a.timeUs < b.timeUs;
+}
+
+/**
+ * Copy the records of a ring that are not being overwritten.
+ */
+static void collectRecords(NfcTraceBuffer* buffer, uint64_t sinceUs,
+                           std::vector<NfcTraceRecord>& records)
+{
+  uint32_t head = buffer->head;
+  __sync_synchronize();
+
+  uint32_t first = head > NFC_TRACE_RING_SIZE ? head - NFC_TRACE_RING_SIZE : 0;
+  std::vector<NfcTraceRecord> copy;
+  copy.reserve(head - first);
+  for (uint32_t i = first; i < head; i++) {
+    copy.push_back(buffer->records[i & (NFC_TRACE_RING_SIZE - 1)]);
+  }
+
+  // The owner kept writing meanwhile; skip the slots it may have reused.
+  __sync_synchronize();
+  uint32_t newHead = buffer->head;
+  uint32_t valid = first;
+  if (newHead >= NFC_TRACE_RING_SIZE && newHead - NFC_TRACE_RING_SIZE + 1 > valid) {
+    valid = newHead - NFC_TRACE_RING_SIZE + 1;
+  }
+
+  for (uint32_t i = valid; i < head; i++) {
+    const NfcTraceRecord& record = copy[i - first];
+    if (record.timeUs >= sinceUs) {
+      records.push_back(record);
+    }
+  }
+}
+
+bool NfcTrace::dump(const char* path, uint32_t lastSecs)
+{
+  uint64_t now = NfcUtil::getMonotonicTimeUs();
+  uint64_t windowUs = (uint64_t)lastSecs * 1000000;
+  uint64_t sinceUs = now > windowUs ? now - windowUs : 0;
+
+  std::vector<NfcTraceRecord> records;
+  for (NfcTraceBuffer* buffer = NfcTraceBuffers::first(); buffer; buffer = buffer->next) {
+    collectRecords(buffer, sinceUs, records);
+  }
+  std::sort(records.begin(), records.end(), compareRecords);
+
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    ALOGE("%s: cannot open %s: %s", FUNC, path, strerror(errno));
+    return false;
+  }
+
+  int pid = getpid();
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < records.size(); i++) {
+    const NfcTraceRecord& record = records[i];
+    const NfcTraceEventInfo& info = sEventInfo[record.event];
+
+    fprintf(file, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%u",
+            info.name, sPhases[record.phase], (unsigned long long)record.timeUs,
+            pid, record.tid);
+    if (record.phase == NFC_TRACE_INSTANT) {
+      fprintf(file, ",\"s\":\"t\"");
+    }
+    fprintf(file, ",\"args\":{");
+    if (info.arg0) {
+      fprintf(file, "\"%s\":%u", info.arg0, record.arg0);
+    }
+    if (info.arg1) {
+      fprintf(file, ",\"%s\":%u", info.arg1, record.arg1);
+    }
+    fprintf(file, "}}%s\n", i + 1 < records.size() ? "," : "");
+  }
+  fprintf(file, "]}\n");
+
+  bool result = fclose(file) == 0;
+  if (result) {
+    ALOGD("%s: %u records written to %s", FUNC, (unsigned)records.size(), path);
+  } else {
+    ALOGE("%s: cannot write %s: %s", FUNC, path, strerror(errno));
+  }
+  return result;
+}
+
+static void* dumpThreadFunc(void* arg)
+{
+  sigset_t* signals = static_cast<sigset_t*>(arg);
+
+  while (true) {
+    int sig;
+    if (sigwait(signals, &sig) != 0) {
+      continue;
+    }
+
+    const char* path = getenv(NFC_TRACE_DUMP_ENV);
+    NfcTrace::dump(path ? path : NFC_TRACE_DUMP_PATH, NFC_TRACE_DUMP_SECS);
+  }
+  return NULL;
+}
+
+void NfcTrace::startDumpOnSignal()
+{
+  if (NFC_TRACE_LEVEL == NFC_TRACE_LEVEL_OFF) {
+    return;
+  }
+
+  static sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+
+  // Inherited by every thread created from now on.
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, dumpThreadFunc, &signals) != 0) {
+    ALOGE("%s: pthread_create failed", FUNC);
+    return;
+  }
+  pthread_detach(thread);
+}
@@ -0,0 +1,87 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcTrace_h
+#define mozilla_nfcd_NfcTrace_h
+
+#include <stdint.h>
+
+// Trace levels; records above NFC_TRACE_LEVEL are compiled out.
+#define NFC_TRACE_LEVEL_OFF   0
+#define NFC_TRACE_LEVEL_EVENT 1  // NFA callbacks and NfcService events.
+#define NFC_TRACE_LEVEL_IO    2  // Also LLCP and IPC I/O.
+
+#ifndef NFC_TRACE_LEVEL
+#define NFC_TRACE_LEVEL NFC_TRACE_LEVEL_EVENT
+#endif
+
+typedef enum {
+  NFC_TRACE_NFA_DM_EVT = 0,    // arg0: event.
+  NFC_TRACE_NFA_CONN_EVT,      // arg0: event.
+  NFC_TRACE_NFA_P2P_EVT,       // arg0: event, arg1: 1 from a server, 0 from a client.
+  NFC_TRACE_SERVICE_POST,      // arg0: NfcEventType, arg1: queue depth.
+  NFC_TRACE_SERVICE_DISPATCH,  // arg0: NfcEventType, arg1: queue depth.
+  NFC_TRACE_LLCP_SEND,         // arg0: bytes, arg1: 1 if sent.
+  NFC_TRACE_LLCP_RECEIVE,      // arg0: bytes, arg1: 1 if received.
+  NFC_TRACE_IPC_READ,          // arg0: client, arg1: bytes.
+  NFC_TRACE_IPC_WRITE,         // arg0: client, arg1: bytes.
+  NFC_TRACE_END
+} NfcTraceEvent;
+
+typedef enum {
+  NFC_TRACE_INSTANT = 0,
+  NFC_TRACE_BEGIN,
+  NFC_TRACE_FINISH
+} NfcTracePhase;
+
+/**
+ * Flight recorder of fixed-size binary records.
+ *
+ * Every thread writes to a ring buffer of its own without locking, so
+ * recording costs a clock read and a few stores. The rings keep the most
+ * recent records and are only decoded when a dump is requested.
+ */
+class NfcTrace {
+public:
+  /**
+   * Append a record to the ring of the calling thread. Use the
+   * NFC_TRACE_EVENT()/NFC_TRACE_IO() macros, which honour NFC_TRACE_LEVEL.
+   *
+   * @return None.
+   */
+  static void record(NfcTraceEvent event, NfcTracePhase phase, uint32_t arg0, uint32_t arg1);
+
+  /**
+   * Decode the records of all threads as Chrome trace JSON
+   * (chrome://tracing, Perfetto).
+   *
+   * @param  path     Output file.
+   * @param  lastSecs Only records of the last lastSecs seconds are written.
+   * @return          True if written.
+   */
+  static bool dump(const char* path, uint32_t lastSecs);
+
+  /**
+   * Dump the trace whenever nfcd receives SIGUSR1. Must be called before
+   * any other thread is created, so that they all leave SIGUSR1 to the
+   * dump thread.
+   *
+   * @return None.
+   */
+  static void startDumpOnSignal();
+};
+
+#if NFC_TRACE_LEVEL >= NFC_TRACE_LEVEL_EVENT
+#define NFC_TRACE_EVENT(event, phase, arg0, arg1) NfcTrace::record(event, phase, arg0, arg1)
+#else
+#define NFC_TRACE_EVENT(event, phase, arg0, arg1) ((void)0)
+#endif
+
+#if NFC_TRACE_LEVEL >= NFC_TRACE_LEVEL_IO
+#define NFC_TRACE_IO(event, phase, arg0, arg1) NfcTrace::record(event, phase, arg0, arg1)
+#else
+#define NFC_TRACE_IO(event, phase, arg0, arg1) ((void)0)
+#endif
+
+#endif // mozilla_nfcd_NfcTrace_h
@@ -1,5 +1,7 @@
 #include "NfcUtil.h"
 
+#include <time.h>
+
 void NfcUtil::convertNdefPduToNdefMessage(NdefMessagePdu& ndefPdu, NdefMessage* ndefMessage) {
   for (uint32_t i = 0; i < ndefPdu.numRecords; i++) {
     NdefRecordPdu& record = ndefPdu.records[i];
@@ -29,3 +31,10 @@ NfcTechnology NfcUtil::convertTagTechToGonkFormat(TagTechnology tagTech) {
   }
   return NFC_TECH_NFCA;
 }
+
+uint64_t NfcUtil::getMonotonicTimeUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -15,6 +15,11 @@ class NfcUtil{
 public:
   static void convertNdefPduToNdefMessage(NdefMessagePdu& ndefPdu, NdefMessage* ndefMessage);
   static NfcTechnology convertTagTechToGonkFormat(TagTechnology tagTech);
+
+  /**
+   * @return Monotonic time in microseconds.
+   */
+  static uint64_t getMonotonicTimeUs();
 private:
   NfcUtil();
 };
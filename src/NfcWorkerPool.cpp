@@ -0,0 +1,113 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcWorkerPool.h"
+
+#include <string.h>
+
+#include "NfcDebug.h"
+
+NfcWorkerPool* NfcWorkerPool::sInstance = NULL;
+
+NfcWorkerPool* NfcWorkerPool::Instance()
+{
+  if (!sInstance)
+    sInstance = new NfcWorkerPool();
+  return sInstance;
+}
+
+NfcWorkerPool::NfcWorkerPool()
+ : mStarted(false)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+bool NfcWorkerPool::submit(NfcWorkerTask* task)
+{
+  pthread_mutex_lock(&mMutex);
+  if (!mStarted) {
+    startWorkersLocked();
+  }
+
+  // Every worker busy and the backlog full: refuse instead of growing.
+  if (mStats.busyWorkers + mTasks.size() >= (uint32_t)(WORKER_COUNT + MAX_PENDING_TASKS)) {
+    mStats.rejected++;
+    pthread_mutex_unlock(&mMutex);
+    ALOGE("%s: worker pool saturated", FUNC);
+    return false;
+  }
+
+  mTasks.push_back(task);
+  mStats.submitted++;
+  pthread_cond_signal(&mCond);
+  pthread_mutex_unlock(&mMutex);
+  return true;
+}
+
+bool NfcWorkerPool::cancel(NfcWorkerTask* task)
+{
+  pthread_mutex_lock(&mMutex);
+  for (std::deque<NfcWorkerTask*>::iterator it = mTasks.begin(); it != mTasks.end(); ++it) {
+    if (*it == task) {
+      mTasks.erase(it);
+      pthread_mutex_unlock(&mMutex);
+      return true;
+    }
+  }
+  pthread_mutex_unlock(&mMutex);
+  return false;
+}
+
+void NfcWorkerPool::getStats(NfcWorkerPoolStats& stats)
+{
+  pthread_mutex_lock(&mMutex);
+  stats = mStats;
+  stats.pendingTasks = mTasks.size();
+  pthread_mutex_unlock(&mMutex);
+}
+
+void NfcWorkerPool::startWorkersLocked()
+{
+  for (int i = 0; i < WORKER_COUNT; i++) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, workerThreadFunc, this) != 0) {
+      ALOGE("%s: pthread_create failed", FUNC);
+      continue;
+    }
+    pthread_detach(tid);
+  }
+  mStarted = true;
+}
+
+void* NfcWorkerPool::workerThreadFunc(void* arg)
+{
+  pthread_setname_np(pthread_self(), "NFC worker");
+  NfcWorkerPool* pool = reinterpret_cast<NfcWorkerPool*>(arg);
+  pool->workerLoop();
+  return NULL;
+}
+
+void NfcWorkerPool::workerLoop()
+{
+  pthread_mutex_lock(&mMutex);
+  while (true) {
+    while (mTasks.empty()) {
+      pthread_cond_wait(&mCond, &mMutex);
+    }
+
+    NfcWorkerTask* task = mTasks.front();
+    mTasks.pop_front();
+    mStats.busyWorkers++;
+    pthread_mutex_unlock(&mMutex);
+
+    task->run();
+    delete task;
+
+    pthread_mutex_lock(&mMutex);
+    mStats.busyWorkers--;
+    mStats.completed++;
+  }
+}
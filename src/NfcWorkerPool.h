@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcWorkerPool_h
+#define mozilla_nfcd_NfcWorkerPool_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+
+/**
+ * A unit of work run by NfcWorkerPool. The pool deletes the task after
+ * run() returns.
+ */
+class NfcWorkerTask {
+public:
+  virtual ~NfcWorkerTask() {};
+  virtual void run() = 0;
+};
+
+/**
+ * Counters of NfcWorkerPool.
+ */
+struct NfcWorkerPoolStats {
+  uint32_t submitted;
+  uint32_t rejected;   // Tasks refused because the pool was saturated.
+  uint32_t completed;
+  uint32_t busyWorkers;
+  uint32_t pendingTasks;
+};
+
+/**
+ * Fixed set of worker threads shared by the LLCP servers (SNEP, handover)
+ * to serve accepted connections, instead of creating a thread for each one.
+ *
+ * Concurrency is bounded: at most WORKER_COUNT tasks run at once and at most
+ * MAX_PENDING_TASKS wait for a worker. Workers are started on first use and
+ * live as long as the daemon.
+ *
+ * A connection holds its worker until it closes. Connections close after
+ * IDLE_TIMEOUT_MS without a request, so idle peers cannot keep queued
+ * connections from being served.
+ */
+class NfcWorkerPool {
+public:
+  static const int WORKER_COUNT = 4;
+  static const int MAX_PENDING_TASKS = 8;
+  static const int IDLE_TIMEOUT_MS = 10000;
+
+  static NfcWorkerPool* Instance();
+
+  /**
+   * Queue a task to be run on a worker thread.
+   *
+   * @param  task Task to run. The pool takes ownership only if the task is
+   *              accepted.
+   * @return      False if the pool is saturated.
+   */
+  bool submit(NfcWorkerTask* task);
+
+  /**
+   * Take back a task that no worker has started yet. Servers stopping use it
+   * for connections that would otherwise wait for a worker held by another
+   * server's connection.
+   *
+   * @param  task Task passed to submit().
+   * @return      True if the task was still queued; the caller owns it again.
+   *              False if it is running or done.
+   */
+  bool cancel(NfcWorkerTask* task);
+
+  /**
+   * Get a snapshot of the pool counters.
+   *
+   * @param  stats Filled with the counters.
+   * @return       None.
+   */
+  void getStats(NfcWorkerPoolStats& stats);
+
+private:
+  NfcWorkerPool();
+
+  static NfcWorkerPool* sInstance;
+  static void* workerThreadFunc(void* arg);
+
+  void startWorkersLocked();
+  void workerLoop();
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  bool mStarted;
+  std::deque<NfcWorkerTask*> mTasks;
+  NfcWorkerPoolStats mStats;
+};
+
+#endif // mozilla_nfcd_NfcWorkerPool_h
@@ -119,8 +119,8 @@ void P2pLinkManager::enableDisable(bool bEnable)
   }
 }
 
-// TODO : P2P push will block in llcp socket send/receive.
-//        Maybe we should create a thread to do it ?
+// Runs on the NfcService thread. It blocks while the message is sent, but
+// every LLCP send and receive on the way times out after a few seconds.
 void P2pLinkManager::push(NdefMessage& ndef)
 {
   if (ndef.mRecords.size() == 0) {
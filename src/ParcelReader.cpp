@@ -0,0 +1,52 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "ParcelReader.h"
+
+#include <string.h>
+
+#define PAD_SIZE(s) (((s) + 3) & ~3)
+
+ParcelReader::ParcelReader(const uint8_t* data, size_t length)
+ : mData(data)
+ , mLength(length)
+ , mPos(0)
+{
+}
+
+int ParcelReader::readInt32(int32_t* value)
+{
+  if (dataAvail() < sizeof(int32_t)) {
+    return -1;
+  }
+
+  // The frame has no alignment guarantee.
+  memcpy(value, mData + mPos, sizeof(int32_t));
+  mPos += sizeof(int32_t);
+  return 0;
+}
+
+int32_t ParcelReader::readInt32()
+{
+  int32_t value = 0;
+  readInt32(&value);
+  return value;
+}
+
+const uint8_t* ParcelReader::readInplace(size_t length)
+{
+  if (length > dataAvail()) {
+    return NULL;
+  }
+
+  // Tolerate a missing pad after the last item of the frame.
+  size_t padded = PAD_SIZE(length);
+  if (padded > dataAvail()) {
+    padded = dataAvail();
+  }
+
+  const uint8_t* data = mData + mPos;
+  mPos += padded;
+  return data;
+}
@@ -0,0 +1,54 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_ParcelReader_h
+#define mozilla_nfcd_ParcelReader_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Reads Parcel-encoded data in place.
+ *
+ * android::Parcel::setData() copies the whole buffer before anything can be
+ * read. ParcelReader decodes the same format (little-endian int32 values,
+ * in-place data padded to 4 bytes) directly from a buffer owned by the
+ * caller, which must stay valid as long as anything returned by
+ * readInplace() is used.
+ */
+class ParcelReader {
+public:
+  ParcelReader(const uint8_t* data, size_t length);
+
+  /**
+   * @param  value Output value.
+   * @return       0 if ok, -1 if the buffer is exhausted.
+   */
+  int readInt32(int32_t* value);
+
+  /**
+   * @return The value, or 0 if the buffer is exhausted.
+   */
+  int32_t readInt32();
+
+  /**
+   * Get a pointer to the next length bytes without copying them.
+   *
+   * @param  length Number of bytes to read.
+   * @return        Pointer into the buffer, or NULL if it is too short.
+   */
+  const uint8_t* readInplace(size_t length);
+
+  /**
+   * @return Number of bytes not read yet.
+   */
+  size_t dataAvail() { return mLength - mPos; }
+
+private:
+  const uint8_t* mData;
+  size_t mLength;
+  size_t mPos;
+};
+
+#endif // mozilla_nfcd_ParcelReader_h
@@ -0,0 +1,267 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "PresenceCheckScheduler.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "INfcTag.h"
+#include "NfcCounters.h"
+#include "NfcService.h"
+#include "NfcUtil.h"
+#include "NfcDebug.h"
+
+// Check intervals of tags that do not report their own.
+#define PRESENCE_CHECK_MIN_INTERVAL_MS 100
+#define PRESENCE_CHECK_MAX_INTERVAL_MS 1000
+
+PresenceCheckScheduler* PresenceCheckScheduler::sInstance = NULL;
+
+PresenceCheckScheduler* PresenceCheckScheduler::Instance()
+{
+  if (!sInstance)
+    sInstance = new PresenceCheckScheduler();
+  return sInstance;
+}
+
+PresenceCheckScheduler::PresenceCheckScheduler()
+ : mTimerFd(-1)
+ , mIsTimerArmed(false)
+ , mIsChecking(false)
+ , mCurrentSlot(0)
+ , mLostLastPresentUs(0)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+
+  mTimerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+  if (mTimerFd < 0) {
+    ALOGE("%s: timerfd_create failed: %s", FUNC, strerror(errno));
+    abort();
+  }
+
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, threadFunc, this) != 0) {
+    ALOGE("%s: pthread_create failed", FUNC);
+    abort();
+  }
+  pthread_detach(tid);
+}
+
+void* PresenceCheckScheduler::threadFunc(void* arg)
+{
+  pthread_setname_np(pthread_self(), "NFC presence");
+  PresenceCheckScheduler* scheduler = reinterpret_cast<PresenceCheckScheduler*>(arg);
+  scheduler->loop();
+  return NULL;
+}
+
+void PresenceCheckScheduler::start(INfcTag* tag)
+{
+  uint32_t minIntervalMs = 0;
+  uint32_t maxIntervalMs = 0;
+  tag->getPresenceCheckIntervals(minIntervalMs, maxIntervalMs);
+
+  pthread_mutex_lock(&mMutex);
+  if (mEntries.find(tag) == mEntries.end()) {
+    Entry* entry = new Entry();
+    entry->tag = tag;
+    entry->intervalMs = minIntervalMs ? minIntervalMs : PRESENCE_CHECK_MIN_INTERVAL_MS;
+    entry->maxIntervalMs = maxIntervalMs ? maxIntervalMs : PRESENCE_CHECK_MAX_INTERVAL_MS;
+    if (entry->maxIntervalMs < entry->intervalMs) {
+      entry->maxIntervalMs = entry->intervalMs;
+    }
+    entry->isCancelled = false;
+    entry->lastPresentUs = NfcUtil::getMonotonicTimeUs();
+    mEntries[tag] = entry;
+    scheduleLocked(entry, entry->intervalMs);
+    updateTimerLocked();
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void PresenceCheckScheduler::cancel(INfcTag* tag)
+{
+  pthread_mutex_lock(&mMutex);
+  std::map<INfcTag*, Entry*>::iterator it = mEntries.find(tag);
+  if (it != mEntries.end()) {
+    Entry* entry = it->second;
+    mEntries.erase(it);
+    if (entry->slot >= 0) {
+      mSlots[entry->slot].remove(entry);
+      delete entry;
+    } else {
+      // The check is running; runCheck() frees the entry.
+      entry->isCancelled = true;
+    }
+    updateTimerLocked();
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void PresenceCheckScheduler::cancelAll()
+{
+  pthread_mutex_lock(&mMutex);
+  std::map<INfcTag*, Entry*>::iterator it;
+  for (it = mEntries.begin(); it != mEntries.end(); it++) {
+    Entry* entry = it->second;
+    if (entry->slot >= 0) {
+      mSlots[entry->slot].remove(entry);
+      delete entry;
+    } else {
+      // Due or running; runCheck() frees the entry.
+      entry->isCancelled = true;
+    }
+  }
+  mEntries.clear();
+  updateTimerLocked();
+
+  while (mIsChecking) {
+    pthread_cond_wait(&mCond, &mMutex);
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void PresenceCheckScheduler::onTechLostNotified()
+{
+  pthread_mutex_lock(&mMutex);
+  if (mLostLastPresentUs) {
+    mRemovalLatency.record(NfcUtil::getMonotonicTimeUs() - mLostLastPresentUs);
+    mLostLastPresentUs = 0;
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void PresenceCheckScheduler::scheduleLocked(Entry* entry, uint32_t delayMs)
+{
+  uint32_t ticks = delayMs / PRESENCE_CHECK_WHEEL_TICK_MS;
+  if (ticks == 0) {
+    ticks = 1;
+  }
+
+  entry->slot = (mCurrentSlot + ticks) % PRESENCE_CHECK_WHEEL_SLOTS;
+  entry->rounds = (ticks - 1) / PRESENCE_CHECK_WHEEL_SLOTS;
+  mSlots[entry->slot].push_back(entry);
+}
+
+void PresenceCheckScheduler::updateTimerLocked()
+{
+  // Only tick while there is something to check.
+  bool shouldArm = !mEntries.empty();
+  if (shouldArm == mIsTimerArmed) {
+    return;
+  }
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (shouldArm) {
+    spec.it_interval.tv_nsec = PRESENCE_CHECK_WHEEL_TICK_MS * 1000000;
+    spec.it_value = spec.it_interval;
+  }
+
+  if (timerfd_settime(mTimerFd, 0, &spec, NULL) < 0) {
+    ALOGE("%s: timerfd_settime failed: %s", FUNC, strerror(errno));
+    return;
+  }
+  mIsTimerArmed = shouldArm;
+}
+
+void PresenceCheckScheduler::loop()
+{
+  while (true) {
+    uint64_t expirations;
+    ssize_t ret = read(mTimerFd, &expirations, sizeof(expirations));
+    if (ret != sizeof(expirations)) {
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      ALOGE("%s: timerfd read failed: %s", FUNC, strerror(errno));
+      abort();
+    }
+
+    // Advance one slot per expiration, so a late wakeup catches up.
+    std::list<Entry*> due;
+    pthread_mutex_lock(&mMutex);
+    for (uint64_t i = 0; i < expirations; i++) {
+      mCurrentSlot = (mCurrentSlot + 1) % PRESENCE_CHECK_WHEEL_SLOTS;
+      std::list<Entry*>& slot = mSlots[mCurrentSlot];
+      std::list<Entry*>::iterator it = slot.begin();
+      while (it != slot.end()) {
+        Entry* entry = *it;
+        if (entry->rounds > 0) {
+          entry->rounds--;
+          it++;
+          continue;
+        }
+        entry->slot = -1;
+        due.push_back(entry);
+        it = slot.erase(it);
+      }
+    }
+    pthread_mutex_unlock(&mMutex);
+
+    for (std::list<Entry*>::iterator it = due.begin(); it != due.end(); it++) {
+      runCheck(*it);
+    }
+  }
+}
+
+void PresenceCheckScheduler::runCheck(Entry* entry)
+{
+  pthread_mutex_lock(&mMutex);
+  if (entry->isCancelled) {
+    delete entry;
+    pthread_mutex_unlock(&mMutex);
+    return;
+  }
+  mIsChecking = true;
+  pthread_mutex_unlock(&mMutex);
+
+  // The RF operation runs without the lock, so cancel() does not block on it.
+  bool isPresent = entry->tag->presenceCheck();
+  NfcCounters::increment(NFC_STATS_PRESENCE_CHECKS);
+  if (!isPresent) {
+    NfcCounters::increment(NFC_STATS_PRESENCE_FAILURES);
+  }
+
+  INfcTag* lostTag = NULL;
+  pthread_mutex_lock(&mMutex);
+  if (entry->isCancelled) {
+    delete entry;
+  } else if (isPresent) {
+    entry->lastPresentUs = NfcUtil::getMonotonicTimeUs();
+    entry->intervalMs *= 2;
+    if (entry->intervalMs > entry->maxIntervalMs) {
+      entry->intervalMs = entry->maxIntervalMs;
+    }
+    scheduleLocked(entry, entry->intervalMs);
+  } else {
+    lostTag = entry->tag;
+    mLostLastPresentUs = entry->lastPresentUs;
+    mEntries.erase(lostTag);
+    delete entry;
+    updateTimerLocked();
+  }
+  pthread_mutex_unlock(&mMutex);
+
+  if (lostTag) {
+    ALOGD("%s: tag lost", FUNC);
+    lostTag->disconnect();
+  }
+
+  // Idle before posting: posting may wait for room in the NfcService
+  // queue, while the NfcService thread may be in cancelAll().
+  pthread_mutex_lock(&mMutex);
+  mIsChecking = false;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+
+  if (lostTag) {
+    NfcService::notifyTagLost();
+  }
+}
@@ -0,0 +1,108 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_PresenceCheckScheduler_h
+#define mozilla_nfcd_PresenceCheckScheduler_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <list>
+#include <map>
+
+#include "NfcStats.h"
+
+class INfcTag;
+
+#define PRESENCE_CHECK_WHEEL_TICK_MS  10
+#define PRESENCE_CHECK_WHEEL_SLOTS    128
+
+/**
+ * Checks periodically whether discovered tags are still in the field.
+ *
+ * All tags are served by one thread driven by a timerfd ticking every
+ * PRESENCE_CHECK_WHEEL_TICK_MS. Pending checks sit in a hashed timer wheel,
+ * so scheduling and cancelling are O(1) and the thread only wakes up while
+ * checks are pending. A tag is checked often right after activation, and
+ * the interval doubles after each successful check up to a maximum; both
+ * come from INfcTag::getPresenceCheckIntervals(). When a check fails the tag
+ * is disconnected and TECH_LOST is posted.
+ */
+class PresenceCheckScheduler {
+public:
+  static PresenceCheckScheduler* Instance();
+
+  /**
+   * Start checking a tag. Does nothing if it is already being checked.
+   *
+   * @param  tag Tag that was just discovered.
+   * @return     None.
+   */
+  void start(INfcTag* tag);
+
+  /**
+   * Stop checking a tag, e.g. because it was disconnected.
+   *
+   * @param  tag Tag to stop checking.
+   * @return     None.
+   */
+  void cancel(INfcTag* tag);
+
+  /**
+   * Stop checking every tag and wait for a running check to finish, so that
+   * no presence check is inside the NFC stack when it shuts down.
+   *
+   * @return None.
+   */
+  void cancelAll();
+
+  /**
+   * Record that TECH_LOST was sent for the tag last reported lost.
+   *
+   * @return None.
+   */
+  void onTechLostNotified();
+
+  /**
+   * Time from the last successful check of a lost tag to its TECH_LOST
+   * notification; an upper bound of the removal latency.
+   */
+  NfcLatencyHistogram& getRemovalLatency() { return mRemovalLatency; }
+
+private:
+  struct Entry {
+    INfcTag* tag;
+    uint32_t intervalMs;
+    uint32_t maxIntervalMs;
+    uint32_t rounds;     // Full wheel turns left before the check is due.
+    int slot;            // -1 while the check is running.
+    bool isCancelled;
+    uint64_t lastPresentUs;
+  };
+
+  PresenceCheckScheduler();
+
+  static void* threadFunc(void* arg);
+  void loop();
+
+  void scheduleLocked(Entry* entry, uint32_t delayMs);
+  void runCheck(Entry* entry);
+  void updateTimerLocked();
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  int mTimerFd;
+  bool mIsTimerArmed;
+  bool mIsChecking;    // A check is using the tag; see cancelAll().
+
+  std::list<Entry*> mSlots[PRESENCE_CHECK_WHEEL_SLOTS];
+  uint32_t mCurrentSlot;
+  std::map<INfcTag*, Entry*> mEntries;
+
+  uint64_t mLostLastPresentUs;
+  NfcLatencyHistogram mRemovalLatency;
+
+  static PresenceCheckScheduler* sInstance;
+};
+
+#endif // mozilla_nfcd_PresenceCheckScheduler_h
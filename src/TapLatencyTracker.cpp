@@ -0,0 +1,260 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "TapLatencyTracker.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "NfcUtil.h"
+#include "NfcDebug.h"
+
+static const char* sStageNames[TAP_STAGE_END] = {
+  "activation",
+  "queue",
+  "read_ndef",
+  "encode",
+  "write",
+  "total",
+};
+
+TapLatencyTracker* TapLatencyTracker::sInstance = NULL;
+
+TapLatencyTracker* TapLatencyTracker::Instance()
+{
+  if (!sInstance)
+    sInstance = new TapLatencyTracker();
+  return sInstance;
+}
+
+TapLatencyTracker::TapLatencyTracker()
+ : mNextId(1)
+ , mActivatedUs(0)
+ , mNotifyingId(0)
+ , mCompletedCount(0)
+ , mDroppedCount(0)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  memset(mTaps, 0, sizeof(mTaps));
+}
+
+const char* TapLatencyTracker::getStageName(TapStage stage)
+{
+  return sStageNames[stage];
+}
+
+TapLatencyTracker::Tap* TapLatencyTracker::findLocked(INfcTag* tag)
+{
+  for (int i = 0; i < TAP_LATENCY_SLOTS; i++) {
+    if (mTaps[i].id && mTaps[i].tag == tag) {
+      return &mTaps[i];
+    }
+  }
+  return NULL;
+}
+
+TapLatencyTracker::Tap* TapLatencyTracker::findLocked(uint32_t id)
+{
+  for (int i = 0; i < TAP_LATENCY_SLOTS; i++) {
+    if (id && mTaps[i].id == id) {
+      return &mTaps[i];
+    }
+  }
+  return NULL;
+}
+
+void TapLatencyTracker::dropLocked(Tap* tap)
+{
+  tap->id = 0;
+  mDroppedCount++;
+}
+
+void TapLatencyTracker::onActivated()
+{
+  pthread_mutex_lock(&mMutex);
+  mActivatedUs = NfcUtil::getMonotonicTimeUs();
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::onDiscovered(INfcTag* tag)
+{
+  uint64_t now = NfcUtil::getMonotonicTimeUs();
+
+  pthread_mutex_lock(&mMutex);
+  // A tap still in flight for the same tag will not complete anymore.
+  Tap* tap = findLocked(tag);
+  if (tap) {
+    dropLocked(tap);
+  }
+
+  // Take a free slot, or the oldest tap if all are in use.
+  tap = &mTaps[0];
+  for (int i = 0; i < TAP_LATENCY_SLOTS; i++) {
+    if (!mTaps[i].id) {
+      tap = &mTaps[i];
+      break;
+    }
+    if (mTaps[i].id < tap->id) {
+      tap = &mTaps[i];
+    }
+  }
+  if (tap->id) {
+    dropLocked(tap);
+  }
+
+  tap->id = mNextId++;
+  if (!mNextId) {
+    mNextId = 1;
+  }
+  tap->tag = tag;
+  tap->isQueued = false;
+  memset(tap->timeUs, 0, sizeof(tap->timeUs));
+  // Without an activation mark the tap starts at discovery.
+  tap->timeUs[TAP_STAGE_ACTIVATION] = mActivatedUs ? mActivatedUs : now;
+  tap->timeUs[TAP_STAGE_QUEUE] = now;
+  mActivatedUs = 0;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::onDispatched(INfcTag* tag)
+{
+  uint64_t now = NfcUtil::getMonotonicTimeUs();
+
+  pthread_mutex_lock(&mMutex);
+  Tap* tap = findLocked(tag);
+  if (tap) {
+    tap->timeUs[TAP_STAGE_READ_NDEF] = now;
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::onNdefRead(INfcTag* tag)
+{
+  uint64_t now = NfcUtil::getMonotonicTimeUs();
+
+  pthread_mutex_lock(&mMutex);
+  Tap* tap = findLocked(tag);
+  if (tap) {
+    tap->timeUs[TAP_STAGE_ENCODE] = now;
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::beginNotify(INfcTag* tag)
+{
+  pthread_mutex_lock(&mMutex);
+  Tap* tap = findLocked(tag);
+  mNotifyingId = tap ? tap->id : 0;
+  mNotifyingThread = pthread_self();
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::endNotify()
+{
+  pthread_mutex_lock(&mMutex);
+  Tap* tap = findLocked(mNotifyingId);
+  if (tap && !tap->isQueued) {
+    // No client was there to send it to.
+    dropLocked(tap);
+  }
+  mNotifyingId = 0;
+  pthread_mutex_unlock(&mMutex);
+}
+
+uint32_t TapLatencyTracker::onMessageQueued()
+{
+  uint32_t id = 0;
+
+  pthread_mutex_lock(&mMutex);
+  Tap* tap = findLocked(mNotifyingId);
+  if (tap && pthread_equal(mNotifyingThread, pthread_self())) {
+    // A broadcast queues one copy per client; the first one counts.
+    if (!tap->isQueued) {
+      tap->isQueued = true;
+      tap->timeUs[TAP_STAGE_WRITE] = NfcUtil::getMonotonicTimeUs();
+    }
+    id = tap->id;
+  }
+  pthread_mutex_unlock(&mMutex);
+  return id;
+}
+
+void TapLatencyTracker::onMessageWritten(uint32_t tapId)
+{
+  uint64_t now = NfcUtil::getMonotonicTimeUs();
+
+  pthread_mutex_lock(&mMutex);
+  // The first client to get the notification completes the tap.
+  Tap* tap = findLocked(tapId);
+  if (tap && tap->isQueued) {
+    for (int stage = TAP_STAGE_ACTIVATION; stage < TAP_STAGE_TOTAL; stage++) {
+      uint64_t end = stage + 1 < TAP_STAGE_TOTAL ? tap->timeUs[stage + 1] : now;
+      if (tap->timeUs[stage] && end >= tap->timeUs[stage]) {
+        mLatency[stage].record(end - tap->timeUs[stage]);
+      }
+    }
+    mLatency[TAP_STAGE_TOTAL].record(now - tap->timeUs[TAP_STAGE_ACTIVATION]);
+    tap->id = 0;
+    mCompletedCount++;
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::getSummary(Summary& summary)
+{
+  pthread_mutex_lock(&mMutex);
+  summary.completedCount = mCompletedCount;
+  summary.droppedCount = mDroppedCount;
+  for (int i = 0; i < TAP_STAGE_END; i++) {
+    summary.latency[i] = mLatency[i];
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+void TapLatencyTracker::logSummary()
+{
+  Summary summary;
+  getSummary(summary);
+
+  ALOGD("%s: %u taps, %u dropped", FUNC, summary.completedCount, summary.droppedCount);
+  for (int i = 0; i < TAP_STAGE_END; i++) {
+    NfcLatencyHistogram& latency = summary.latency[i];
+    ALOGD("%s: %-10s p50=%lluus p99=%lluus p999=%lluus", FUNC, sStageNames[i],
+          (unsigned long long)latency.getPercentileUs(50),
+          (unsigned long long)latency.getPercentileUs(99),
+          (unsigned long long)latency.getPercentileUs(99.9));
+  }
+}
+
+bool TapLatencyTracker::writeReport(const char* path)
+{
+  Summary summary;
+  getSummary(summary);
+
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    ALOGE("%s: cannot open %s: %s", FUNC, path, strerror(errno));
+    return false;
+  }
+
+  fprintf(file, "{\n  \"taps\": %u,\n  \"dropped\": %u,\n  \"stages\": {\n",
+          summary.completedCount, summary.droppedCount);
+  for (int i = 0; i < TAP_STAGE_END; i++) {
+    NfcLatencyHistogram& latency = summary.latency[i];
+    fprintf(file, "    \"%s\": { \"count\": %u, \"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu }%s\n",
+            sStageNames[i], latency.getCount(),
+            (unsigned long long)latency.getPercentileUs(50),
+            (unsigned long long)latency.getPercentileUs(99),
+            (unsigned long long)latency.getPercentileUs(99.9),
+            i + 1 < TAP_STAGE_END ? "," : "");
+  }
+  fprintf(file, "  }\n}\n");
+
+  bool result = fclose(file) == 0;
+  if (!result) {
+    ALOGE("%s: cannot write %s: %s", FUNC, path, strerror(errno));
+  }
+  return result;
+}
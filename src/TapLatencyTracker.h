@@ -0,0 +1,136 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_TapLatencyTracker_h
+#define mozilla_nfcd_TapLatencyTracker_h
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "NfcStats.h"
+
+class INfcTag;
+
+/**
+ * Stages of the path from RF activation of a tag to the TECH_DISCOVERED
+ * notification reaching a client socket.
+ */
+typedef enum {
+  TAP_STAGE_ACTIVATION = 0,  // RF activation until TAG_DISCOVERED is posted.
+  TAP_STAGE_QUEUE,           // Waiting in the NfcService event queue.
+  TAP_STAGE_READ_NDEF,       // INfcTag::readNdef().
+  TAP_STAGE_ENCODE,          // Building TECH_DISCOVERED until it is queued to the socket.
+  TAP_STAGE_WRITE,           // Queued until written to a client socket.
+  TAP_STAGE_TOTAL,           // RF activation until written.
+  TAP_STAGE_END
+} TapStage;
+
+#define TAP_LATENCY_SLOTS 16
+
+/**
+ * Measures each stage of every tag tap.
+ *
+ * The vendor layer marks the RF activation, NfcService the discovery,
+ * dispatch and NDEF read, and NfcIpcSocket the write of the notification.
+ * Up to TAP_LATENCY_SLOTS taps can be in flight; a tap that never reaches
+ * a client, e.g. because none is connected, is counted as dropped.
+ */
+class TapLatencyTracker {
+public:
+  static TapLatencyTracker* Instance();
+
+  /**
+   * Called by the vendor layer when a tag is activated, before it is
+   * reported through DeviceHost::notifyTagDiscovered().
+   *
+   * @return None.
+   */
+  void onActivated();
+
+  void onDiscovered(INfcTag* tag);
+  void onDispatched(INfcTag* tag);
+  void onNdefRead(INfcTag* tag);
+
+  /**
+   * Bracket the TECH_DISCOVERED notification of a tag. Messages queued by
+   * the calling thread in between belong to the tap.
+   */
+  void beginNotify(INfcTag* tag);
+  void endNotify();
+
+  /**
+   * Called by NfcIpcSocket when it queues a message.
+   *
+   * @return Id of the tap the message belongs to, 0 if none.
+   */
+  uint32_t onMessageQueued();
+
+  /**
+   * Called by NfcIpcSocket when a message tagged by onMessageQueued() has
+   * been written completely.
+   *
+   * @param  tapId Id returned by onMessageQueued().
+   * @return       None.
+   */
+  void onMessageWritten(uint32_t tapId);
+
+  NfcLatencyHistogram& getLatency(TapStage stage) { return mLatency[stage]; }
+
+  static const char* getStageName(TapStage stage);
+
+  /**
+   * Log p50/p99/p999 of every stage.
+   *
+   * @return None.
+   */
+  void logSummary();
+
+  /**
+   * Write p50/p99/p999 of every stage as JSON, to be kept as a baseline.
+   *
+   * @param  path Output file.
+   * @return      True if written.
+   */
+  bool writeReport(const char* path);
+
+private:
+  struct Tap {
+    uint32_t id;                     // 0 if the slot is free.
+    INfcTag* tag;
+    bool isQueued;
+    uint64_t timeUs[TAP_STAGE_END];  // Start of each stage; the last is the write.
+  };
+
+  // Consistent copy of the results, taken under mMutex.
+  struct Summary {
+    uint32_t completedCount;
+    uint32_t droppedCount;
+    NfcLatencyHistogram latency[TAP_STAGE_END];
+  };
+
+  TapLatencyTracker();
+
+  void getSummary(Summary& summary);
+
+  Tap* findLocked(INfcTag* tag);
+  Tap* findLocked(uint32_t id);
+  void dropLocked(Tap* tap);
+
+  pthread_mutex_t mMutex;
+  Tap mTaps[TAP_LATENCY_SLOTS];
+  uint32_t mNextId;
+  uint64_t mActivatedUs;
+
+  // Tap being notified, and the thread doing it.
+  uint32_t mNotifyingId;
+  pthread_t mNotifyingThread;
+
+  NfcLatencyHistogram mLatency[TAP_STAGE_END];
+  uint32_t mCompletedCount;
+  uint32_t mDroppedCount;
+
+  static TapLatencyTracker* sInstance;
+};
+
+#endif // mozilla_nfcd_TapLatencyTracker_h
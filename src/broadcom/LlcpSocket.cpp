@@ -5,15 +5,20 @@
 #include "LlcpSocket.h"
 
 #include "PeerToPeer.h"
+#include "NfcTrace.h"
 
 #define LOG_TAG "BroadcomNfc"
 #include <cutils/log.h>
 
+// LLCP default MIU; the smallest unit a peer may send.
+#define LLCP_DEFAULT_MIU 128
+
 LlcpSocket::LlcpSocket(unsigned int handle, int sap, int miu, int rw)
   : mHandle(handle)
   , mSap(sap)
   , mLocalMiu(miu)
   , mLocalRw(rw)
+  , mTimeoutMs(0)
 {
 }
 
@@ -21,6 +26,7 @@ LlcpSocket::LlcpSocket(unsigned int handle, int miu, int rw)
   : mHandle(handle)
   , mLocalMiu(miu)
   , mLocalRw(rw)
+  , mTimeoutMs(0)
 {
 }
 
@@ -48,12 +54,36 @@ void LlcpSocket::close()
 
 bool LlcpSocket::send(std::vector<uint8_t>& data)
 {
-  return LlcpSocket::doSend(data);
+  return LlcpSocket::doSend(data.empty() ? NULL : &data[0], data.size());
+}
+
+bool LlcpSocket::send(const uint8_t* data, size_t length)
+{
+  return LlcpSocket::doSend(data, length);
 }
 
 int LlcpSocket::receive(std::vector<uint8_t>& recvBuff)
 {
-  return LlcpSocket::doReceive(recvBuff);;
+  // The peer never sends more than our MIU in one I-PDU.
+  if (mRecvBuffer.empty()) {
+    mRecvBuffer.resize(mLocalMiu > LLCP_DEFAULT_MIU ? mLocalMiu : LLCP_DEFAULT_MIU);
+  }
+
+  int length = LlcpSocket::doReceive(&mRecvBuffer[0], mRecvBuffer.size());
+  if (length > 0) {
+    recvBuff.insert(recvBuff.end(), mRecvBuffer.begin(), mRecvBuffer.begin() + length);
+  }
+  return length;
+}
+
+int LlcpSocket::receive(uint8_t* buffer, size_t length)
+{
+  return LlcpSocket::doReceive(buffer, length);
+}
+
+void LlcpSocket::cancel()
+{
+  PeerToPeer::getInstance().cancel(mHandle);
 }
 
 int LlcpSocket::getRemoteMiu() const
@@ -111,43 +141,43 @@ bool LlcpSocket::doClose()
   return true;  // TODO: stat?
 }
 
-bool LlcpSocket::doSend(std::vector<uint8_t>& data)
+bool LlcpSocket::doSend(const uint8_t* data, size_t length)
 {
-  UINT8* raw_ptr = new UINT8[data.size()];
-
-  for(uint32_t i = 0; i < data.size(); i++)
-    raw_ptr[i] = (UINT8)data[i];
+  if (length > 0xFFFF) {
+    ALOGE("%s: data too long: %u", __FUNCTION__, length);
+    return false;
+  }
 
-  bool stat = PeerToPeer::getInstance().send(mHandle, raw_ptr, data.size());
+  // NFA copies the data into its own buffer before NFA_P2pSendData returns,
+  // so the caller's buffer can be passed directly.
+  NFC_TRACE_IO(NFC_TRACE_LLCP_SEND, NFC_TRACE_BEGIN, length, 0);
+  bool stat = PeerToPeer::getInstance().send(mHandle, const_cast<UINT8*>(data), length, mTimeoutMs);
+  NFC_TRACE_IO(NFC_TRACE_LLCP_SEND, NFC_TRACE_FINISH, length, stat);
   if (!stat) {
     ALOGE("%s: fail send", __FUNCTION__);
-  }  
-
-  delete[] raw_ptr;
+  }
 
   return stat;
 }
 
-int LlcpSocket::doReceive(std::vector<uint8_t>& recvBuff)
+int LlcpSocket::doReceive(uint8_t* buffer, size_t length)
 {
-  const uint16_t MAX_BUF_SIZE = 4096;
-  uint16_t actualLen = 0;
+  if (!buffer || length == 0) {
+    return -1;
+  }
 
-  UINT8* raw_ptr = new UINT8[MAX_BUF_SIZE];
-  bool stat = PeerToPeer::getInstance().receive(mHandle, raw_ptr, MAX_BUF_SIZE, actualLen);
+  // NFA reads at most 0xFFFF bytes at a time.
+  uint16_t bufferLen = length > 0xFFFF ? 0xFFFF : (uint16_t)length;
+  uint16_t actualLen = 0;
 
-  int retval = 0;
-  if (stat && (actualLen > 0)) {
-    for (uint16_t i = 0; i < actualLen; i++)
-      recvBuff.push_back(raw_ptr[i]);
-    retval = actualLen;
-  } else {
-    retval = -1;
+  NFC_TRACE_IO(NFC_TRACE_LLCP_RECEIVE, NFC_TRACE_BEGIN, 0, 0);
+  bool stat = PeerToPeer::getInstance().receive(mHandle, buffer, bufferLen, actualLen, mTimeoutMs);
+  NFC_TRACE_IO(NFC_TRACE_LLCP_RECEIVE, NFC_TRACE_FINISH, actualLen, stat);
+  if (!stat || actualLen == 0) {
+    return -1;
   }
 
-  delete[] raw_ptr;
-
-  return retval;
+  return actualLen;
 }
 
 int LlcpSocket::doGetRemoteSocketMIU() const
@@ -51,14 +51,41 @@ public:
    */
   bool send(std::vector<uint8_t>& sendBuff);
 
+  /**
+   * Send data to peer.
+   *
+   * @param data   Data to send.
+   * @param length Number of bytes.
+   * @return       True if sent ok.
+   */
+  bool send(const uint8_t* data, size_t length);
+
   /**
    * Receive data from peer.
    *
-   * @param recvBuff Buffer to put received data.
-   * @return         Buffer to put received data.
+   * @param recvBuff Buffer to append received data to.
+   * @return         Number of bytes received, or -1 on failure.
    */
   int receive(std::vector<uint8_t>& recvBuff);
 
+  /**
+   * Receive data from peer.
+   *
+   * @param buffer Buffer to put received data.
+   * @param length Size of the buffer.
+   * @return       Number of bytes received, or -1 on failure.
+   */
+  int receive(uint8_t* buffer, size_t length);
+
+  void setTimeout(int timeoutMs) { mTimeoutMs = timeoutMs; }
+
+  /**
+   * Unblock pending send and receive.
+   *
+   * @return None.
+   */
+  void cancel();
+
   /**
    * Get peer's maximum information unit.
    *
@@ -82,13 +109,17 @@ private:
   int mSap;
   int mLocalMiu;
   int mLocalRw;
+  volatile int mTimeoutMs;  // 0 waits forever.
+
+  // Reused by receive(std::vector&), sized to the local MIU on first use.
+  std::vector<uint8_t> mRecvBuffer;
 
   bool doConnect(int nSap);
   bool doConnectBy(const char* sn);
   bool doClose();
 
-  bool doSend(std::vector<uint8_t>& data);
-  int doReceive(std::vector<uint8_t>& recvBuff);
+  bool doSend(const uint8_t* data, size_t length);
+  int doReceive(uint8_t* buffer, size_t length);
 
   int doGetRemoteSocketMIU() const;
   int doGetRemoteSocketRW() const;
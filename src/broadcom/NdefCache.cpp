@@ -0,0 +1,85 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NdefCache.h"
+
+#include "NfcCounters.h"
+#include "NfcUtil.h"
+
+#define LOG_TAG "BroadcomNfc"
+#include <cutils/log.h>
+
+NdefCache::NdefCache(uint32_t capacity, uint32_t ttlMs)
+  : mCapacity(capacity)
+  , mTtlMs(ttlMs)
+{
+}
+
+bool NdefCache::get(const std::vector<uint8_t>& uid, uint32_t currentSize, uint32_t maxSize,
+                    bool isReadOnly, std::vector<uint8_t>& buf)
+{
+  std::list<Entry>::iterator it;
+  for (it = mEntries.begin(); it != mEntries.end(); it++) {
+    if (it->uid == uid) {
+      break;
+    }
+  }
+
+  if (it == mEntries.end()) {
+    NfcCounters::increment(NFC_STATS_NDEF_CACHE_MISSES);
+    return false;
+  }
+
+  if (NfcUtil::getMonotonicTimeUs() / 1000 - it->timeMs > mTtlMs) {
+    mEntries.erase(it);
+    NfcCounters::increment(NFC_STATS_NDEF_CACHE_EXPIRATIONS);
+    NfcCounters::increment(NFC_STATS_NDEF_CACHE_MISSES);
+    return false;
+  }
+
+  if (it->currentSize != currentSize || it->maxSize != maxSize ||
+      it->isReadOnly != isReadOnly) {
+    // Same UID, different content.
+    mEntries.erase(it);
+    NfcCounters::increment(NFC_STATS_NDEF_CACHE_MISSES);
+    return false;
+  }
+
+  // Move to the front.
+  mEntries.splice(mEntries.begin(), mEntries, it);
+  buf = it->data;
+  NfcCounters::increment(NFC_STATS_NDEF_CACHE_HITS);
+  ALOGD("%s: hit, %u bytes", __FUNCTION__, (unsigned)buf.size());
+  return true;
+}
+
+void NdefCache::put(const std::vector<uint8_t>& uid, uint32_t currentSize, uint32_t maxSize,
+                    bool isReadOnly, const std::vector<uint8_t>& buf)
+{
+  remove(uid);
+
+  if (mEntries.size() >= mCapacity) {
+    mEntries.pop_back();
+  }
+
+  mEntries.push_front(Entry());
+  Entry& entry = mEntries.front();
+  entry.uid = uid;
+  entry.currentSize = currentSize;
+  entry.maxSize = maxSize;
+  entry.isReadOnly = isReadOnly;
+  entry.timeMs = NfcUtil::getMonotonicTimeUs() / 1000;
+  entry.data = buf;
+}
+
+void NdefCache::remove(const std::vector<uint8_t>& uid)
+{
+  std::list<Entry>::iterator it;
+  for (it = mEntries.begin(); it != mEntries.end(); it++) {
+    if (it->uid == uid) {
+      mEntries.erase(it);
+      return;
+    }
+  }
+}
@@ -0,0 +1,77 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NdefCache_h
+#define mozilla_nfcd_NdefCache_h
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+
+/**
+ * LRU cache of raw NDEF messages read from read-only tags.
+ *
+ * Entries are keyed by the tag UID together with the NDEF size, maximum
+ * size and read-only flag reported by NDEF detection, so a tag that was
+ * reformatted or made writable does not match. Entries expire after a TTL.
+ * Hits and misses are reported through NfcCounters.
+ *
+ * Not thread-safe; NfcTagManager only uses it with its mutex held.
+ */
+class NdefCache {
+public:
+  /**
+   * @param capacity Maximum number of cached messages.
+   * @param ttlMs    Time after which an entry is no longer used.
+   */
+  NdefCache(uint32_t capacity, uint32_t ttlMs);
+
+  /**
+   * Look up the NDEF message of a tag.
+   *
+   * @param  uid         UID of the tag.
+   * @param  currentSize NDEF size reported by NDEF detection.
+   * @param  maxSize     Maximum NDEF size reported by NDEF detection.
+   * @param  isReadOnly  Read-only flag reported by NDEF detection.
+   * @param  buf         Filled with the raw NDEF message on a hit.
+   * @return             True on a hit.
+   */
+  bool get(const std::vector<uint8_t>& uid, uint32_t currentSize, uint32_t maxSize,
+           bool isReadOnly, std::vector<uint8_t>& buf);
+
+  /**
+   * Store the NDEF message read from a tag, evicting the least recently used
+   * entry if the cache is full.
+   *
+   * @return None.
+   */
+  void put(const std::vector<uint8_t>& uid, uint32_t currentSize, uint32_t maxSize,
+           bool isReadOnly, const std::vector<uint8_t>& buf);
+
+  /**
+   * Forget the message of a tag, e.g. after it was written.
+   *
+   * @param  uid UID of the tag.
+   * @return     None.
+   */
+  void remove(const std::vector<uint8_t>& uid);
+
+private:
+  struct Entry {
+    std::vector<uint8_t> uid;
+    uint32_t currentSize;
+    uint32_t maxSize;
+    bool isReadOnly;
+    uint64_t timeMs;
+    std::vector<uint8_t> data;
+  };
+
+  uint32_t mCapacity;
+  uint32_t mTtlMs;
+
+  // Most recently used first.
+  std::list<Entry> mEntries;
+};
+
+#endif // mozilla_nfcd_NdefCache_h
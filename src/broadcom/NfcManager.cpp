@@ -17,6 +17,8 @@
 #include "LlcpServiceSocket.h"
 #include "NfcTagManager.h"
 #include "P2pDevice.h"
+#include "TapLatencyTracker.h"
+#include "NfcTrace.h"
 
 extern "C"
 {
@@ -417,6 +419,7 @@ static void handleRfDiscoveryEvent(tNFC_RESULT_DEVT* discoveredDevice)
 void nfaDeviceManagementCallback(UINT8 dmEvent, tNFA_DM_CBACK_DATA* eventData)
 {
   ALOGD("%s: enter; event=0x%X", __FUNCTION__, dmEvent);
+  NFC_TRACE_EVENT(NFC_TRACE_NFA_DM_EVT, NFC_TRACE_INSTANT, dmEvent, 0);
 
   switch (dmEvent) {
     // Result of NFA_Enable.
@@ -528,6 +531,7 @@ static void nfaConnectionCallback(UINT8 connEvent, tNFA_CONN_EVT_DATA* eventData
 {
   tNFA_STATUS status = NFA_STATUS_FAILED;
   ALOGD("%s: enter; event=0x%X", __FUNCTION__, connEvent);
+  NFC_TRACE_EVENT(NFC_TRACE_NFA_CONN_EVT, NFC_TRACE_INSTANT, connEvent, 0);
 
   switch (connEvent) {
     // Whether polling successfully started.
@@ -609,6 +613,7 @@ static void nfaConnectionCallback(UINT8 connEvent, tNFA_CONN_EVT_DATA* eventData
         // For the SE, consider the field to be on while p2p is active.
         // TODO : Implement SE
       } else if (pn544InteropIsBusy() == false) {
+        TapLatencyTracker::Instance()->onActivated();
         NfcTag::getInstance().connectionEventHandler(connEvent, eventData);
 
         // We know it is not activating for P2P.  If it activated in
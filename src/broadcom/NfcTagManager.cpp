@@ -6,10 +6,13 @@
 
 #include <semaphore.h>
 #include <errno.h>
+#include <string.h>
+#include <algorithm>
 #include <time.h>
 #include <signal.h>
 
 #include "NdefMessage.h"
+#include "NfcCounters.h"
 #include "TagTechnology.h"
 #include "NfcUtil.h"
 #include "NfcTag.h"
@@ -49,6 +52,29 @@ bool    gIsSelectingRfInterface = false;
 
 #define STATUS_CODE_TARGET_LOST    146  // This error code comes from the service.
 
+// Read-only tags tapped again within this time are served from the cache.
+#define NDEF_CACHE_CAPACITY        16
+#define NDEF_CACHE_TTL_MS          (5 * 60 * 1000)
+
+/**
+ * Presence-check strategy per protocol. NFA_RwPresenceCheck() already sends
+ * the cheapest command for the activated protocol (e.g. a T2T read, a T3T
+ * poll, an empty ISO-DEP I-block), so the table only tunes how often we ask
+ * and how many consecutive failures make a tag absent. ISO-DEP checks
+ * interrupt APDU exchanges, so cards are checked less often. The last entry
+ * is the fallback.
+ */
+static const PresenceCheckStrategy sPresenceCheckStrategies[] = {
+  { NFA_PROTOCOL_T1T,      "T1T",      3, 100, 500  },
+  { NFA_PROTOCOL_T2T,      "T2T",      3, 100, 500  },
+  { NFA_PROTOCOL_T3T,      "T3T",      3, 100, 500  },
+  { NFA_PROTOCOL_ISO_DEP,  "ISO-DEP",  2, 250, 1000 },
+  { NFA_PROTOCOL_ISO15693, "ISO15693", 3, 200, 1000 },
+  { 0,                     "default",  4, 100, 1000 },
+};
+#define PRESENCE_CHECK_STRATEGY_COUNT \
+  (int)(sizeof(sPresenceCheckStrategies) / sizeof(sPresenceCheckStrategies[0]))
+
 static uint32_t     sCheckNdefCurrentSize = 0;
 static tNFA_STATUS  sCheckNdefStatus = 0;      // Whether tag already contains a NDEF message.
 static bool         sCheckNdefCapable = false; // Whether tag has NDEF capability.
@@ -111,8 +137,17 @@ static void ndefHandlerCallback(tNFA_NDEF_EVT event, tNFA_NDEF_EVT_DATA *eventDa
 }
 
 NfcTagManager::NfcTagManager()
+  : mConnectedHandle(-1)
+  , mConnectedTechIndex(-1)
+  , mIsPresent(false)
+  , mNdefCache(NDEF_CACHE_CAPACITY, NDEF_CACHE_TTL_MS)
 {
   pthread_mutex_init(&mMutex, NULL);
+
+  // Initialized once; doPresenceCheck() drains stale posts before waiting.
+  if (sem_init(&sPresenceCheckSem, 0, 0) == -1) {
+    ALOGE("%s: semaphore creation failed (errno=0x%08x)", __FUNCTION__, errno);
+  }
 }
 
 NfcTagManager::~NfcTagManager()
@@ -139,6 +174,56 @@ NdefDetail* NfcTagManager::doReadNdefDetail()
   return pNdefDetail;
 }
 
+/**
+ * How likely a protocol is to carry an NDEF message; lower is probed first.
+ */
+static int getNdefLikelihoodRank(int libNfcType)
+{
+  switch (libNfcType) {
+    case NFA_PROTOCOL_T2T:      return 0;
+    case NFA_PROTOCOL_ISO_DEP:  return 1;
+    case NFA_PROTOCOL_T3T:      return 2;
+    case NFA_PROTOCOL_T1T:      return 3;
+    case NFA_PROTOCOL_ISO15693: return 4;
+    default:                    return 5;
+  }
+}
+
+void NfcTagManager::planNdefProbe(std::vector<uint32_t>& order)
+{
+  std::vector<int> ranks;
+
+  for (uint32_t techIndex = 0; techIndex < mTechList.size(); techIndex++) {
+    int rank = getNdefLikelihoodRank(mTechLibNfcTypes[techIndex]);
+
+    // libnfc activates a handle to its highest level whatever tech is
+    // used, so probe each handle once, through its first tech.
+    uint32_t i;
+    for (i = 0; i < order.size(); i++) {
+      if (mTechHandles[order[i]] == mTechHandles[techIndex]) {
+        break;
+      }
+    }
+    if (i < order.size()) {
+      if (rank < ranks[i]) {
+        ranks[i] = rank;
+      }
+      continue;
+    }
+
+    order.push_back(techIndex);
+    ranks.push_back(rank);
+  }
+
+  // Stable insertion sort; a tag has a handful of handles at most.
+  for (uint32_t i = 1; i < order.size(); i++) {
+    for (uint32_t j = i; j > 0 && ranks[j] < ranks[j - 1]; j--) {
+      std::swap(ranks[j], ranks[j - 1]);
+      std::swap(order[j], order[j - 1]);
+    }
+  }
+}
+
 NdefMessage* NfcTagManager::doReadNdef()
 {
   NdefMessage* ndefMsg = NULL;
@@ -146,16 +231,24 @@ NdefMessage* NfcTagManager::doReadNdef()
   int formattableHandle = 0;
   int formattableLibNfcType = 0;
   int status;
+  uint64_t startUs;
 
-  for(uint32_t techIndex = 0; techIndex < mTechList.size(); techIndex++) {
-    // Have we seen this handle before?
-    for (uint32_t i = 0; i < techIndex; i++) {
-      if (mTechHandles[i] == mTechHandles[techIndex]) {
-        continue;  // Don't check duplicate handles.
-      }
-    }
+  std::vector<uint32_t> probeOrder;
+  planNdefProbe(probeOrder);
 
+  NdefProbeStats trace;
+  memset(&trace, 0, sizeof(trace));
+  // addTechnology() below grows the list.
+  uint32_t techCount = mTechList.size();
+  trace.skippedHandles = techCount - probeOrder.size();
+
+  for (uint32_t probe = 0; probe < probeOrder.size(); probe++) {
+    uint32_t techIndex = probeOrder[probe];
+
+    startUs = NfcUtil::getMonotonicTimeUs();
     status = connectWithStatus(mTechList[techIndex]);
+    trace.connects++;
+    trace.rfTimeUs += NfcUtil::getMonotonicTimeUs() - startUs;
     if (status != 0) {
       ALOGE("%s: Connect Failed - status = %d", __FUNCTION__, status);
       if (status == STATUS_CODE_TARGET_LOST) {
@@ -181,7 +274,10 @@ NdefMessage* NfcTagManager::doReadNdef()
     }
 
     int ndefinfo[2];
+    startUs = NfcUtil::getMonotonicTimeUs();
     status = doCheckNdef(ndefinfo);
+    trace.checkNdefs++;
+    trace.rfTimeUs += NfcUtil::getMonotonicTimeUs() - startUs;
     if (status != 0) {
       ALOGE("%s: Check NDEF Failed - status = %d", __FUNCTION__, status);
       if (status == STATUS_CODE_TARGET_LOST) {
@@ -197,7 +293,23 @@ NdefMessage* NfcTagManager::doReadNdef()
     int supportedNdefLength = ndefinfo[0];
     int cardState = ndefinfo[1];
     std::vector<uint8_t> buf;
-    doRead(buf);
+
+    // A read-only tag cannot have changed if NDEF detection reports the same
+    // sizes, so serve it from the cache and skip the NDEF read.
+    bool isReadOnly = cardState == NDEF_MODE_READ_ONLY;
+    const std::vector<uint8_t>* uid = techIndex < mUid.size() ? &mUid[techIndex] : NULL;
+    bool isCacheable = isReadOnly && uid && !uid->empty() && sCheckNdefCurrentSize > 0;
+    if (!isCacheable ||
+        !mNdefCache.get(*uid, sCheckNdefCurrentSize, supportedNdefLength, isReadOnly, buf)) {
+      startUs = NfcUtil::getMonotonicTimeUs();
+      doRead(buf);
+      trace.reads++;
+      trace.rfTimeUs += NfcUtil::getMonotonicTimeUs() - startUs;
+      if (isCacheable && buf.size() != 0) {
+        mNdefCache.put(*uid, sCheckNdefCurrentSize, supportedNdefLength, isReadOnly, buf);
+      }
+    }
+
     if (buf.size() != 0) {
       ndefMsg = new NdefMessage();
       if (ndefMsg->init(buf)) {
@@ -230,6 +342,14 @@ NdefMessage* NfcTagManager::doReadNdef()
     addTechnology(NDEF_FORMATABLE, formattableHandle, formattableLibNfcType);
   } 
 
+  ALOGD("%s: %u techs, %u skipped: connect=%u checkNdef=%u read=%u rf=%lluus",
+        __FUNCTION__, techCount, trace.skippedHandles, trace.connects,
+        trace.checkNdefs, trace.reads, (unsigned long long)trace.rfTimeUs);
+  NfcCounters::add(NFC_STATS_NDEF_PROBE_CONNECTS, trace.connects);
+  NfcCounters::add(NFC_STATS_NDEF_PROBE_CHECKS, trace.checkNdefs);
+  NfcCounters::add(NFC_STATS_NDEF_PROBE_READS, trace.reads);
+  NfcCounters::addTimeUs(NFC_STATS_NDEF_PROBE_RF_TIME_MS, trace.rfTimeUs);
+
   return ndefMsg;
 }
 
@@ -758,30 +878,44 @@ bool NfcTagManager::doPresenceCheck()
     return false;
   }
 
-  if (sem_init(&sPresenceCheckSem, 0, 0) == -1) {
-    ALOGE("%s: semaphore creation failed (errno=0x%08x)", __FUNCTION__, errno);
-    return false;
-  }
+  int index = getPresenceCheckStrategyIndex();
+  const PresenceCheckStrategy& strategy = sPresenceCheckStrategies[index];
 
+  // Drop posts left over from doAbortWaits().
+  while (sem_trywait(&sPresenceCheckSem) == 0);
+
+  uint64_t startUs = NfcUtil::getMonotonicTimeUs();
   status = NFA_RwPresenceCheck();
   if (status == NFA_STATUS_OK) {
     if (sem_wait(&sPresenceCheckSem)) {
       ALOGE("%s: failed to wait (errno=0x%08x)", __FUNCTION__, errno);
     } else {
-      isPresent = (sCountTagAway > 3) ? false : true;
+      isPresent = (sCountTagAway >= strategy.failureThreshold) ? false : true;
     }
   }
 
-  if (sem_destroy(&sPresenceCheckSem)) {
-    ALOGE("%s: Failed to destroy check NDEF semaphore (errno=0x%08x)", __FUNCTION__, errno);
-  }
+  // Checks and failures are counted by PresenceCheckScheduler.
+  NfcCounters::addTimeUs(NFC_STATS_PRESENCE_RF_TIME_MS,
+                         NfcUtil::getMonotonicTimeUs() - startUs);
 
   if (isPresent == false)
-    ALOGD("%s: tag absent ????", __FUNCTION__);
+    ALOGD("%s: %s tag absent after %d failures", __FUNCTION__, strategy.name, sCountTagAway);
 
   return isPresent;
 }
 
+int NfcTagManager::getPresenceCheckStrategyIndex()
+{
+  int libNfcType = getConnectedLibNfcType();
+  int i;
+  for (i = 0; i < PRESENCE_CHECK_STRATEGY_COUNT - 1; i++) {
+    if (sPresenceCheckStrategies[i].libNfcType == libNfcType) {
+      break;
+    }
+  }
+  return i;
+}
+
 int NfcTagManager::reSelect(tNFA_INTF_TYPE rfInterface)
 {
   ALOGD("%s: enter; rf intf = %d", __FUNCTION__, rfInterface);
@@ -1094,6 +1228,15 @@ bool NfcTagManager::presenceCheck()
   return result;
 }
 
+void NfcTagManager::getPresenceCheckIntervals(uint32_t& minIntervalMs, uint32_t& maxIntervalMs)
+{
+  pthread_mutex_lock(&mMutex);
+  const PresenceCheckStrategy& strategy = sPresenceCheckStrategies[getPresenceCheckStrategyIndex()];
+  minIntervalMs = strategy.minIntervalMs;
+  maxIntervalMs = strategy.maxIntervalMs;
+  pthread_mutex_unlock(&mMutex);
+}
+
 NdefMessage* NfcTagManager::readNdef()
 {
   pthread_mutex_lock(&mMutex);
@@ -1117,6 +1260,10 @@ bool NfcTagManager::writeNdef(NdefMessage& ndef)
   ndef.toByteArray(buf);
   pthread_mutex_lock(&mMutex);
   result = doWrite(buf);
+  const std::vector<uint8_t>* uid = getConnectedUid();
+  if (uid) {
+    mNdefCache.remove(*uid);
+  }
   pthread_mutex_unlock(&mMutex);
   return result;
 }
@@ -1126,6 +1273,10 @@ bool NfcTagManager::makeReadOnly()
   bool result;
   pthread_mutex_lock(&mMutex);
   result = doMakeReadonly();
+  const std::vector<uint8_t>* uid = getConnectedUid();
+  if (uid) {
+    mNdefCache.remove(*uid);
+  }
   pthread_mutex_unlock(&mMutex);
   return result;
 }
@@ -1140,6 +1291,18 @@ bool NfcTagManager::formatNdef()
   bool result;
   pthread_mutex_lock(&mMutex);
   result = doNdefFormat();
+  const std::vector<uint8_t>* uid = getConnectedUid();
+  if (uid) {
+    mNdefCache.remove(*uid);
+  }
   pthread_mutex_unlock(&mMutex);
   return result;
 }
+
+const std::vector<uint8_t>* NfcTagManager::getConnectedUid()
+{
+  if (mConnectedTechIndex < 0 || (uint32_t)mConnectedTechIndex >= mUid.size()) {
+    return NULL;
+  }
+  return &mUid[mConnectedTechIndex];
+}
@@ -9,11 +9,34 @@
 #include <vector>
 
 #include "INfcTag.h"
+#include "NdefCache.h"
 extern "C"
 {
   #include "nfa_rw_api.h"
 }
 
+/**
+ * How presence-check is done for one tag protocol.
+ */
+struct PresenceCheckStrategy {
+  int libNfcType;          // NFA_PROTOCOL_*; 0 for the fallback entry.
+  const char* name;
+  int failureThreshold;    // Consecutive failures before the tag is absent.
+  uint32_t minIntervalMs;  // Interval right after activation.
+  uint32_t maxIntervalMs;  // Interval while the tag stays in the field.
+};
+
+/**
+ * RF operations done to find the NDEF message of one tag.
+ */
+struct NdefProbeStats {
+  uint32_t connects;
+  uint32_t checkNdefs;
+  uint32_t reads;
+  uint32_t skippedHandles;  // Techs sharing a handle that was already probed.
+  uint64_t rfTimeUs;
+};
+
 class NfcTagManager
   : public INfcTag
 {
@@ -31,6 +54,7 @@ public:
   bool presenceCheck();
   bool makeReadOnly();
   bool formatNdef();
+  void getPresenceCheckIntervals(uint32_t& minIntervalMs, uint32_t& maxIntervalMs);
 
   std::vector<TagTechnology>& getTechList() { return mTechList; };
   std::vector<int>& getTechHandles() { return mTechHandles; };
@@ -155,11 +179,12 @@ public:
   static void doDeregisterNdefTypeHandler();
 
   /**
-   * Check if the tag is in the RF field.
+   * Check if the tag is in the RF field, using the strategy of the
+   * connected protocol.
    *
-   * @return None.
+   * @return True if tag is in RF field.
    */
-  static bool doPresenceCheck();
+  bool doPresenceCheck();
 
   /**
    * Deactivate the RF field.
@@ -234,6 +259,32 @@ private:
 
   bool mIsPresent; // Whether the tag is known to be still present.
 
+  // NDEF messages of read-only tags seen recently, protected by mMutex.
+  NdefCache mNdefCache;
+
+  /**
+   * Get the presence-check strategy of the connected protocol.
+   *
+   * @return Index of the strategy.
+   */
+  int getPresenceCheckStrategyIndex();
+
+  /**
+   * Decide in which order doReadNdef() probes the techs: one tech per
+   * handle, handles most likely to hold NDEF first.
+   *
+   * @param  order Filled with indexes into mTechList.
+   * @return       None.
+   */
+  void planNdefProbe(std::vector<uint32_t>& order);
+
+  /**
+   * Get the UID of the tag the upper layer is connected to.
+   *
+   * @return UID, or NULL if unknown.
+   */
+  const std::vector<uint8_t>* getConnectedUid();
+
   /**
    * Deactivates the tag and re-selects it with the specified
    * rf interface.
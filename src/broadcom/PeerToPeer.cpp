@@ -9,6 +9,8 @@
 
 #include "NfcManager.h"
 #include "NfcUtil.h"
+#include "NfcTrace.h"
+#include "NfcCounters.h"
 #include "llcp_defs.h"
 #include "config.h"
 #include "IP2pDevice.h"
@@ -31,6 +33,25 @@ using namespace android;
 #define LLCP_DATA_LINK_TIMEOUT    2000
 
 PeerToPeer PeerToPeer::sP2p;
+
+/**
+ * Wait on an event whose guard is held, up to the deadline if timeoutMs > 0.
+ *
+ * @return False if the deadline passed.
+ */
+static bool waitUntil(SyncEvent& event, long timeoutMs, uint64_t deadlineMs)
+{
+  if (timeoutMs <= 0) {
+    event.wait();
+    return true;
+  }
+
+  uint64_t now = NfcUtil::getMonotonicTimeUs() / 1000;
+  if (now >= deadlineMs) {
+    return false;
+  }
+  return event.wait((long)(deadlineMs - now));
+}
 const std::string P2pServer::sSnepServiceName("urn:nfc:sn:snep");
 
 PeerToPeer::PeerToPeer()
@@ -45,10 +66,12 @@ PeerToPeer::PeerToPeer()
 {
   memset(mServers, 0, sizeof(mServers));
   memset(mClients, 0, sizeof(mClients));
+  pthread_rwlock_init(&mConnLock, NULL);
 }
 
 PeerToPeer::~PeerToPeer()
 {
+  pthread_rwlock_destroy(&mConnLock);
 }
 
 PeerToPeer& PeerToPeer::getInstance()
@@ -291,6 +314,10 @@ bool PeerToPeer::createClient(unsigned int handle, UINT16 miu, UINT8 rw)
   }
   mMutex.unlock();
 
+  if (client != NULL) {
+    addConnection(client->mClientConn);
+  }
+
   if (client == NULL) {
     ALOGE("%s: fail", fn);
     return false;
@@ -318,6 +345,8 @@ void PeerToPeer::removeConn(unsigned int handle)
 {
   static const char fn[] = "PeerToPeer::removeConn";
 
+  removeConnection(handle);
+
   AutoMutex mutex(mMutex);
   // If the connection is a for a client, delete the client itself.
   for (int ii = 0; ii < sMax; ii++) {
@@ -439,55 +468,76 @@ sp<P2pClient> PeerToPeer::findClientCon(tNFA_HANDLE nfaConnHandle)
 
 sp<NfaConn> PeerToPeer::findConnection(tNFA_HANDLE nfaConnHandle)
 {
-  AutoMutex mutex(mMutex);
-  // First, look through all the client control blocks.
-  for (int ii = 0; ii < sMax; ii++) {
-    if ((mClients[ii] != NULL)
-      &&(mClients[ii]->mClientConn->mNfaConnHandle == nfaConnHandle) ) {
-      return mClients[ii]->mClientConn;
-    }
-  }
+  sp<NfaConn> conn = NULL;
 
-  // Not found yet. Look through all the server control blocks.
-  for (int ii = 0; ii < sMax; ii++) {
-    if (mServers[ii] != NULL) {
-      sp<NfaConn> conn = mServers[ii]->findServerConnection(nfaConnHandle);
-      if (conn != NULL) {
-        return conn;
-      }
-    }
+  pthread_rwlock_rdlock(&mConnLock);
+  ConnMap::iterator it = mConnByNfaHandle.find(nfaConnHandle);
+  if (it != mConnByNfaHandle.end()) {
+    conn = it->second;
   }
+  pthread_rwlock_unlock(&mConnLock);
 
-  // Not found...
-  return NULL;
+  return conn;
 }
 
 sp<NfaConn> PeerToPeer::findConnection(unsigned int handle)
 {
-  AutoMutex mutex(mMutex);
-  // First, look through all the client control blocks.
-  for (int ii = 0; ii < sMax; ii++) {
-    if ((mClients[ii] != NULL)
-      && (mClients[ii]->mClientConn->mHandle == handle) ) {
-      return mClients[ii]->mClientConn;
-    }
+  sp<NfaConn> conn = NULL;
+
+  pthread_rwlock_rdlock(&mConnLock);
+  ConnMap::iterator it = mConnByHandle.find(handle);
+  if (it != mConnByHandle.end()) {
+    conn = it->second;
   }
+  pthread_rwlock_unlock(&mConnLock);
 
-  // Not found yet. Look through all the server control blocks.
-  for (int ii = 0; ii < sMax; ii++) {
-    if (mServers[ii] != NULL) {
-      sp<NfaConn> conn = mServers[ii]->findServerConnection(handle);
-      if (conn != NULL) {
-        return conn;
-      }
+  return conn;
+}
+
+void PeerToPeer::addConnection(const sp<NfaConn>& conn)
+{
+  pthread_rwlock_wrlock(&mConnLock);
+  mConnByHandle[conn->mHandle] = conn;
+  if (conn->mNfaConnHandle != NFA_HANDLE_INVALID) {
+    mConnByNfaHandle[conn->mNfaConnHandle] = conn;
+  }
+  pthread_rwlock_unlock(&mConnLock);
+}
+
+void PeerToPeer::setNfaConnHandle(const sp<NfaConn>& conn, tNFA_HANDLE nfaConnHandle)
+{
+  pthread_rwlock_wrlock(&mConnLock);
+  if (conn->mNfaConnHandle != NFA_HANDLE_INVALID) {
+    // NFA reuses handles, only drop the entry if it is still ours.
+    ConnMap::iterator it = mConnByNfaHandle.find(conn->mNfaConnHandle);
+    if (it != mConnByNfaHandle.end() && it->second == conn) {
+      mConnByNfaHandle.erase(it);
     }
   }
+  conn->mNfaConnHandle = nfaConnHandle;
+  if (nfaConnHandle != NFA_HANDLE_INVALID) {
+    mConnByNfaHandle[nfaConnHandle] = conn;
+  }
+  pthread_rwlock_unlock(&mConnLock);
+}
 
-  // Not found...
-  return NULL;
+void PeerToPeer::removeConnection(unsigned int handle)
+{
+  pthread_rwlock_wrlock(&mConnLock);
+  ConnMap::iterator it = mConnByHandle.find(handle);
+  if (it != mConnByHandle.end()) {
+    sp<NfaConn> conn = it->second;
+    mConnByHandle.erase(it);
+
+    ConnMap::iterator nfaIt = mConnByNfaHandle.find(conn->mNfaConnHandle);
+    if (nfaIt != mConnByNfaHandle.end() && nfaIt->second == conn) {
+      mConnByNfaHandle.erase(nfaIt);
+    }
+  }
+  pthread_rwlock_unlock(&mConnLock);
 }
 
-bool PeerToPeer::send(unsigned int handle, UINT8 *buffer, UINT16 bufferLen)
+bool PeerToPeer::send(unsigned int handle, UINT8 *buffer, UINT16 bufferLen, long timeoutMs)
 {
   static const char fn [] = "PeerToPeer::send";
   tNFA_STATUS nfaStat = NFA_STATUS_FAILED;
@@ -501,14 +551,26 @@ bool PeerToPeer::send(unsigned int handle, UINT8 *buffer, UINT16 bufferLen)
   ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: send data; handle: %u  nfaHandle: 0x%04X",
           fn, pConn->mHandle, pConn->mNfaConnHandle);
 
+  uint64_t deadlineMs = NfcUtil::getMonotonicTimeUs() / 1000 + timeoutMs;
   while (true) {
     SyncEventGuard guard(pConn->mCongEvent);
+    if (pConn->mIsCancelled) {
+      ALOGD("%s: cancelled; handle: %u", fn, handle);
+      return false;
+    }
+
     nfaStat = NFA_P2pSendData(pConn->mNfaConnHandle, bufferLen, buffer);
-    if (nfaStat == NFA_STATUS_CONGESTED)
-      pConn->mCongEvent.wait(); // Wait for NFA_P2P_CONGEST_EVT.
-    else
+    if (nfaStat != NFA_STATUS_CONGESTED)
       break;
 
+    // Wait for NFA_P2P_CONGEST_EVT.
+    NfcCounters::increment(NFC_STATS_LLCP_CONGESTION_WAITS);
+    if (!waitUntil(pConn->mCongEvent, timeoutMs, deadlineMs)) {
+      ALOGE("%s: still congested after %ld ms; handle: %u", fn, timeoutMs, handle);
+      NfcCounters::increment(NFC_STATS_LLCP_TIMEOUTS);
+      return false;
+    }
+
     if (pConn->mNfaConnHandle == NFA_HANDLE_INVALID) { // Peer already disconnected.
       ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: peer disconnected", fn);
       return false;
@@ -524,7 +586,7 @@ bool PeerToPeer::send(unsigned int handle, UINT8 *buffer, UINT16 bufferLen)
   return nfaStat == NFA_STATUS_OK;
 }
 
-bool PeerToPeer::receive(unsigned int handle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen)
+bool PeerToPeer::receive(unsigned int handle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen, long timeoutMs)
 {
   static const char fn [] = "PeerToPeer::receive";
   ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: enter; handle: %u  bufferLen: %u", fn, handle, bufferLen);
@@ -541,7 +603,8 @@ bool PeerToPeer::receive(unsigned int handle, UINT8* buffer, UINT16 bufferLen, U
 
   ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: handle: %u  nfaHandle: 0x%04X  buf len=%u", fn, pConn->mHandle, pConn->mNfaConnHandle, bufferLen);
 
-  while (pConn->mNfaConnHandle != NFA_HANDLE_INVALID) {
+  uint64_t deadlineMs = NfcUtil::getMonotonicTimeUs() / 1000 + timeoutMs;
+  while (pConn->mNfaConnHandle != NFA_HANDLE_INVALID && !pConn->mIsCancelled) {
     // NFA_P2pReadData() is synchronous.
     stat = NFA_P2pReadData(pConn->mNfaConnHandle, bufferLen, &actualDataLen2, buffer, &isMoreData);
     if ((stat == NFA_STATUS_OK) && (actualDataLen2 > 0)) { // Received some data.
@@ -552,7 +615,15 @@ bool PeerToPeer::receive(unsigned int handle, UINT8* buffer, UINT16 bufferLen, U
     ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: waiting for data...", fn);
     {
       SyncEventGuard guard(pConn->mReadEvent);
-      pConn->mReadEvent.wait();
+      // Checked under the guard so a cancel() cannot slip in before the wait.
+      if (pConn->mIsCancelled) {
+        break;
+      }
+      if (!waitUntil(pConn->mReadEvent, timeoutMs, deadlineMs)) {
+        ALOGE("%s: no data after %ld ms; handle: %u", fn, timeoutMs, handle);
+        NfcCounters::increment(NFC_STATS_LLCP_TIMEOUTS);
+        break;
+      }
     }
   } // while.
 
@@ -609,6 +680,29 @@ bool PeerToPeer::disconnectConnOriented(unsigned int handle)
   return nfaStat == NFA_STATUS_OK;
 }
 
+bool PeerToPeer::cancel(unsigned int handle)
+{
+  static const char fn [] = "PeerToPeer::cancel";
+  sp<NfaConn> pConn = NULL;
+
+  if ((pConn = findConnection(handle)) == NULL) {
+    ALOGE("%s: can't find connection handle: %u", fn, handle);
+    return false;
+  }
+
+  // Set before notifying; waiters check it under the event guards.
+  pConn->mIsCancelled = true;
+  {
+    SyncEventGuard guard1(pConn->mCongEvent);
+    pConn->mCongEvent.notifyOne(); // Unblock send() if congested.
+  }
+  {
+    SyncEventGuard guard2(pConn->mReadEvent);
+    pConn->mReadEvent.notifyOne(); // Unblock receive().
+  }
+  return true;
+}
+
 UINT16 PeerToPeer::getRemoteMaxInfoUnit(unsigned int handle)
 {
   static const char fn [] = "PeerToPeer::getRemoteMaxInfoUnit";
@@ -681,6 +775,11 @@ void PeerToPeer::handleNfcOnOff(bool isOn)
     // Start with no clients or servers.
     memset(mServers, 0, sizeof(mServers));
     memset(mClients, 0, sizeof(mClients));
+
+    pthread_rwlock_wrlock(&mConnLock);
+    mConnByHandle.clear();
+    mConnByNfaHandle.clear();
+    pthread_rwlock_unlock(&mConnLock);
   } else {
     // Disconnect through all the clients.
     for (int ii = 0; ii < sMax; ii++) {
@@ -689,7 +788,7 @@ void PeerToPeer::handleNfcOnOff(bool isOn)
           SyncEventGuard guard(mClients[ii]->mConnectingEvent);
           mClients[ii]->mConnectingEvent.notifyOne();
         } else {
-          mClients[ii]->mClientConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+          setNfaConnHandle(mClients[ii]->mClientConn, NFA_HANDLE_INVALID);
           {
             SyncEventGuard guard1(mClients[ii]->mClientConn->mCongEvent);
             mClients[ii]->mClientConn->mCongEvent.notifyOne(); // Unblock send().
@@ -720,6 +819,7 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* eve
   sp<NfaConn>     pConn = NULL;
 
   ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: enter; event=0x%X", fn, p2pEvent);
+  NFC_TRACE_EVENT(NFC_TRACE_NFA_P2P_EVT, NFC_TRACE_INSTANT, p2pEvent, 1);
 
   switch (p2pEvent) {
     case NFA_P2P_REG_SERVER_EVT:  // NFA_P2pRegisterServer() has started to listen.
@@ -764,7 +864,7 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* eve
         ALOGE("%s: NFA_P2P_CONN_REQ_EVT; server not listening", fn);
       } else {
         SyncEventGuard guard(pSrv->mConnRequestEvent);
-        pConn->mNfaConnHandle = eventData->conn_req.conn_handle;
+        sP2p.setNfaConnHandle(pConn, eventData->conn_req.conn_handle);
         pConn->mRemoteMaxInfoUnit = eventData->conn_req.remote_miu;
         pConn->mRemoteRecvWindow = eventData->conn_req.remote_rw;
         ALOGD("%s: NFA_P2P_CONN_REQ_EVT; server h=%u; conn h=%u; notify conn req", fn, pSrv->mHandle, pConn->mHandle);
@@ -784,7 +884,7 @@ void PeerToPeer::nfaServerCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* eve
         ALOGE("%s: NFA_P2P_DISC_EVT: can't find conn for NFA handle: 0x%04x", fn, eventData->disc.handle);
       } else {
         sP2p.mDisconnectMutex.lock();
-        pConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+        sP2p.setNfaConnHandle(pConn, NFA_HANDLE_INVALID);
         {
           ALOGD("%s: NFA_P2P_DISC_EVT; try guard disconn event", fn);
           SyncEventGuard guard3(pConn->mDisconnectingEvent);
@@ -847,6 +947,7 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* eve
   sp<P2pClient>   pClient = NULL;
 
   ALOGD_IF((appl_trace_level>=BT_TRACE_LEVEL_DEBUG), "%s: enter; event=%u", fn, p2pEvent);
+  NFC_TRACE_EVENT(NFC_TRACE_NFA_P2P_EVT, NFC_TRACE_INSTANT, p2pEvent, 0);
 
   switch (p2pEvent) {
     case NFA_P2P_REG_CLIENT_EVT:
@@ -884,7 +985,7 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* eve
         eventData->connected.client_handle, eventData->connected.conn_handle, eventData->connected.remote_sap, pClient.get());
 
         SyncEventGuard guard(pClient->mConnectingEvent);
-        pClient->mClientConn->mNfaConnHandle     = eventData->connected.conn_handle;
+        sP2p.setNfaConnHandle(pClient->mClientConn, eventData->connected.conn_handle);
         pClient->mClientConn->mRemoteMaxInfoUnit = eventData->connected.remote_miu;
         pClient->mClientConn->mRemoteRecvWindow  = eventData->connected.remote_rw;
         pClient->mConnectingEvent.notifyOne(); // Unblock createDataLinkConn().
@@ -905,7 +1006,7 @@ void PeerToPeer::nfaClientCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA* eve
         pClient->mConnectingEvent.notifyOne();
       } else {
         sP2p.mDisconnectMutex.lock();
-        pConn->mNfaConnHandle = NFA_HANDLE_INVALID;
+        sP2p.setNfaConnHandle(pConn, NFA_HANDLE_INVALID);
         {
           ALOGD("%s: NFA_P2P_DISC_EVT; try guard disconn event", fn);
           SyncEventGuard guard3(pConn->mDisconnectingEvent);
@@ -1050,6 +1151,7 @@ bool P2pServer::accept(unsigned int serverHandle, unsigned int connHandle,
     ALOGE("%s: failed to allocate new server connection", fn);
     return false;
   }
+  PeerToPeer::getInstance().addConnection(connection);
 
   {
     // Wait for NFA_P2P_CONN_REQ_EVT or NFA_NDEF_DATA_EVT when remote device requests connection.
@@ -1062,6 +1164,7 @@ bool P2pServer::accept(unsigned int serverHandle, unsigned int connHandle,
   }
 
   if (connection->mNfaConnHandle == NFA_HANDLE_INVALID) {
+    PeerToPeer::getInstance().removeConnection(connHandle);
     removeServerConnection(connHandle);
     ALOGD("%s: no handle assigned", fn);
     return false;
@@ -1086,7 +1189,7 @@ void P2pServer::unblockAll()
   AutoMutex mutex(mMutex);
   for (int jj = 0; jj < MAX_NFA_CONNS_PER_SERVER; jj++) {
     if (mServerConn[jj] != NULL) {
-      mServerConn[jj]->mNfaConnHandle = NFA_HANDLE_INVALID;
+      PeerToPeer::getInstance().setNfaConnHandle(mServerConn[jj], NFA_HANDLE_INVALID);
       {
         SyncEventGuard guard1(mServerConn[jj]->mCongEvent);
         mServerConn[jj]->mCongEvent.notifyOne(); // Unblock write (if congested).
@@ -1176,5 +1279,6 @@ NfaConn::NfaConn()
  , mRecvWindow(0)
  , mRemoteMaxInfoUnit(0)
  , mRemoteRecvWindow(0)
+ , mIsCancelled(false)
 {
 }
@@ -6,6 +6,8 @@
 
 #include <utils/RefBase.h>
 #include <utils/StrongPointer.h>
+#include <pthread.h>
+#include <map>
 #include <string>
 
 #include "SyncEvent.h"
@@ -134,9 +136,10 @@ public:
    * @param  handle    Handle of connection.
    * @param  buffer    Buffer of data.
    * @param  bufferLen Length of data.
+   * @param  timeoutMs How long to wait while the link is congested; 0 waits forever.
    * @return           True if ok.
    */
-  bool send(unsigned int handle, UINT8* buffer, UINT16 bufferLen);
+  bool send(unsigned int handle, UINT8* buffer, UINT16 bufferLen, long timeoutMs);
 
   /**
    * Receive data from peer.
@@ -145,9 +148,19 @@ public:
    * @param  buffer    Buffer to store data.
    * @param  bufferLen Max length of buffer.
    * @param  actualLen Actual length received. 
+   * @param  timeoutMs How long to wait for data; 0 waits forever.
    * @return           True if ok.
    */
-  bool receive(unsigned int handle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen);
+  bool receive(unsigned int handle, UINT8* buffer, UINT16 bufferLen, UINT16& actualLen, long timeoutMs);
+
+  /**
+   * Unblock send() and receive() on a connection and make later calls fail.
+   * The connection stays up until disconnectConnOriented().
+   *
+   * @param  handle Handle of connection.
+   * @return        True if ok.
+   */
+  bool cancel(unsigned int handle);
 
   /**
    * Disconnect a connection-oriented connection with peer.
@@ -222,6 +235,31 @@ public:
    */
   static void nfaClientCallback(tNFA_P2P_EVT p2pEvent, tNFA_P2P_EVT_DATA *eventData);
 
+  /**
+   * Make a connection findable by its handle.
+   *
+   * @param  conn Connection.
+   * @return      None.
+   */
+  void addConnection(const android::sp<NfaConn>& conn);
+
+  /**
+   * Update the NFA handle of a connection and the index on it.
+   *
+   * @param  conn          Connection.
+   * @param  nfaConnHandle New NFA handle; NFA_HANDLE_INVALID once disconnected.
+   * @return               None.
+   */
+  void setNfaConnHandle(const android::sp<NfaConn>& conn, tNFA_HANDLE nfaConnHandle);
+
+  /**
+   * Remove a connection from the index.
+   *
+   * @param  handle Handle of the connection.
+   * @return        None.
+   */
+  void removeConnection(unsigned int handle);
+
 private:
   static const int  sMax = 10;
   static PeerToPeer sP2p;
@@ -241,6 +279,14 @@ private:
   android::sp<P2pServer>   mServers [sMax];
   android::sp<P2pClient>   mClients [sMax];
 
+  // Index of all client and server connections, by our handle and by NFA
+  // handle. Lookups on the data path only take mConnLock for reading. It
+  // is the innermost lock; nothing else is locked while holding it.
+  typedef std::map<unsigned int, android::sp<NfaConn> > ConnMap;
+  pthread_rwlock_t         mConnLock;
+  ConnMap                  mConnByHandle;
+  ConnMap                  mConnByNfaHandle;
+
   // Synchronization variables.
   // Completion event for NFA_SetP2pListenTech().
   SyncEvent       mSetTechEvent;
@@ -285,6 +331,7 @@ public:
   SyncEvent           mReadEvent;          // Event for reading.
   SyncEvent           mCongEvent;          // Event for congestion.
   SyncEvent           mDisconnectingEvent; // Event for disconnecting.
+  volatile bool       mIsCancelled;        // Set by PeerToPeer::cancel().
 
   NfaConn();
 };
@@ -9,6 +9,9 @@
 #include "HandoverServer.h"
 #include "ILlcpSocket.h"
 #include "NdefMessage.h"
+#include "NdefParser.h"
+#include "NdefStreamDecoder.h"
+#include "NfcCounters.h"
 #include "NfcDebug.h"
 
 HandoverClient::HandoverClient()
@@ -52,6 +55,7 @@ bool HandoverClient::connect()
     return false;
   }
 
+  mSocket->setTimeout(DEFAULT_TIMEOUT_MS);
   mState = HandoverClient::CONNECTED;
 
   ALOGD("%s: exit", FUNC);
@@ -63,6 +67,7 @@ NdefMessage* HandoverClient::processHandoverRequest(NdefMessage& msg)
   NdefMessage* ndef = NULL;
   // Send handover request message.
   if (put(msg)) {
+    NfcCounters::increment(NFC_STATS_HANDOVER_REQUESTS);
     // Get handover select message sent from remote.
     ndef = receive();
   }
@@ -72,23 +77,29 @@ NdefMessage* HandoverClient::processHandoverRequest(NdefMessage& msg)
 
 NdefMessage* HandoverClient::receive()
 {
-  std::vector<uint8_t> buffer;
+  NdefStreamDecoder decoder(NdefParser::MAX_PAYLOAD_SIZE);
+  // Reused for every I-PDU; the peer never sends more than our MIU.
+  int miu = mSocket->getLocalMiu();
+  if (miu < DEFAULT_MIU) {
+    miu = DEFAULT_MIU;
+  }
+  std::vector<uint8_t> partial(miu);
   while(true) {
-    std::vector<uint8_t> partial;
-    int size = mSocket->receive(partial);
+    int size = mSocket->receive(&partial[0], partial.size());
     if (size < 0) {
       ALOGE("%s: connection broken", FUNC);
       break;
-    } else {
-      buffer.insert(buffer.end(), partial.begin(), partial.end());
+    } else if (size == 0) {
+      continue;
     }
 
-    NdefMessage* ndef = new NdefMessage();
-    if(ndef->init(buffer)) {
+    NdefStreamDecoder::Status status = decoder.append(&partial[0], size);
+    if (status == NdefStreamDecoder::COMPLETE) {
       ALOGD("%s: get a complete NDEF message", FUNC);
-      return ndef;
-    } else {
-      delete ndef;
+      return decoder.takeMessage();
+    } else if (status == NdefStreamDecoder::ERROR) {
+      ALOGE("%s: invalid NDEF data", FUNC);
+      break;
     }
   }
   return NULL;
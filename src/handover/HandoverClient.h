@@ -23,6 +23,9 @@ public:
 private:
   static const int DEFAULT_MIU = 128;
 
+  // How long the peer may stay silent before a put or receive fails.
+  static const int DEFAULT_TIMEOUT_MS = 5000;
+
   static const int DISCONNECTED = 0;
   static const int CONNECTING = 1;
   static const int CONNECTED = 2;
@@ -1,87 +1,100 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdlib.h>
+#include <vector>
 
 #include "NfcService.h"
 #include "NfcManager.h"
 #include "HandoverServer.h"
 #include "IHandoverCallback.h"
 #include "NdefMessage.h"
+#include "NdefParser.h"
+#include "NdefStreamDecoder.h"
+#include "NfcCounters.h"
 #include "NfcDebug.h"
 
 // Registered LLCP Service Names.
 const char* HandoverServer::DEFAULT_SERVICE_NAME = "urn:nfc:sn:handover";
 
+HandoverConnectionThread::HandoverConnectionThread(
+  HandoverServer* server, ILlcpSocket* socket, IHandoverCallback* ICallback)
+ : mSock(socket)
+ , mCallback(ICallback)
+ , mServer(server)
+{
+  // put() runs on the NfcService thread, which must not block forever on a
+  // congested link.
+  mSock->setTimeout(HandoverServer::DEFAULT_TIMEOUT_MS);
+}
+
+HandoverConnectionThread::~HandoverConnectionThread()
+{
+  delete mSock;
+}
+
 // Handover conncetion thread is responsible for sending/receiving NDEF message.
-void* HandoverConnectionThreadFunc(void* arg)
+// It runs on a worker thread.
+void HandoverConnectionThread::run()
 {
   ALOGD("%s: connection thread enter", FUNC);
 
-  HandoverConnectionThread* pConnectionThread = reinterpret_cast<HandoverConnectionThread*>(arg);
-  if (!pConnectionThread) {
-    ALOGE("%s: invalid parameter", FUNC);
-    return NULL;
-  }
-
-  IHandoverCallback* ICallback = pConnectionThread->getCallback();
-  ILlcpSocket* socket = pConnectionThread->getSocket();
   bool connectionBroken = false;
-  std::vector<uint8_t> buffer;
+  NdefStreamDecoder decoder(NdefParser::MAX_PAYLOAD_SIZE);
+  // Reused for every I-PDU; the peer never sends more than our MIU.
+  int miu = mSock->getLocalMiu();
+  if (miu < HandoverServer::DEFAULT_MIU) {
+    miu = HandoverServer::DEFAULT_MIU;
+  }
+  std::vector<uint8_t> partial(miu);
   while(!connectionBroken) {
-    std::vector<uint8_t> partial;
-    int size = socket->receive(partial);
+    // Between messages the peer may stay silent for the idle timeout, then
+    // the connection is closed to free its worker. A put() meanwhile is
+    // bounded by the idle timeout too.
+    mSock->setTimeout(decoder.getBufferedLength() ? HandoverServer::DEFAULT_TIMEOUT_MS
+                                                  : NfcWorkerPool::IDLE_TIMEOUT_MS);
+    int size = mSock->receive(&partial[0], partial.size());
     if (size < 0) {
-      ALOGE("%s: connection broken", FUNC);
+      ALOGE("%s: connection broken or idle", FUNC);
       connectionBroken = true;
       break;
-    } else {
-      buffer.insert(buffer.end(), partial.begin(), partial.end());
+    } else if (size == 0) {
+      continue;
     }
 
-    // Check if buffer can be create a NDEF message.
-    // If yes. need to notify upper layer.
-    NdefMessage* ndef = new NdefMessage();
-    if(ndef->init(buffer)) {
-      ALOGD("%s: get a complete NDEF message", FUNC);
-      ICallback->onMessageReceived(ndef);
-    } else {
-      ALOGD("%s: cannot get a complete NDEF message", FUNC);
+    // Only the new bytes are scanned; the message is parsed once complete.
+    if (decoder.append(&partial[0], size) == NdefStreamDecoder::ERROR) {
+      ALOGE("%s: invalid NDEF data, dropping buffered bytes", FUNC);
+      decoder.reset();
+      continue;
     }
-  }
-
-  if (socket)
-    socket->close();
 
-  HandoverServer* server = pConnectionThread->getServer();
-  if (server)
-    server->setConnectionThread(NULL);
+    while (decoder.getStatus() == NdefStreamDecoder::COMPLETE) {
+      NdefMessage* ndef = decoder.takeMessage();
+      if (ndef) {
+        ALOGD("%s: get a complete NDEF message", FUNC);
+        mCallback->onMessageReceived(ndef);
+        delete ndef;
+        NfcCounters::increment(NFC_STATS_HANDOVER_REQUESTS_SERVED);
+      }
+    }
 
-  // TODO : is this correct ??
-  delete pConnectionThread;
+    // Rescanning the bytes left over by takeMessage() may have hit invalid
+    // data. ERROR is sticky, so clear it before the next fragment arrives.
+    if (decoder.getStatus() == NdefStreamDecoder::ERROR) {
+      ALOGE("%s: invalid NDEF data, dropping buffered bytes", FUNC);
+      decoder.reset();
+    } else if (decoder.getStatus() == NdefStreamDecoder::NEED_MORE) {
+      ALOGD("%s: need at least %u more bytes", FUNC, decoder.getNeededLength());
+    }
+  }
 
-  ALOGD("%s: connection thread exit", FUNC);
-  return NULL;
-}
+  mSock->close();
 
-HandoverConnectionThread::HandoverConnectionThread(
-  HandoverServer* server, ILlcpSocket* socket, IHandoverCallback* ICallback)
- : mSock(socket)
- , mCallback(ICallback)
- , mServer(server)
-{
-}
+  // After this the server no longer refers to the connection; the pool
+  // deletes it.
+  mServer->removeConnectionThread(this);
 
-HandoverConnectionThread::~HandoverConnectionThread()
-{
-}
-
-void HandoverConnectionThread::run()
-{
-  pthread_t tid;
-  if(pthread_create(&tid, NULL, HandoverConnectionThreadFunc, this) != 0) {
-    ALOGE("connection pthread_create failed");
-    abort();
-  }
+  ALOGD("%s: connection thread exit", FUNC);
 }
 
 bool HandoverConnectionThread::isServerRunning() const
@@ -117,8 +130,10 @@ void* handoverServerThreadFunc(void* arg)
     if (communicationSocket != NULL) {
       HandoverConnectionThread* pConnectionThread =
           new HandoverConnectionThread(pHandoverServer, communicationSocket, ICallback);
-      pHandoverServer->setConnectionThread(pConnectionThread);
-      pConnectionThread->run();
+      if (!pHandoverServer->addConnectionThread(pConnectionThread)) {
+        communicationSocket->close();
+        delete pConnectionThread;
+      }
     }
   }
 
@@ -131,12 +146,19 @@ HandoverServer::HandoverServer(IHandoverCallback* ICallback)
  , mServiceSap(HANDOVER_SAP)
  , mCallback(ICallback)
  , mServerRunning(false)
+ , mThreadStarted(false)
  , mConnectionThread(NULL)
+ , mPutConnection(NULL)
 {
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
 }
 
 HandoverServer::~HandoverServer()
 {
+  stop();
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mMutex);
 }
 
 void HandoverServer::start()
@@ -150,51 +172,122 @@ void HandoverServer::start()
     ALOGE("%s: cannot create llcp server socket", FUNC);
   }
 
-  pthread_t tid;
-  if(pthread_create(&tid, NULL, handoverServerThreadFunc, this) != 0)
+  // Set before the thread starts, or it may see the server stopped.
+  mServerRunning = true;
+  if(pthread_create(&mThread, NULL, handoverServerThreadFunc, this) != 0)
   {
     ALOGE("%s: pthread_create failed", FUNC);
     abort();
   }
-  mServerRunning = true;
+  mThreadStarted = true;
 
   ALOGD("%s: exit", FUNC);
 }
 
 void HandoverServer::stop()
 {
-  // TODO : need to kill thread here
+  mServerRunning = false;
+
+  // Closing the server socket makes a pending accept() fail.
   if (mServerSocket) {
     mServerSocket->close();
-    delete mServerSocket;
-    mServerSocket = NULL;
   }
-  mServerRunning = false;
+  if (mThreadStarted) {
+    pthread_join(mThread, NULL);
+    mThreadStarted = false;
+  }
+  delete mServerSocket;
+  mServerSocket = NULL;
+
+  // Connections still waiting for a worker are taken back from the pool, as
+  // SnepServer::stop() does. Cancelling the sockets of the running ones ends
+  // their receive loops, which then close the sockets.
+  std::vector<HandoverConnectionThread*> queued;
+  pthread_mutex_lock(&mMutex);
+  std::set<HandoverConnectionThread*>::iterator it;
+  for (it = mConnections.begin(); it != mConnections.end(); it++) {
+    if (NfcWorkerPool::Instance()->cancel(*it)) {
+      queued.push_back(*it);
+    } else {
+      (*it)->getSocket()->cancel();
+    }
+  }
+  for (size_t i = 0; i < queued.size(); i++) {
+    mConnections.erase(queued[i]);
+    if (mConnectionThread == queued[i]) {
+      mConnectionThread = NULL;
+    }
+  }
+  while (!mConnections.empty()) {
+    pthread_cond_wait(&mCond, &mMutex);
+  }
+  pthread_mutex_unlock(&mMutex);
 
-  // use pthread_join here to make sure all thread is finished ?
+  for (size_t i = 0; i < queued.size(); i++) {
+    queued[i]->getSocket()->close();
+    delete queued[i];
+  }
 }
 
 bool HandoverServer::put(NdefMessage& msg)
 {
   ALOGD("%s: enter", FUNC);
 
-  if (!mConnectionThread || !mConnectionThread->getSocket()) {
+  std::vector<uint8_t> buf;
+  msg.toByteArray(buf);
+
+  // The send may block until the link is no longer congested, so it runs
+  // without the lock; mPutConnection keeps the connection from being deleted
+  // meanwhile.
+  pthread_mutex_lock(&mMutex);
+  HandoverConnectionThread* connection = mConnectionThread;
+  if (!connection || !connection->getSocket()) {
+    pthread_mutex_unlock(&mMutex);
     ALOGE("%s: connection is not established", FUNC);
     return false;
   }
+  mPutConnection = connection;
+  pthread_mutex_unlock(&mMutex);
 
-  std::vector<uint8_t> buf;
-  msg.toByteArray(buf);
-  mConnectionThread->getSocket()->send(buf);
+  bool sent = connection->getSocket()->send(buf);
+
+  pthread_mutex_lock(&mMutex);
+  mPutConnection = NULL;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
 
   ALOGD("%s: exit", FUNC);
-  return true;
+  return sent;
 }
 
-void HandoverServer::setConnectionThread(HandoverConnectionThread* pThread)
+bool HandoverServer::addConnectionThread(HandoverConnectionThread* pThread)
 {
-  if (pThread != NULL && mConnectionThread != NULL) {
+  pthread_mutex_lock(&mMutex);
+  if (mConnectionThread != NULL) {
     ALOGE("%s: there is more than one connection, should not happen!", FUNC);
   }
+  mConnections.insert(pThread);
   mConnectionThread = pThread;
+  pthread_mutex_unlock(&mMutex);
+
+  if (!NfcWorkerPool::Instance()->submit(pThread)) {
+    removeConnectionThread(pThread);
+    return false;
+  }
+  return true;
+}
+
+void HandoverServer::removeConnectionThread(HandoverConnectionThread* pThread)
+{
+  pthread_mutex_lock(&mMutex);
+  mConnections.erase(pThread);
+  if (mConnectionThread == pThread) {
+    mConnectionThread = NULL;
+  }
+  // The connection is deleted once this returns.
+  while (mPutConnection == pThread) {
+    pthread_cond_wait(&mCond, &mMutex);
+  }
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
 }
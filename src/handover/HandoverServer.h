@@ -5,7 +5,14 @@
 #ifndef mozilla_nfcd_HandoverPushServer_h
 #define mozilla_nfcd_HandoverPushServer_h
 
+#include <pthread.h>
+#include <set>
+
+#include "NfcWorkerPool.h"
+
 class IHandoverCallback;
+class ILlcpServerSocket;
+class ILlcpSocket;
 class NdefMessage;
 class HandoverConnectionThread;
 
@@ -15,13 +22,25 @@ public:
   ~HandoverServer();
 
   static const int DEFAULT_MIU = 128;
+
+  // How long the peer may stay silent or congested before a put or receive
+  // on a connection fails.
+  static const int DEFAULT_TIMEOUT_MS = 5000;
+
   static const char* DEFAULT_SERVICE_NAME;
   static const int HANDOVER_SAP = 0x14;
 
   void start();
+
+  /**
+   * Stop accepting connections, close the open ones and wait until the
+   * server thread and every connection have finished.
+   */
   void stop();
   bool put(NdefMessage& msg);
-  void setConnectionThread(HandoverConnectionThread* pThread);
+
+  bool addConnectionThread(HandoverConnectionThread* pThread);
+  void removeConnectionThread(HandoverConnectionThread* pThread);
 
   ILlcpServerSocket* mServerSocket;
   int                mServiceSap;
@@ -29,14 +48,30 @@ public:
   bool               mServerRunning;
 
 private:
+  pthread_t mThread;
+  bool mThreadStarted;
+
+  // mConnectionThread is the latest connection, used by put(), and
+  // mPutConnection the one put() is sending on. Both of them and
+  // mConnections are protected by mMutex.
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
   HandoverConnectionThread* mConnectionThread;
+  HandoverConnectionThread* mPutConnection;
+  std::set<HandoverConnectionThread*> mConnections;
 };
 
-class HandoverConnectionThread {
+/**
+ * An accepted handover connection. It is served on a NfcWorkerPool thread.
+ */
+class HandoverConnectionThread : public NfcWorkerTask {
 public:
   HandoverConnectionThread(HandoverServer* server, ILlcpSocket* socket, IHandoverCallback* callback);
   ~HandoverConnectionThread();
 
+  /**
+   * Receive NDEF messages until the connection is closed.
+   */
   void run();
   bool isServerRunning() const;
 
@@ -5,6 +5,7 @@
 #ifndef mozilla_nfcd_DeviceHost_h
 #define mozilla_nfcd_DeviceHost_h
 
+#include <stdint.h>
 #include <stdio.h>
 
 class INfcTag;
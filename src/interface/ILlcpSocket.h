@@ -5,6 +5,8 @@
 #ifndef mozilla_nfcd_ILlcpSocket_h
 #define mozilla_nfcd_ILlcpSocket_h
 
+#include <stdint.h>
+#include <stddef.h>
 #include <vector>
 
 class ILlcpSocket {
@@ -42,6 +44,16 @@ public:
    */
   virtual bool send(std::vector<uint8_t>& sendBuff) = 0;
 
+  /**
+   * Send data to peer without copying it into a vector first. The data is
+   * sent as one I-PDU, so length must not exceed the remote MIU.
+   *
+   * @param data   Data to send.
+   * @param length Number of bytes.
+   * @return       True if sent ok.
+   */
+  virtual bool send(const uint8_t* data, size_t length) = 0;
+
   /**
    * Receive data from peer.
    *
@@ -50,6 +62,34 @@ public:
    */
   virtual int receive(std::vector<uint8_t>& recvBuff) = 0;
 
+  /**
+   * Receive data from peer into a caller-provided buffer. A buffer of the
+   * local MIU holds a whole I-PDU.
+   *
+   * @param buffer Buffer to put received data.
+   * @param length Size of the buffer.
+   * @return       Number of bytes received, or -1 if the connection broke.
+   */
+  virtual int receive(uint8_t* buffer, size_t length) = 0;
+
+  /**
+   * Bound how long each send() and receive() may block. A send times out
+   * if the link stays congested, a receive if no data arrives. May be called
+   * while another thread sends or receives; later calls use the new value.
+   *
+   * @param timeoutMs Timeout in milliseconds; 0 waits forever.
+   * @return          None.
+   */
+  virtual void setTimeout(int timeoutMs) = 0;
+
+  /**
+   * Unblock send() and receive() from another thread and make later calls
+   * fail. The owner still calls close().
+   *
+   * @return None.
+   */
+  virtual void cancel() = 0;
+
   /**
    * Get peer's maximum information unit.
    *
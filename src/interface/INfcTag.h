@@ -6,6 +6,7 @@
 #define mozilla_nfcd_INfcTag_h
 
 #include "TagTechnology.h"
+#include <stdint.h>
 #include <vector>
 
 #define INTERFACE_TAG_MANAGER "NfcTagManager"
@@ -68,6 +69,15 @@ public:
    */
   virtual bool presenceCheck() = 0;
 
+  /**
+   * Get how often presence-check should be done for the connected tag.
+   *
+   * @param  minIntervalMs Interval right after activation.
+   * @param  maxIntervalMs Interval while the tag stays in the field.
+   * @return               None.
+   */
+  virtual void getPresenceCheckIntervals(uint32_t& minIntervalMs, uint32_t& maxIntervalMs) = 0;
+
   /**
    * Make the tag read-only.
    *
@@ -30,16 +30,43 @@ bool NdefMessage::init(std::vector<uint8_t>& buf)
   return NdefRecord::parse(buf, false, mRecords);
 }
 
+bool NdefMessage::init(const uint8_t* data, size_t length)
+{
+  return NdefRecord::parse(data, length, false, mRecords);
+}
+
 /**
  * This method will generate current NDEF message to byte array(vector).
+ * The message is appended to buf, which is grown once to the exact size.
  */
 void NdefMessage::toByteArray(std::vector<uint8_t>& buf)
+{
+  uint32_t size = getEncodedSize();
+  if (!size) {
+    return;
+  }
+
+  size_t offset = buf.size();
+  buf.resize(offset + size);
+  writeTo(&buf[offset]);
+}
+
+uint32_t NdefMessage::getEncodedSize()
+{
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < mRecords.size(); i++) {
+    size += mRecords[i].getEncodedSize();
+  }
+  return size;
+}
+
+uint8_t* NdefMessage::writeTo(uint8_t* dest)
 {
   int recordSize = mRecords.size();
   for (int i = 0; i < recordSize; i++) {
     bool mb = (i == 0);  // first record.
     bool me = (i == recordSize - 1);  // last record.
-    mRecords[i].writeToByteBuffer(buf, mb, me);
-  } 
-  return;
+    dest = mRecords[i].writeTo(dest, mb, me);
+  }
+  return dest;
 }
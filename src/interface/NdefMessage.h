@@ -31,6 +31,15 @@ public:
    */
   bool init(std::vector<uint8_t>& buf, int offset);
 
+  /**
+   * Initialize NDEF meesage with NDEF binary data.
+   *
+   * @param  data   Input buffer contains raw NDEF data.
+   * @param  length Length of the buffer.
+   * @return        True if the buffer can be correctly parsed.
+   */
+  bool init(const uint8_t* data, size_t length);
+
   /**
    * Write current NdefMessage to byte buffer.
    *
@@ -39,6 +48,19 @@ public:
    */
   void toByteArray(std::vector<uint8_t>& buf);
 
+  /**
+   * @return Number of bytes writeTo() writes for this message.
+   */
+  uint32_t getEncodedSize();
+
+  /**
+   * Write current NdefMessage to a raw buffer.
+   *
+   * @param  dest Output buffer, at least getEncodedSize() bytes long.
+   * @return      Pointer past the last byte written.
+   */
+  uint8_t* writeTo(uint8_t* dest);
+
   // Array of NDEF records.
   std::vector<NdefRecord> mRecords;
 };
@@ -0,0 +1,228 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NdefParser.h"
+#include "NdefRecord.h"
+
+#undef LOG_TAG
+#define LOG_TAG "nfcd"
+#include <utils/Log.h>
+
+static bool ensureSanePayloadSize(uint32_t size);
+static bool validateTnf(uint8_t tnf, uint32_t typeLength, uint32_t idLength, uint32_t payloadLength);
+
+const uint32_t NdefParser::MAX_PAYLOAD_SIZE;
+
+NdefParser::NdefParser(const uint8_t* data, size_t length)
+ : mData(data)
+ , mLength(data ? length : 0)
+ , mOffset(0)
+{
+}
+
+bool NdefParser::parse(bool ignoreMbMe)
+{
+  bool inChunk = false;
+  bool me = false;
+  NdefRecordView view;
+
+  mViews.clear();
+  mChunks.clear();
+  mOffset = 0;
+
+  while (!me) {
+    // Flags and type length are always present.
+    if (!has(2)) {
+      ALOGE("truncated record header");
+      return false;
+    }
+
+    uint8_t flag = mData[mOffset++];
+
+    bool mb = (flag & NdefRecord::FLAG_MB) != 0;
+    me = (flag & NdefRecord::FLAG_ME) != 0;
+    bool cf = (flag & NdefRecord::FLAG_CF) != 0;
+    bool sr = (flag & NdefRecord::FLAG_SR) != 0;
+    bool il = (flag & NdefRecord::FLAG_IL) != 0;
+    uint8_t tnf = flag & 0x07;
+
+    if (!mb && mViews.size() == 0 && !inChunk && !ignoreMbMe) {
+      ALOGE("expected MB flag");
+      return false;
+    } else if (mb && mViews.size() != 0 && !ignoreMbMe) {
+      ALOGE("unexpected MB flag");
+      return false;
+    } else if (inChunk && il) {
+      ALOGE("unexpected IL flag in non-leading chunk");
+      return false;
+    } else if (cf && me) {
+      ALOGE("unexpected ME flag in non-trailing chunk");
+      return false;
+    } else if (inChunk && tnf != NdefRecord::TNF_UNCHANGED) {
+      ALOGE("expected TNF_UNCHANGED in non-leading chunk");
+      return false;
+    } else if (!inChunk && tnf == NdefRecord::TNF_UNCHANGED) {
+      ALOGE("unexpected TNF_UNCHANGED in first chunk or unchunked record");
+      return false;
+    }
+
+    uint32_t typeLength = mData[mOffset++];
+    uint32_t payloadLength;
+    if (sr) {
+      if (!has(1)) {
+        ALOGE("truncated record header");
+        return false;
+      }
+      payloadLength = mData[mOffset++];
+    } else {
+      if (!has(4)) {
+        ALOGE("truncated record header");
+        return false;
+      }
+      payloadLength = ((uint32_t)mData[mOffset]     << 24) |
+                      ((uint32_t)mData[mOffset + 1] << 16) |
+                      ((uint32_t)mData[mOffset + 2] <<  8) |
+                      ((uint32_t)mData[mOffset + 3]);
+      mOffset += 4;
+    }
+
+    uint32_t idLength = 0;
+    if (il) {
+      if (!has(1)) {
+        ALOGE("truncated record header");
+        return false;
+      }
+      idLength = mData[mOffset++];
+    }
+
+    if (inChunk && typeLength != 0) {
+      ALOGE("expected zero-length type in non-leading chunk");
+      return false;
+    }
+
+    if (!ensureSanePayloadSize(payloadLength)) {
+      return false;
+    }
+
+    // Type and id are below 256 bytes and the payload below MAX_PAYLOAD_SIZE,
+    // so the sum cannot overflow.
+    if (!has((size_t)typeLength + idLength + payloadLength)) {
+      ALOGE("record length exceeds buffer: %u/%u/%u, %u bytes left",
+            typeLength, idLength, payloadLength, (uint32_t)(mLength - mOffset));
+      return false;
+    }
+
+    if (!inChunk) {
+      view.tnf = tnf;
+      view.type.offset = mOffset;
+      view.type.length = typeLength;
+      mOffset += typeLength;
+      view.id.offset = mOffset;
+      view.id.length = idLength;
+      mOffset += idLength;
+      view.payloadLength = 0;
+      view.firstChunk = mChunks.size();
+      view.chunkCount = 0;
+    }
+
+    NdefSpan payload;
+    payload.offset = mOffset;
+    payload.length = payloadLength;
+    mOffset += payloadLength;
+
+    mChunks.push_back(payload);
+    view.chunkCount++;
+    view.payloadLength += payloadLength;
+    if (!ensureSanePayloadSize(view.payloadLength)) {
+      return false;
+    }
+
+    if (cf) {
+      // more chunks to come.
+      inChunk = true;
+      continue;
+    }
+    inChunk = false;
+
+    if (!validateTnf(view.tnf, view.type.length, view.id.length, view.payloadLength)) {
+      return false;
+    }
+
+    mViews.push_back(view);
+
+    if (ignoreMbMe) {  // for parsing a single NdefRecord.
+      break;
+    }
+  }
+  return true;
+}
+
+void NdefParser::getRecord(size_t index, NdefRecord& record)
+{
+  const NdefRecordView& view = mViews[index];
+
+  record.mTnf = view.tnf;
+  record.mType.assign(getData(view.type), getData(view.type) + view.type.length);
+  record.mId.assign(getData(view.id), getData(view.id) + view.id.length);
+
+  record.mPayload.clear();
+  record.mPayload.reserve(view.payloadLength);
+  for (uint32_t i = 0; i < view.chunkCount; i++) {
+    const NdefSpan& chunk = mChunks[view.firstChunk + i];
+    record.mPayload.insert(record.mPayload.end(), getData(chunk), getData(chunk) + chunk.length);
+  }
+}
+
+void NdefParser::getRecords(std::vector<NdefRecord>& records)
+{
+  // Construct the records in place rather than copying each one in.
+  size_t base = records.size();
+  records.resize(base + mViews.size());
+  for (size_t i = 0; i < mViews.size(); i++) {
+    getRecord(i, records[base + i]);
+  }
+}
+
+bool ensureSanePayloadSize(uint32_t size)
+{
+  if (size > NdefParser::MAX_PAYLOAD_SIZE) {
+    ALOGE("payload above max limit: %u > %u", size, NdefParser::MAX_PAYLOAD_SIZE);
+    return false;
+  }
+  return true;
+}
+
+bool validateTnf(uint8_t tnf, uint32_t typeLength, uint32_t idLength, uint32_t payloadLength)
+{
+  bool isValid = true;
+  switch (tnf) {
+    case NdefRecord::TNF_EMPTY:
+      if (typeLength != 0 || idLength != 0 || payloadLength != 0) {
+        ALOGE("unexpected data in TNF_EMPTY record");
+        isValid = false;
+      }
+      break;
+    case NdefRecord::TNF_WELL_KNOWN:
+    case NdefRecord::TNF_MIME_MEDIA:
+    case NdefRecord::TNF_ABSOLUTE_URI:
+    case NdefRecord::TNF_EXTERNAL_TYPE:
+      break;
+    case NdefRecord::TNF_UNKNOWN:
+    case NdefRecord::TNF_RESERVED:
+      if (typeLength != 0) {
+        ALOGE("unexpected type field in TNF_UNKNOWN or TNF_RESERVEd record");
+        isValid = false;
+      }
+      break;
+    case NdefRecord::TNF_UNCHANGED:
+      ALOGE("unexpected TNF_UNCHANGED in first chunk or logical record");
+      isValid = false;
+      break;
+    default:
+      ALOGE("unexpected tnf value");
+      isValid = false;
+      break;
+  }
+  return isValid;
+}
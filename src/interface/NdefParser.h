@@ -0,0 +1,99 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NdefParser_h
+#define mozilla_nfcd_NdefParser_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class NdefRecord;
+
+/**
+ * A range of bytes in the buffer given to NdefParser.
+ */
+struct NdefSpan {
+  uint32_t offset;
+  uint32_t length;
+};
+
+/**
+ * A parsed NDEF record that refers to the source buffer instead of owning
+ * its fields. A chunked record has one payload span per chunk.
+ */
+struct NdefRecordView {
+  uint8_t tnf;
+  NdefSpan type;
+  NdefSpan id;
+
+  // Total payload length, summed over all chunks.
+  uint32_t payloadLength;
+
+  // Payload spans are stored in the parser, starting at firstChunk.
+  uint32_t firstChunk;
+  uint32_t chunkCount;
+};
+
+/**
+ * NDEF parser over a raw byte buffer.
+ *
+ * parse() walks the buffer once and validates every header and length
+ * against the bytes left before reading them. Records are kept as views into
+ * the buffer, so nothing is copied until a record is materialized with
+ * getRecord() or getRecords(). The buffer must outlive the parser.
+ */
+class NdefParser {
+public:
+  // 10 MB payload limit.
+  static const uint32_t MAX_PAYLOAD_SIZE = 10 * (1 << 20);
+
+  NdefParser(const uint8_t* data, size_t length);
+
+  /**
+   * Parse the buffer.
+   *
+   * @param  ignoreMbMe Set if only want to parse single NdefRecord and do not care about Mb,Me field.
+   * @return            True if the buffer can be correctly parsed.
+   */
+  bool parse(bool ignoreMbMe);
+
+  /**
+   * @return Number of bytes taken by the parsed records.
+   */
+  size_t getParsedLength() { return mOffset; }
+
+  size_t getRecordCount() { return mViews.size(); }
+  const NdefRecordView& getRecordView(size_t index) { return mViews[index]; }
+  const uint8_t* getData(const NdefSpan& span) { return mData + span.offset; }
+
+  /**
+   * Copy one parsed record into an owning NdefRecord. Chunked payloads are
+   * joined.
+   *
+   * @param  index  Index of the record.
+   * @param  record Output record.
+   * @return        None.
+   */
+  void getRecord(size_t index, NdefRecord& record);
+
+  /**
+   * Append all parsed records to a vector.
+   *
+   * @param  records Output records.
+   * @return         None.
+   */
+  void getRecords(std::vector<NdefRecord>& records);
+
+private:
+  bool has(size_t count) { return mLength - mOffset >= count; }
+
+  const uint8_t* mData;
+  size_t mLength;
+  size_t mOffset;
+  std::vector<NdefRecordView> mViews;
+  std::vector<NdefSpan> mChunks;
+};
+
+#endif // mozilla_nfcd_NdefParser_h
@@ -5,6 +5,8 @@
 #ifndef mozilla_nfcd_NdefRecord_h
 #define mozilla_nfcd_NdefRecord_h
 
+#include <stdint.h>
+#include <stddef.h>
 #include <vector>
 
 class NdefRecord {
@@ -20,6 +22,13 @@ public:
   static const uint8_t TNF_UNCHANGED = 0x06;
   static const uint8_t TNF_RESERVED = 0x07;
 
+  // Record header flags.
+  static const uint8_t FLAG_MB = 0x80;
+  static const uint8_t FLAG_ME = 0x40;
+  static const uint8_t FLAG_CF = 0x20;
+  static const uint8_t FLAG_SR = 0x10;
+  static const uint8_t FLAG_IL = 0x08;
+
   /**
    * Default constructor.
    */
@@ -33,8 +42,8 @@ public:
   /**
    * Constructor with type, id, payload as input parameter.
    */
-  NdefRecord(uint8_t tnf, uint32_t typeLength, uint8_t* type, uint32_t idLength,
-             uint8_t* id, uint32_t payloadLength, uint8_t* payload);
+  NdefRecord(uint8_t tnf, uint32_t typeLength, const uint8_t* type, uint32_t idLength,
+             const uint8_t* id, uint32_t payloadLength, const uint8_t* payload);
 
   /**
    * Destructor.
@@ -62,6 +71,17 @@ public:
    */
   static bool parse(std::vector<uint8_t>& buf, bool ignoreMbMe, std::vector<NdefRecord>& records, int offset);
 
+  /**
+   * Utility function to fill NdefRecord.
+   *
+   * @param  data       Input buffer contains raw NDEF data.
+   * @param  length     Length of the buffer.
+   * @param  ignoreMbMe Set if only want to parse single NdefRecord and do not care about Mb,Me field.
+   * @param  records    Output formatted NdefRecord parsed from data.
+   * @return            True if the buffer can be correctly parsed.
+   */
+  static bool parse(const uint8_t* data, size_t length, bool ignoreMbMe, std::vector<NdefRecord>& records);
+
   /**
    * Write current Ndefrecord to byte buffer. MB,ME bit is specified in parameter.
    *
@@ -72,6 +92,21 @@ public:
    */
   void writeToByteBuffer(std::vector<uint8_t>& buf, bool mb, bool me);
 
+  /**
+   * @return Number of bytes writeTo() writes for this record.
+   */
+  uint32_t getEncodedSize();
+
+  /**
+   * Write current NdefRecord to a raw buffer. MB,ME bit is specified in parameter.
+   *
+   * @param  dest Output buffer, at least getEncodedSize() bytes long.
+   * @param  mb   Message begine bit of NDEF record.
+   * @param  me   Message end bit of NDEF record.
+   * @return      Pointer past the last byte written.
+   */
+  uint8_t* writeTo(uint8_t* dest, bool mb, bool me);
+
   // MB, ME, CF, SR, IL.
   uint8_t mFlags;
 
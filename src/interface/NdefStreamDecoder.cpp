@@ -0,0 +1,126 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NdefStreamDecoder.h"
+#include "NdefMessage.h"
+#include "NdefParser.h"
+#include "NdefRecord.h"
+#include "NfcDebug.h"
+
+NdefStreamDecoder::NdefStreamDecoder(uint32_t maxLength)
+ : mMaxLength(maxLength)
+ , mScanOffset(0)
+ , mNeededLength(2)
+ , mStatus(NEED_MORE)
+{
+}
+
+NdefStreamDecoder::Status NdefStreamDecoder::append(const uint8_t* data, size_t length)
+{
+  if (mStatus == ERROR) {
+    return mStatus;
+  }
+
+  if (length) {
+    if (mBuffer.size() + length > mMaxLength) {
+      ALOGE("%s: NDEF message exceeds %u bytes", FUNC, mMaxLength);
+      mStatus = ERROR;
+      return mStatus;
+    }
+    mBuffer.insert(mBuffer.end(), data, data + length);
+  }
+
+  if (mStatus == NEED_MORE) {
+    mStatus = scan();
+  }
+  return mStatus;
+}
+
+NdefStreamDecoder::Status NdefStreamDecoder::scan()
+{
+  size_t size = mBuffer.size();
+
+  while (true) {
+    size_t available = size - mScanOffset;
+
+    // Flags and type length.
+    if (available < 2) {
+      mNeededLength = 2 - available;
+      return NEED_MORE;
+    }
+
+    uint8_t flag = mBuffer[mScanOffset];
+    bool sr = (flag & NdefRecord::FLAG_SR) != 0;
+    bool il = (flag & NdefRecord::FLAG_IL) != 0;
+    size_t headerLength = 2 + (sr ? 1 : 4) + (il ? 1 : 0);
+    if (available < headerLength) {
+      mNeededLength = headerLength - available;
+      return NEED_MORE;
+    }
+
+    const uint8_t* header = &mBuffer[mScanOffset];
+    uint32_t typeLength = header[1];
+    uint32_t payloadLength;
+    if (sr) {
+      payloadLength = header[2];
+    } else {
+      payloadLength = ((uint32_t)header[2] << 24) |
+                      ((uint32_t)header[3] << 16) |
+                      ((uint32_t)header[4] <<  8) |
+                      ((uint32_t)header[5]);
+    }
+    uint32_t idLength = il ? header[headerLength - 1] : 0;
+
+    if (payloadLength > NdefParser::MAX_PAYLOAD_SIZE) {
+      ALOGE("%s: payload above max limit: %u", FUNC, payloadLength);
+      return ERROR;
+    }
+
+    uint64_t recordEnd = (uint64_t)mScanOffset + headerLength + typeLength + idLength + payloadLength;
+    if (recordEnd > mMaxLength) {
+      ALOGE("%s: NDEF message exceeds %u bytes", FUNC, mMaxLength);
+      return ERROR;
+    }
+    if (recordEnd > size) {
+      mNeededLength = recordEnd - size;
+      return NEED_MORE;
+    }
+
+    mScanOffset = recordEnd;
+
+    // The last chunk of a chunked record carries ME, so a record with CF set
+    // never ends the message.
+    if ((flag & NdefRecord::FLAG_ME) && !(flag & NdefRecord::FLAG_CF)) {
+      mNeededLength = 0;
+      return COMPLETE;
+    }
+  }
+}
+
+NdefMessage* NdefStreamDecoder::takeMessage()
+{
+  if (mStatus != COMPLETE) {
+    return NULL;
+  }
+
+  NdefMessage* ndef = new NdefMessage();
+  if (!ndef->init(&mBuffer[0], mScanOffset)) {
+    ALOGE("%s: invalid NDEF message", FUNC);
+    delete ndef;
+    ndef = NULL;
+  }
+
+  mBuffer.erase(mBuffer.begin(), mBuffer.begin() + mScanOffset);
+  mScanOffset = 0;
+  mStatus = scan();
+  return ndef;
+}
+
+void NdefStreamDecoder::reset()
+{
+  mBuffer.clear();
+  mScanOffset = 0;
+  mNeededLength = 2;
+  mStatus = NEED_MORE;
+}
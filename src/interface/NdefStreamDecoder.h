@@ -0,0 +1,86 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NdefStreamDecoder_h
+#define mozilla_nfcd_NdefStreamDecoder_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class NdefMessage;
+
+/**
+ * Reassembles NDEF messages that arrive in fragments, e.g. over LLCP.
+ *
+ * Fragments are appended to an internal buffer. The decoder only walks the
+ * record headers, and it remembers where the next header starts, so every
+ * byte is looked at once no matter how many fragments the message is split
+ * into. The message is parsed once, when its last record is complete.
+ */
+class NdefStreamDecoder {
+public:
+  typedef enum {
+    NEED_MORE,
+    COMPLETE,
+    ERROR,
+  } Status;
+
+  /**
+   * @param maxLength Largest message accepted, in bytes.
+   */
+  NdefStreamDecoder(uint32_t maxLength);
+
+  /**
+   * Add received bytes.
+   *
+   * @param  data   Received bytes.
+   * @param  length Number of bytes.
+   * @return        COMPLETE if a whole message is buffered, NEED_MORE if
+   *                not, ERROR if the data cannot be a valid message.
+   */
+  Status append(const uint8_t* data, size_t length);
+
+  Status getStatus() { return mStatus; }
+
+  /**
+   * @return Minimum number of bytes still needed before the decoder can make
+   *         progress. Only meaningful when the status is NEED_MORE.
+   */
+  uint32_t getNeededLength() { return mNeededLength; }
+
+  /**
+   * @return Number of bytes buffered, 0 if no message has started.
+   */
+  size_t getBufferedLength() { return mBuffer.size(); }
+
+  /**
+   * Parse the complete message and remove it from the buffer. Bytes received
+   * after the message are kept and scanned for the next one.
+   *
+   * @return The message, owned by the caller, or NULL if it is invalid or no
+   *         message is complete.
+   */
+  NdefMessage* takeMessage();
+
+  /**
+   * Drop everything buffered so far.
+   *
+   * @return None.
+   */
+  void reset();
+
+private:
+  Status scan();
+
+  uint32_t mMaxLength;
+  std::vector<uint8_t> mBuffer;
+
+  // Offset of the next record header that has not been scanned yet.
+  size_t mScanOffset;
+  uint32_t mNeededLength;
+  Status mStatus;
+};
+
+#endif // mozilla_nfcd_NdefStreamDecoder_h
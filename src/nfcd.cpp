@@ -3,15 +3,24 @@
  * You can obtain one at http://mozilla.org/MPL/2.0/. */
 #include "nfcd.h"
 
+#include <stdlib.h>
+
 #include "NfcManager.h"
 #include "NfcService.h"
 #include "NfcIpcSocket.h"
 #include "DeviceHost.h"
 #include "MessageHandler.h"
 #include "SnepServer.h"
+#include "NfcTrace.h"
+
+// Overrides the number of bytes that may be queued for one IPC client.
+#define IPC_HIGH_WATER_MARK_ENV "NFCD_IPC_HIGH_WATER_MARK"
 
 int main() {
 
+  // Before any thread is created, see NfcTrace::startDumpOnSignal().
+  NfcTrace::startDumpOnSignal();
+
   // Create NFC Manager and do initialize.
   NfcManager* pNfcManager = new NfcManager();
 
@@ -23,6 +32,10 @@ int main() {
   // Create IPC socket & main thread will enter while loop to read data from socket.
   NfcIpcSocket* socket = NfcIpcSocket::Instance();
   socket->initialize(msgHandler);
+  const char* highWaterMark = getenv(IPC_HIGH_WATER_MARK_ENV);
+  if (highWaterMark && atoi(highWaterMark) > 0) {
+    socket->setHighWaterMark(atoi(highWaterMark));
+  }
   socket->setSocketListener(service);
   msgHandler->setOutgoingSocket(socket);
   socket->loop();
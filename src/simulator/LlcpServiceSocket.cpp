@@ -0,0 +1,92 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "LlcpServiceSocket.h"
+
+#include "LlcpSocket.h"
+#include "SimulatedField.h"
+#include "SimulatedLink.h"
+#include "NfcDebug.h"
+
+LlcpServiceSocket::LlcpServiceSocket(SimulatedField* field, int sap, const char* serviceName,
+                                     int localMiu, int localRw)
+ : mField(field)
+ , mSap(sap)
+ , mServiceName(serviceName ? serviceName : "")
+ , mLocalMiu(localMiu)
+ , mLocalRw(localRw)
+ , mIsClosed(false)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+}
+
+LlcpServiceSocket::~LlcpServiceSocket()
+{
+  close();
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mMutex);
+}
+
+ILlcpSocket* LlcpServiceSocket::accept()
+{
+  ALOGD("%s: enter", FUNC);
+
+  pthread_mutex_lock(&mMutex);
+  while (!mIsClosed && mPending.empty()) {
+    pthread_cond_wait(&mCond, &mMutex);
+  }
+
+  if (mIsClosed) {
+    pthread_mutex_unlock(&mMutex);
+    ALOGE("%s: fail accept", FUNC);
+    return NULL;
+  }
+
+  SimulatedLink* link = mPending.front();
+  mPending.pop_front();
+  pthread_mutex_unlock(&mMutex);
+
+  // The socket takes over the reference held by the queue.
+  LlcpSocket* clientSocket = new LlcpSocket(link, SimulatedLink::SIDE_LOCAL, mSap);
+
+  ALOGD("%s: exit", FUNC);
+  return static_cast<ILlcpSocket*>(clientSocket);
+}
+
+bool LlcpServiceSocket::close()
+{
+  // Unregister first, so the field offers no more connections.
+  mField->unregisterService(this);
+
+  pthread_mutex_lock(&mMutex);
+  if (mIsClosed) {
+    pthread_mutex_unlock(&mMutex);
+    return true;
+  }
+  mIsClosed = true;
+
+  while (!mPending.empty()) {
+    SimulatedLink* link = mPending.front();
+    mPending.pop_front();
+    link->close();
+    link->release();
+  }
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+  return true;
+}
+
+bool LlcpServiceSocket::offer(SimulatedLink* link)
+{
+  pthread_mutex_lock(&mMutex);
+  if (mIsClosed) {
+    pthread_mutex_unlock(&mMutex);
+    return false;
+  }
+  mPending.push_back(link);
+  pthread_cond_signal(&mCond);
+  pthread_mutex_unlock(&mMutex);
+  return true;
+}
@@ -0,0 +1,69 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_LlcpServiceSocket_h
+#define mozilla_nfcd_LlcpServiceSocket_h
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+
+#include "ILlcpServerSocket.h"
+
+class ILlcpSocket;
+class SimulatedField;
+class SimulatedLink;
+
+/**
+ * LlcpServiceSocket represents a LLCP Service the simulated peer can
+ * connect to.
+ */
+class LlcpServiceSocket
+  : public ILlcpServerSocket
+{
+public:
+  LlcpServiceSocket(SimulatedField* field, int sap, const char* serviceName, int localMiu, int localRw);
+  virtual ~LlcpServiceSocket();
+
+  /**
+   * Accept a connection request from a peer.
+   *
+   * @return ILlcpSocket interface, or NULL once the socket is closed.
+   */
+  ILlcpSocket* accept();
+
+  /**
+   * Close a server socket.
+   *
+   * @return True if ok.
+   */
+  bool close();
+
+  /**
+   * Queue a connection from the peer for accept().
+   *
+   * @param  link Link to hand over, with a reference owned by the socket.
+   * @return      False if the socket is closed; the caller keeps the reference.
+   */
+  bool offer(SimulatedLink* link);
+
+  int getSap() const { return mSap; }
+  const std::string& getServiceName() const { return mServiceName; }
+  int getLocalMiu() const { return mLocalMiu; }
+  int getLocalRw() const { return mLocalRw; }
+
+private:
+  SimulatedField* mField;
+  int mSap;
+  std::string mServiceName;
+  int mLocalMiu;
+  int mLocalRw;
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  std::deque<SimulatedLink*> mPending;
+  bool mIsClosed;
+};
+
+#endif  // mozilla_nfcd_LlcpServiceSocket_h
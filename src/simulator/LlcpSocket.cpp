@@ -0,0 +1,131 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "LlcpSocket.h"
+
+#include "SimulatedField.h"
+#include "SimulatedLink.h"
+#include "NfcDebug.h"
+#include "NfcTrace.h"
+
+// LLCP default MIU; the smallest unit a peer may send.
+#define LLCP_DEFAULT_MIU 128
+
+LlcpSocket::LlcpSocket(SimulatedField* field, int sap, int miu, int rw)
+ : mField(field)
+ , mLink(NULL)
+ , mSide(SimulatedLink::SIDE_LOCAL)
+ , mSap(sap)
+ , mLocalMiu(miu)
+ , mLocalRw(rw)
+ , mTimeoutMs(0)
+{
+}
+
+LlcpSocket::LlcpSocket(SimulatedLink* link, int side, int sap)
+ : mField(NULL)
+ , mLink(link)
+ , mSide(side)
+ , mSap(sap)
+ , mLocalMiu(link->getMiu(side))
+ , mLocalRw(link->getRw(side))
+ , mTimeoutMs(0)
+{
+}
+
+LlcpSocket::~LlcpSocket()
+{
+  if (mLink) {
+    mLink->release();
+  }
+}
+
+bool LlcpSocket::connectToSap(int sap)
+{
+  if (mLink || !mField) {
+    ALOGE("%s: socket already connected", FUNC);
+    return false;
+  }
+
+  mLink = mField->connect(sap, NULL, mLocalMiu, mLocalRw);
+  return mLink != NULL;
+}
+
+bool LlcpSocket::connectToService(const char* serviceName)
+{
+  if (mLink || !mField) {
+    ALOGE("%s: socket already connected", FUNC);
+    return false;
+  }
+
+  mLink = mField->connect(0, serviceName, mLocalMiu, mLocalRw);
+  return mLink != NULL;
+}
+
+void LlcpSocket::close()
+{
+  if (mLink) {
+    mLink->close();
+  }
+}
+
+bool LlcpSocket::send(std::vector<uint8_t>& data)
+{
+  return send(data.empty() ? NULL : &data[0], data.size());
+}
+
+bool LlcpSocket::send(const uint8_t* data, size_t length)
+{
+  if (!mLink) {
+    ALOGE("%s: socket not connected", FUNC);
+    return false;
+  }
+  NFC_TRACE_IO(NFC_TRACE_LLCP_SEND, NFC_TRACE_BEGIN, length, 0);
+  bool result = mLink->send(mSide, data, length, mTimeoutMs);
+  NFC_TRACE_IO(NFC_TRACE_LLCP_SEND, NFC_TRACE_FINISH, length, result);
+  return result;
+}
+
+int LlcpSocket::receive(std::vector<uint8_t>& recvBuff)
+{
+  // The peer never sends more than our MIU in one I-PDU.
+  if (mRecvBuffer.empty()) {
+    mRecvBuffer.resize(mLocalMiu > LLCP_DEFAULT_MIU ? mLocalMiu : LLCP_DEFAULT_MIU);
+  }
+
+  int length = receive(&mRecvBuffer[0], mRecvBuffer.size());
+  if (length > 0) {
+    recvBuff.insert(recvBuff.end(), mRecvBuffer.begin(), mRecvBuffer.begin() + length);
+  }
+  return length;
+}
+
+int LlcpSocket::receive(uint8_t* buffer, size_t length)
+{
+  if (!mLink) {
+    ALOGE("%s: socket not connected", FUNC);
+    return -1;
+  }
+  NFC_TRACE_IO(NFC_TRACE_LLCP_RECEIVE, NFC_TRACE_BEGIN, 0, 0);
+  int received = mLink->receive(mSide, buffer, length, mTimeoutMs);
+  NFC_TRACE_IO(NFC_TRACE_LLCP_RECEIVE, NFC_TRACE_FINISH, received > 0 ? received : 0, received > 0);
+  return received;
+}
+
+void LlcpSocket::cancel()
+{
+  if (mLink) {
+    mLink->cancel(mSide);
+  }
+}
+
+int LlcpSocket::getRemoteMiu() const
+{
+  return mLink ? mLink->getMiu(1 - mSide) : 0;
+}
+
+int LlcpSocket::getRemoteRw() const
+{
+  return mLink ? mLink->getRw(1 - mSide) : 0;
+}
@@ -0,0 +1,120 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_LlcpSocket_h
+#define mozilla_nfcd_LlcpSocket_h
+
+#include <vector>
+#include "ILlcpSocket.h"
+
+class SimulatedField;
+class SimulatedLink;
+
+/**
+ * LlcpSocket represents one side of a simulated LLCP connection-oriented
+ * data link.
+ */
+class LlcpSocket
+  : public ILlcpSocket
+{
+public:
+  /**
+   * Create a client socket, connected later by connectToSap() or
+   * connectToService().
+   */
+  LlcpSocket(SimulatedField* field, int sap, int miu, int rw);
+
+  /**
+   * Wrap one side of a link that is already connected.
+   */
+  LlcpSocket(SimulatedLink* link, int side, int sap);
+  virtual ~LlcpSocket();
+
+  /**
+   * Establish a connection to the peer.
+   *
+   * @param nSap Service access point of the peer.
+   * @return     True if ok.
+   */
+  bool connectToSap(int nSap);
+
+  /**
+   * Establish a connection to the peer.
+   *
+   * @param sn Service name.
+   * return    True if ok.
+   */
+  bool connectToService(const char* serviceName);
+
+  /**
+   * Close socket.
+   *
+   * @return None.
+   */
+  void close();
+
+  /**
+   * Send data to peer.
+   *
+   * @param sendBuff Buffer of data.
+   * @return         True if sent ok.
+   */
+  bool send(std::vector<uint8_t>& sendBuff);
+
+  /**
+   * Send data to peer.
+   *
+   * @param data   Data to send.
+   * @param length Number of bytes.
+   * @return       True if sent ok.
+   */
+  bool send(const uint8_t* data, size_t length);
+
+  /**
+   * Receive data from peer.
+   *
+   * @param recvBuff Buffer to append received data to.
+   * @return         Number of bytes received, or -1 on failure.
+   */
+  int receive(std::vector<uint8_t>& recvBuff);
+
+  /**
+   * Receive data from peer.
+   *
+   * @param buffer Buffer to put received data.
+   * @param length Size of the buffer.
+   * @return       Number of bytes received, or -1 on failure.
+   */
+  int receive(uint8_t* buffer, size_t length);
+
+  void setTimeout(int timeoutMs) { mTimeoutMs = timeoutMs; }
+
+  /**
+   * Unblock pending send and receive.
+   *
+   * @return None.
+   */
+  void cancel();
+
+  int getRemoteMiu() const;
+  int getRemoteRw() const;
+
+  int getLocalSap() const { return mSap; }
+  int getLocalMiu() const { return mLocalMiu; }
+  int getLocalRw() const { return mLocalRw; }
+
+private:
+  SimulatedField* mField;
+  SimulatedLink* mLink;  // NULL until connected.
+  int mSide;
+  int mSap;
+  int mLocalMiu;
+  int mLocalRw;
+  volatile int mTimeoutMs;  // 0 waits forever.
+
+  // Reused by receive(std::vector&), sized to the local MIU on first use.
+  std::vector<uint8_t> mRecvBuffer;
+};
+
+#endif // mozilla_nfcd_LlcpSocket_h
@@ -0,0 +1,112 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcManager.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "IP2pDevice.h"
+#include "INfcTag.h"
+#include "LlcpServiceSocket.h"
+#include "LlcpSocket.h"
+#include "NfcTagManager.h"
+#include "P2pDevice.h"
+#include "SimulatedField.h"
+#include "NfcDebug.h"
+
+// Environment variable naming the script of the simulated field.
+#define SIM_SCRIPT_ENV "NFCD_SIM_SCRIPT"
+
+NfcManager::NfcManager()
+ : mP2pDevice(NULL)
+ , mField(NULL)
+{
+  mP2pDevice = new P2pDevice();
+  mField = new SimulatedField(this, mP2pDevice);
+}
+
+NfcManager::~NfcManager()
+{
+  delete mField;
+  delete mP2pDevice;
+}
+
+void* NfcManager::queryInterface(const char* name)
+{
+  if (0 == strcmp(name, INTERFACE_P2P_DEVICE))
+    return reinterpret_cast<void*>(mP2pDevice);
+  else if (0 == strcmp(name, INTERFACE_TAG_MANAGER))
+    return reinterpret_cast<void*>(static_cast<INfcTag*>(mField->getActiveTag()));
+
+  return NULL;
+}
+
+bool NfcManager::initialize()
+{
+  const char* path = getenv(SIM_SCRIPT_ENV);
+  if (!path || !mField->loadScript(path)) {
+    ALOGD("%s: using the default script", FUNC);
+    mField->loadDefaultScript();
+  }
+  return true;
+}
+
+bool NfcManager::deinitialize()
+{
+  mField->stop();
+  return true;
+}
+
+void NfcManager::enableDiscovery()
+{
+  mField->start();
+}
+
+void NfcManager::disableDiscovery()
+{
+  mField->stop();
+}
+
+bool NfcManager::checkLlcp()
+{
+  return true;
+}
+
+bool NfcManager::activateLlcp()
+{
+  return true;
+}
+
+ILlcpSocket* NfcManager::createLlcpSocket(int sap, int miu, int rw, int linearBufferLength)
+{
+  ALOGD("%s: sap=%d miu=%d rw=%d", FUNC, sap, miu, rw);
+  LlcpSocket* pLlcpSocket = new LlcpSocket(mField, sap, miu, rw);
+  return static_cast<ILlcpSocket*>(pLlcpSocket);
+}
+
+ILlcpServerSocket* NfcManager::createLlcpServerSocket(int sap, const char* sn, int miu, int rw, int linearBufferLength)
+{
+  ALOGD("%s: sap=%d sn=%s miu=%d rw=%d", FUNC, sap, sn, miu, rw);
+  LlcpServiceSocket* pLlcpServiceSocket = new LlcpServiceSocket(mField, sap, sn, miu, rw);
+
+  if (!mField->registerService(pLlcpServiceSocket)) {
+    ALOGE("%s: register server fail", FUNC);
+    delete pLlcpServiceSocket;
+    return NULL;
+  }
+
+  return static_cast<ILlcpServerSocket*>(pLlcpServiceSocket);
+}
+
+void NfcManager::setP2pInitiatorModes(int modes)
+{
+  // The simulated peer always polls.
+  ALOGD("%s: modes=0x%X", FUNC, modes);
+}
+
+void NfcManager::setP2pTargetModes(int modes)
+{
+  ALOGD("%s: modes=0x%X", FUNC, modes);
+}
@@ -0,0 +1,314 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "NfcTagManager.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "NdefMessage.h"
+#include "NfcDebug.h"
+
+// RF discovery ID of the activated tag.
+#define SIM_TAG_HANDLE 1
+
+// NDEF message with one empty record, written by formatNdef().
+static const uint8_t EMPTY_NDEF[] = { 0xD0, 0x00, 0x00 };
+
+NfcTagManager::NfcTagManager()
+ : mIsPresent(false)
+ , mIsActivated(false)
+ , mMinIntervalMs(0)
+ , mMaxIntervalMs(0)
+ , mConnectedHandle(-1)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+
+  mTag.protocol = 0;
+  mTag.isNdef = false;
+  mTag.maxNdefSize = 0;
+  mTag.isReadOnly = false;
+  mTag.rfLatencyUs = 0;
+}
+
+NfcTagManager::~NfcTagManager()
+{
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mMutex);
+}
+
+void NfcTagManager::activate(const SimulatedTag& tag, uint32_t minIntervalMs, uint32_t maxIntervalMs)
+{
+  pthread_mutex_lock(&mMutex);
+  mTag = tag;
+  mMinIntervalMs = minIntervalMs;
+  mMaxIntervalMs = maxIntervalMs;
+
+  mTechList.clear();
+  mTechHandles.clear();
+  mTechLibNfcTypes.clear();
+  mTechPollBytes.clear();
+  mTechActBytes.clear();
+  mUid.clear();
+
+  switch (tag.protocol) {
+    case SIM_PROTOCOL_T1T:
+    case SIM_PROTOCOL_T2T:
+      addTechnology(NFC_A, SIM_TAG_HANDLE, tag.protocol);
+      break;
+    case SIM_PROTOCOL_T3T:
+      addTechnology(NFC_F, SIM_TAG_HANDLE, tag.protocol);
+      break;
+    case SIM_PROTOCOL_ISO_DEP:
+      addTechnology(NFC_ISO_DEP, SIM_TAG_HANDLE, tag.protocol);
+      addTechnology(NFC_A, SIM_TAG_HANDLE, tag.protocol);
+      break;
+    case SIM_PROTOCOL_ISO15693:
+      addTechnology(NFC_V, SIM_TAG_HANDLE, tag.protocol);
+      break;
+    default:
+      addTechnology(UNKNOWN_TECH, SIM_TAG_HANDLE, tag.protocol);
+      break;
+  }
+
+  mConnectedHandle = SIM_TAG_HANDLE;
+  mIsPresent = true;
+  mIsActivated = true;
+  pthread_mutex_unlock(&mMutex);
+}
+
+void NfcTagManager::remove()
+{
+  pthread_mutex_lock(&mMutex);
+  mIsPresent = false;
+  pthread_mutex_unlock(&mMutex);
+}
+
+bool NfcTagManager::waitForDeactivation(uint32_t timeoutMs)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeoutMs / 1000;
+  deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  while (mIsActivated) {
+    if (pthread_cond_timedwait(&mCond, &mMutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  bool isDeactivated = !mIsActivated;
+  pthread_mutex_unlock(&mMutex);
+  return isDeactivated;
+}
+
+bool NfcTagManager::isActivated()
+{
+  pthread_mutex_lock(&mMutex);
+  bool isActivated = mIsActivated;
+  pthread_mutex_unlock(&mMutex);
+  return isActivated;
+}
+
+void NfcTagManager::addTechnology(TagTechnology tech, int handle, int libnfctype)
+{
+  for (size_t i = 0; i < mTechList.size(); i++) {
+    if (mTechList[i] == tech) {
+      return;
+    }
+  }
+
+  mTechList.push_back(tech);
+  mTechHandles.push_back(handle);
+  mTechLibNfcTypes.push_back(libnfctype);
+  mTechPollBytes.push_back(std::vector<uint8_t>());
+  mTechActBytes.push_back(std::vector<uint8_t>());
+  mUid.push_back(mTag.uid);
+}
+
+bool NfcTagManager::doRfExchange()
+{
+  pthread_mutex_lock(&mMutex);
+  uint32_t latencyUs = mTag.rfLatencyUs;
+  bool isActivated = mIsActivated;
+  pthread_mutex_unlock(&mMutex);
+
+  if (!isActivated) {
+    return false;
+  }
+
+  if (latencyUs) {
+    usleep(latencyUs);
+  }
+
+  pthread_mutex_lock(&mMutex);
+  bool isPresent = mIsPresent && mIsActivated;
+  pthread_mutex_unlock(&mMutex);
+  return isPresent;
+}
+
+bool NfcTagManager::connect(int technology)
+{
+  pthread_mutex_lock(&mMutex);
+  int handle = -1;
+  for (size_t i = 0; i < mTechList.size(); i++) {
+    if (mTechList[i] == technology) {
+      handle = mTechHandles[i];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mMutex);
+
+  if (handle < 0) {
+    ALOGE("%s: tech %d not supported", FUNC, technology);
+    return false;
+  }
+
+  if (!doRfExchange()) {
+    return false;
+  }
+  mConnectedHandle = handle;
+  return true;
+}
+
+bool NfcTagManager::disconnect()
+{
+  pthread_mutex_lock(&mMutex);
+  mIsPresent = false;
+  mIsActivated = false;
+  mConnectedHandle = -1;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+  return true;
+}
+
+bool NfcTagManager::reconnect()
+{
+  return doRfExchange();
+}
+
+NdefMessage* NfcTagManager::readNdef()
+{
+  // Check NDEF.
+  if (!doRfExchange()) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  if (!mTag.isNdef) {
+    if (!mTag.isReadOnly) {
+      addTechnology(NDEF_FORMATABLE, SIM_TAG_HANDLE, mTag.protocol);
+    }
+    pthread_mutex_unlock(&mMutex);
+    return NULL;
+  }
+  pthread_mutex_unlock(&mMutex);
+
+  // Read NDEF.
+  if (!doRfExchange()) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  NdefMessage* ndefMsg = new NdefMessage();
+  if (!ndefMsg->init(mTag.ndef)) {
+    ALOGE("%s: scripted NDEF cannot be parsed", FUNC);
+    delete ndefMsg;
+    ndefMsg = NULL;
+  }
+
+  addTechnology(NDEF, SIM_TAG_HANDLE, mTag.protocol);
+  if (!mTag.isReadOnly) {
+    addTechnology(NDEF_WRITABLE, SIM_TAG_HANDLE, mTag.protocol);
+  }
+  pthread_mutex_unlock(&mMutex);
+  return ndefMsg;
+}
+
+NdefDetail* NfcTagManager::readNdefDetail()
+{
+  if (!doRfExchange()) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  NdefDetail* pNdefDetail = NULL;
+  if (mTag.isNdef) {
+    pNdefDetail = new NdefDetail();
+    pNdefDetail->maxSupportedLength = mTag.maxNdefSize;
+    pNdefDetail->isReadOnly = mTag.isReadOnly;
+    pNdefDetail->canBeMadeReadOnly = mTag.protocol == SIM_PROTOCOL_T1T ||
+                                     mTag.protocol == SIM_PROTOCOL_T2T;
+  }
+  pthread_mutex_unlock(&mMutex);
+  return pNdefDetail;
+}
+
+bool NfcTagManager::writeNdef(NdefMessage& ndef)
+{
+  std::vector<uint8_t> buf;
+  ndef.toByteArray(buf);
+
+  if (!doRfExchange()) {
+    return false;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  bool result = mTag.isNdef && !mTag.isReadOnly && buf.size() <= mTag.maxNdefSize;
+  if (result) {
+    mTag.ndef = buf;
+  }
+  pthread_mutex_unlock(&mMutex);
+  return result;
+}
+
+bool NfcTagManager::presenceCheck()
+{
+  return doRfExchange();
+}
+
+void NfcTagManager::getPresenceCheckIntervals(uint32_t& minIntervalMs, uint32_t& maxIntervalMs)
+{
+  pthread_mutex_lock(&mMutex);
+  minIntervalMs = mMinIntervalMs;
+  maxIntervalMs = mMaxIntervalMs;
+  pthread_mutex_unlock(&mMutex);
+}
+
+bool NfcTagManager::makeReadOnly()
+{
+  if (!doRfExchange()) {
+    return false;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  bool result = mTag.isNdef;
+  if (result) {
+    mTag.isReadOnly = true;
+  }
+  pthread_mutex_unlock(&mMutex);
+  return result;
+}
+
+bool NfcTagManager::formatNdef()
+{
+  if (!doRfExchange()) {
+    return false;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  bool result = !mTag.isNdef && !mTag.isReadOnly;
+  if (result) {
+    mTag.isNdef = true;
+    mTag.ndef.assign(EMPTY_NDEF, EMPTY_NDEF + sizeof(EMPTY_NDEF));
+  }
+  pthread_mutex_unlock(&mMutex);
+  return result;
+}
@@ -0,0 +1,95 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcTagManager_h
+#define mozilla_nfcd_NfcTagManager_h
+
+#include <pthread.h>
+#include <vector>
+
+#include "INfcTag.h"
+#include "SimulatedTag.h"
+
+/**
+ * INfcTag for a tag in the simulated RF field. Every RF operation takes the
+ * scripted RF latency and fails once the tag has left the field.
+ */
+class NfcTagManager
+  : public INfcTag
+{
+public:
+  NfcTagManager();
+  virtual ~NfcTagManager();
+
+  // INfcTag interface.
+  bool connect(int technology);
+  bool disconnect();
+  bool reconnect();
+  NdefMessage* readNdef();
+  NdefDetail* readNdefDetail();
+  bool writeNdef(NdefMessage& ndef);
+  bool presenceCheck();
+  bool makeReadOnly();
+  bool formatNdef();
+  void getPresenceCheckIntervals(uint32_t& minIntervalMs, uint32_t& maxIntervalMs);
+
+  std::vector<TagTechnology>& getTechList() { return mTechList; };
+  std::vector<int>& getTechHandles() { return mTechHandles; };
+  std::vector<int>& getTechLibNfcTypes() { return mTechLibNfcTypes; };
+  std::vector<std::vector<uint8_t> >& getTechPollBytes() { return mTechPollBytes; };
+  std::vector<std::vector<uint8_t> >& getTechActBytes() { return mTechActBytes; };
+  std::vector<std::vector<uint8_t> >& getUid() { return mUid; };
+  int& getConnectedHandle() { return mConnectedHandle; };
+
+  /**
+   * Bring a tag into the field and activate it. Must not be called before
+   * the previous tag was deactivated.
+   *
+   * @param  tag             Scripted tag.
+   * @param  minIntervalMs   Presence-check interval right after activation, 0 for the default.
+   * @param  maxIntervalMs   Presence-check interval while the tag stays, 0 for the default.
+   * @return                 None.
+   */
+  void activate(const SimulatedTag& tag, uint32_t minIntervalMs, uint32_t maxIntervalMs);
+
+  /**
+   * Take the tag out of the field. The next RF operation fails.
+   *
+   * @return None.
+   */
+  void remove();
+
+  /**
+   * Wait until nfcd has disconnected the tag.
+   *
+   * @param  timeoutMs Maximum time to wait.
+   * @return           True if the tag is deactivated.
+   */
+  bool waitForDeactivation(uint32_t timeoutMs);
+
+  bool isActivated();
+
+private:
+  bool doRfExchange();
+  void addTechnology(TagTechnology tech, int handle, int libnfctype);
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+
+  SimulatedTag mTag;
+  bool mIsPresent;
+  bool mIsActivated;
+  uint32_t mMinIntervalMs;
+  uint32_t mMaxIntervalMs;
+
+  std::vector<TagTechnology> mTechList;
+  std::vector<int> mTechHandles;
+  std::vector<int> mTechLibNfcTypes;
+  std::vector<std::vector<uint8_t> > mTechPollBytes;
+  std::vector<std::vector<uint8_t> > mTechActBytes;
+  std::vector<std::vector<uint8_t> > mUid;
+  int mConnectedHandle;
+};
+
+#endif // mozilla_nfcd_NfcTagManager_h
@@ -0,0 +1,35 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_P2pDevice_h
+#define mozilla_nfcd_P2pDevice_h
+
+#include "IP2pDevice.h"
+
+/**
+ * The simulated peer. It always polls, so the local side is the target of
+ * an NFC-DEP link that is already connected when LLCP comes up.
+ */
+class P2pDevice
+  : public IP2pDevice
+{
+public:
+  P2pDevice();
+  virtual ~P2pDevice();
+
+  bool connect();
+  bool disconnect();
+  void transceive();
+  void receive();
+  bool send();
+
+  int& getHandle();
+  int& getMode();
+
+private:
+  int mHandle;
+  int mMode;
+};
+
+#endif // mozilla_nfcd_P2pDevice_h
@@ -0,0 +1,532 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "SimulatedField.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DeviceHost.h"
+#include "LlcpServiceSocket.h"
+#include "LlcpSocket.h"
+#include "NdefMessage.h"
+#include "NfcTagManager.h"
+#include "NfcUtil.h"
+#include "P2pDevice.h"
+#include "SimulatedLink.h"
+#include "SnepMessage.h"
+#include "SnepMessenger.h"
+#include "TapLatencyTracker.h"
+#include "NfcDebug.h"
+
+#define SIM_DEFAULT_DWELL_MS            100
+#define SIM_DEFAULT_REMOVAL_TIMEOUT_MS  1000
+
+// The simulated peer's LLCP parameters.
+#define SIM_PEER_MIU  248
+#define SIM_PEER_RW   2
+
+// NFC Forum default SNEP server.
+#define SNEP_SAP  4
+#define SNEP_SN   "urn:nfc:sn:snep"
+
+// A URI record for "https://www.mozilla.org".
+static const char* DEFAULT_SCRIPT_NDEF = "d1010c55026d6f7a696c6c612e6f7267";
+static const char* DEFAULT_SCRIPT_UID = "04a2241a2b3c80";
+
+SimulatedField::SimulatedField(DeviceHost* host, P2pDevice* p2pDevice)
+ : mHost(host)
+ , mP2pDevice(p2pDevice)
+ , mHasThread(false)
+ , mIsRunning(false)
+ , mRepeatCount(1)
+ , mMinIntervalMs(0)
+ , mMaxIntervalMs(0)
+ , mRemovalTimeoutMs(SIM_DEFAULT_REMOVAL_TIMEOUT_MS)
+ , mNextTag(0)
+ , mActiveTag(NULL)
+ , mIsLinkUp(false)
+ , mLinkLatencyUs(0)
+ , mTapCount(0)
+ , mPushCount(0)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+
+  mTags.push_back(new NfcTagManager());
+  mActiveTag = mTags[0];
+}
+
+SimulatedField::~SimulatedField()
+{
+  stop();
+  for (size_t i = 0; i < mTags.size(); i++) {
+    delete mTags[i];
+  }
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mMutex);
+}
+
+/**
+ * Script.
+ */
+bool SimulatedField::parseHex(const char* str, std::vector<uint8_t>& buf)
+{
+  buf.clear();
+  if (!strcmp(str, "-")) {
+    return true;
+  }
+
+  size_t length = strlen(str);
+  if (length % 2) {
+    return false;
+  }
+
+  for (size_t i = 0; i < length; i += 2) {
+    char byte[3] = { str[i], str[i + 1], '\0' };
+    char* end;
+    unsigned long value = strtoul(byte, &end, 16);
+    if (*end != '\0') {
+      return false;
+    }
+    buf.push_back((uint8_t)value);
+  }
+  return true;
+}
+
+int SimulatedField::parseProtocol(const char* str)
+{
+  if (!strcmp(str, "t1t")) return SIM_PROTOCOL_T1T;
+  if (!strcmp(str, "t2t")) return SIM_PROTOCOL_T2T;
+  if (!strcmp(str, "t3t")) return SIM_PROTOCOL_T3T;
+  if (!strcmp(str, "iso-dep")) return SIM_PROTOCOL_ISO_DEP;
+  if (!strcmp(str, "iso15693")) return SIM_PROTOCOL_ISO15693;
+  return -1;
+}
+
+bool SimulatedField::parseLine(char* line, std::vector<Step>& steps)
+{
+  char* comment = strchr(line, '#');
+  if (comment) {
+    *comment = '\0';
+  }
+
+  const char* argv[8];
+  int argc = 0;
+  char* save = NULL;
+  for (char* token = strtok_r(line, " \t\r\n", &save);
+       token && argc < 8;
+       token = strtok_r(NULL, " \t\r\n", &save)) {
+    argv[argc++] = token;
+  }
+
+  if (argc == 0) {
+    return true;
+  }
+
+  Step step;
+  step.dwellMs = SIM_DEFAULT_DWELL_MS;
+  step.latencyUs = 0;
+
+  if (!strcmp(argv[0], "tag") && argc >= 4) {
+    step.type = STEP_TAG;
+    step.tag.protocol = parseProtocol(argv[1]);
+    if (step.tag.protocol < 0 ||
+        !parseHex(argv[2], step.tag.uid) ||
+        !parseHex(argv[3], step.tag.ndef)) {
+      return false;
+    }
+    step.tag.isNdef = strcmp(argv[3], "-") != 0;
+    step.tag.isReadOnly = false;
+    if (argc > 4) step.dwellMs = atoi(argv[4]);
+    if (argc > 5) step.latencyUs = atoi(argv[5]);
+    if (argc > 6) step.tag.isReadOnly = !strcmp(argv[6], "ro");
+    step.tag.rfLatencyUs = step.latencyUs;
+    // Leave room to write a message a bit larger than the scripted one.
+    step.tag.maxNdefSize = step.tag.ndef.size() + 256;
+    steps.push_back(step);
+  } else if (!strcmp(argv[0], "peer") && argc >= 2) {
+    step.type = STEP_PEER;
+    if (!parseHex(argv[1], step.ndef)) {
+      return false;
+    }
+    if (argc > 2) step.dwellMs = atoi(argv[2]);
+    if (argc > 3) step.latencyUs = atoi(argv[3]);
+    steps.push_back(step);
+  } else if (!strcmp(argv[0], "wait") && argc == 2) {
+    step.type = STEP_WAIT;
+    step.dwellMs = atoi(argv[1]);
+    steps.push_back(step);
+  } else if (!strcmp(argv[0], "repeat") && argc == 2) {
+    mRepeatCount = atoi(argv[1]);
+  } else if (!strcmp(argv[0], "presence") && argc == 3) {
+    mMinIntervalMs = atoi(argv[1]);
+    mMaxIntervalMs = atoi(argv[2]);
+  } else if (!strcmp(argv[0], "overlap") && argc == 2) {
+    int overlap = atoi(argv[1]);
+    // Tags already handed out to nfcd are kept.
+    while ((int)mTags.size() < overlap) {
+      mTags.push_back(new NfcTagManager());
+    }
+  } else if (!strcmp(argv[0], "removal-timeout") && argc == 2) {
+    mRemovalTimeoutMs = atoi(argv[1]);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SimulatedField::loadScript(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    ALOGE("%s: cannot open %s: %s", FUNC, path, strerror(errno));
+    return false;
+  }
+
+  std::vector<Step> steps;
+  char line[4096];
+  int lineNumber = 0;
+  bool result = true;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    if (!parseLine(line, steps)) {
+      ALOGE("%s: %s:%d: invalid command", FUNC, path, lineNumber);
+      result = false;
+      break;
+    }
+  }
+  fclose(file);
+
+  if (result) {
+    mSteps.swap(steps);
+    ALOGD("%s: %u steps from %s, repeat=%u overlap=%u", FUNC, (unsigned)mSteps.size(),
+          path, mRepeatCount, (unsigned)mTags.size());
+  }
+  return result;
+}
+
+void SimulatedField::loadDefaultScript()
+{
+  char line[128];
+  snprintf(line, sizeof(line), "tag t2t %s %s", DEFAULT_SCRIPT_UID, DEFAULT_SCRIPT_NDEF);
+
+  std::vector<Step> steps;
+  parseLine(line, steps);
+  mSteps.swap(steps);
+  mRepeatCount = 1;
+}
+
+/**
+ * Field thread.
+ */
+void SimulatedField::start()
+{
+  pthread_mutex_lock(&mMutex);
+  if (mIsRunning) {
+    pthread_mutex_unlock(&mMutex);
+    return;
+  }
+  mIsRunning = true;
+  pthread_mutex_unlock(&mMutex);
+
+  if (mHasThread) {
+    pthread_join(mThread, NULL);
+    mHasThread = false;
+  }
+
+  if (pthread_create(&mThread, NULL, threadFunc, this) != 0) {
+    ALOGE("%s: pthread_create failed", FUNC);
+    mIsRunning = false;
+    return;
+  }
+  mHasThread = true;
+}
+
+void SimulatedField::stop()
+{
+  pthread_mutex_lock(&mMutex);
+  mIsRunning = false;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+
+  // Unblock a push in progress.
+  closeLinks();
+
+  if (mHasThread) {
+    pthread_join(mThread, NULL);
+    mHasThread = false;
+  }
+}
+
+void* SimulatedField::threadFunc(void* arg)
+{
+  pthread_setname_np(pthread_self(), "NFC field");
+  SimulatedField* field = reinterpret_cast<SimulatedField*>(arg);
+  field->run();
+  return NULL;
+}
+
+bool SimulatedField::sleepMs(uint32_t ms)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ms / 1000;
+  deadline.tv_nsec += (ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  while (mIsRunning) {
+    if (pthread_cond_timedwait(&mCond, &mMutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  bool isRunning = mIsRunning;
+  pthread_mutex_unlock(&mMutex);
+  return isRunning;
+}
+
+void SimulatedField::run()
+{
+  ALOGD("%s: playing %u steps", FUNC, (unsigned)mSteps.size());
+
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
+  mTapCount = 0;
+  mPushCount = 0;
+
+  bool isRunning = true;
+  for (uint32_t round = 0; isRunning && (mRepeatCount == 0 || round < mRepeatCount); round++) {
+    for (size_t i = 0; isRunning && i < mSteps.size(); i++) {
+      const Step& step = mSteps[i];
+      switch (step.type) {
+        case STEP_TAG:
+          isRunning = runTag(step);
+          break;
+        case STEP_PEER:
+          isRunning = runPeer(step);
+          break;
+        case STEP_WAIT:
+          isRunning = sleepMs(step.dwellMs);
+          break;
+      }
+    }
+  }
+
+  uint64_t elapsed = NfcUtil::getMonotonicTimeUs() - start;
+  ALOGD("%s: done, %u taps and %u pushes in %llu us", FUNC, mTapCount, mPushCount,
+        (unsigned long long)elapsed);
+}
+
+bool SimulatedField::runTag(const Step& step)
+{
+  NfcTagManager* tag = mTags[mNextTag];
+  mNextTag = (mNextTag + 1) % mTags.size();
+
+  // The NFCC only discovers a new tag once the last one using this INfcTag
+  // has been deactivated.
+  if (tag->isActivated() && !tag->waitForDeactivation(mRemovalTimeoutMs)) {
+    ALOGE("%s: tag not deactivated after %u ms", FUNC, mRemovalTimeoutMs);
+  }
+
+  TapLatencyTracker::Instance()->onActivated();
+  tag->activate(step.tag, mMinIntervalMs, mMaxIntervalMs);
+  pthread_mutex_lock(&mMutex);
+  mActiveTag = tag;
+  pthread_mutex_unlock(&mMutex);
+
+  mHost->notifyTagDiscovered(tag);
+  mTapCount++;
+
+  bool isRunning = sleepMs(step.dwellMs);
+  tag->remove();
+  return isRunning;
+}
+
+bool SimulatedField::runPeer(const Step& step)
+{
+  pthread_mutex_lock(&mMutex);
+  mIsLinkUp = true;
+  mLinkLatencyUs = step.latencyUs;
+  pthread_mutex_unlock(&mMutex);
+
+  mHost->notifyLlcpLinkActivated(mP2pDevice);
+
+  if (!step.ndef.empty()) {
+    pushToLocal(step.ndef);
+  }
+
+  bool isRunning = sleepMs(step.dwellMs);
+
+  closeLinks();
+  mHost->notifyLlcpLinkDeactivated(mP2pDevice);
+  return isRunning;
+}
+
+void SimulatedField::pushToLocal(const std::vector<uint8_t>& ndefBytes)
+{
+  NdefMessage ndef;
+  if (!ndef.init(&ndefBytes[0], ndefBytes.size())) {
+    ALOGE("%s: scripted NDEF cannot be parsed", FUNC);
+    return;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  LlcpServiceSocket* server = mIsLinkUp ? findServiceLocked(SNEP_SAP, SNEP_SN) : NULL;
+  if (!server) {
+    pthread_mutex_unlock(&mMutex);
+    ALOGE("%s: no local SNEP server", FUNC);
+    return;
+  }
+
+  // One reference each for the peer socket, the accepting side and mLinks.
+  SimulatedLink* link = new SimulatedLink(server->getLocalMiu(), server->getLocalRw(),
+                                          SIM_PEER_MIU, SIM_PEER_RW, mLinkLatencyUs);
+  link->acquire();
+  if (!server->offer(link)) {
+    link->release();
+    link->release();
+    pthread_mutex_unlock(&mMutex);
+    ALOGE("%s: local SNEP server is closed", FUNC);
+    return;
+  }
+  link->acquire();
+  mLinks.push_back(link);
+  pthread_mutex_unlock(&mMutex);
+
+  LlcpSocket socket(link, SimulatedLink::SIDE_PEER, 0);
+  SnepMessenger messenger(true, &socket, SIM_PEER_MIU);
+
+  SnepMessage* request = SnepMessage::getPutRequest(ndef);
+  messenger.sendMessage(*request);
+  delete request;
+
+  SnepMessage* response = messenger.getMessage();
+  if (!response || response->getField() != SnepMessage::RESPONSE_SUCCESS) {
+    ALOGE("%s: push failed (%d)", FUNC, response ? response->getField() : -1);
+  } else {
+    mPushCount++;
+  }
+  delete response;
+}
+
+void SimulatedField::closeLinks()
+{
+  pthread_mutex_lock(&mMutex);
+  mIsLinkUp = false;
+  while (!mLinks.empty()) {
+    SimulatedLink* link = mLinks.front();
+    mLinks.pop_front();
+    link->close();
+    link->release();
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+NfcTagManager* SimulatedField::getActiveTag()
+{
+  pthread_mutex_lock(&mMutex);
+  NfcTagManager* tag = mActiveTag;
+  pthread_mutex_unlock(&mMutex);
+  return tag;
+}
+
+/**
+ * LLCP.
+ */
+LlcpServiceSocket* SimulatedField::findServiceLocked(int sap, const char* sn)
+{
+  for (std::list<LlcpServiceSocket*>::iterator it = mServices.begin(); it != mServices.end(); it++) {
+    if ((sap && (*it)->getSap() == sap) ||
+        (sn && (*it)->getServiceName() == sn)) {
+      return *it;
+    }
+  }
+  return NULL;
+}
+
+bool SimulatedField::registerService(LlcpServiceSocket* socket)
+{
+  pthread_mutex_lock(&mMutex);
+  const char* sn = socket->getServiceName().empty() ? NULL : socket->getServiceName().c_str();
+  if (findServiceLocked(socket->getSap(), sn)) {
+    pthread_mutex_unlock(&mMutex);
+    ALOGE("%s: sap %d / %s already in use", FUNC, socket->getSap(), sn ? sn : "");
+    return false;
+  }
+  mServices.push_back(socket);
+  pthread_mutex_unlock(&mMutex);
+  return true;
+}
+
+void SimulatedField::unregisterService(LlcpServiceSocket* socket)
+{
+  pthread_mutex_lock(&mMutex);
+  mServices.remove(socket);
+  pthread_mutex_unlock(&mMutex);
+}
+
+SimulatedLink* SimulatedField::connect(int sap, const char* sn, int miu, int rw)
+{
+  // The peer only runs the default SNEP server.
+  bool isSnep = sn ? !strcmp(sn, SNEP_SN) : sap == SNEP_SAP;
+  if (!isSnep) {
+    ALOGE("%s: peer has no service at sap %d / %s", FUNC, sap, sn ? sn : "");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mMutex);
+  if (!mIsLinkUp) {
+    pthread_mutex_unlock(&mMutex);
+    ALOGE("%s: LLCP link is down", FUNC);
+    return NULL;
+  }
+
+  // One reference each for the caller, the peer server and mLinks.
+  SimulatedLink* link = new SimulatedLink(miu, rw, SIM_PEER_MIU, SIM_PEER_RW, mLinkLatencyUs);
+  link->acquire();
+  link->acquire();
+  mLinks.push_back(link);
+  pthread_mutex_unlock(&mMutex);
+
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, peerServerThreadFunc, link) != 0) {
+    ALOGE("%s: pthread_create failed", FUNC);
+    link->close();
+    link->release();
+    link->release();
+    return NULL;
+  }
+  pthread_detach(tid);
+  return link;
+}
+
+void* SimulatedField::peerServerThreadFunc(void* arg)
+{
+  pthread_setname_np(pthread_self(), "NFC peer");
+  SimulatedLink* link = reinterpret_cast<SimulatedLink*>(arg);
+
+  LlcpSocket socket(link, SimulatedLink::SIDE_PEER, SNEP_SAP);
+  SnepMessenger messenger(false, &socket, SIM_PEER_MIU);
+
+  // Answer requests until the link goes down.
+  SnepMessage* request;
+  while ((request = messenger.getMessage()) != NULL) {
+    uint8_t field = SnepMessage::RESPONSE_NOT_IMPLEMENTED;
+    if (request->getField() == SnepMessage::REQUEST_PUT) {
+      field = SnepMessage::RESPONSE_SUCCESS;
+    }
+    delete request;
+
+    SnepMessage* response = SnepMessage::getMessage(field);
+    messenger.sendMessage(*response);
+    delete response;
+  }
+  return NULL;
+}
@@ -0,0 +1,173 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_SimulatedField_h
+#define mozilla_nfcd_SimulatedField_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <list>
+#include <vector>
+
+#include "SimulatedTag.h"
+
+class DeviceHost;
+class LlcpServiceSocket;
+class NfcTagManager;
+class P2pDevice;
+class SimulatedLink;
+
+/**
+ * In-process RF field that plays a script of tag taps and LLCP peers while
+ * discovery is enabled.
+ *
+ * A script is a text file, one command per line; '#' starts a comment.
+ *
+ *   tag <t1t|t2t|t3t|iso-dep|iso15693> <uid> <ndef|-> [dwell-ms] [rf-latency-us] [ro]
+ *       A tag enters the field, stays dwell-ms (default 100) and leaves.
+ *       <uid> and <ndef> are hex; '-' is a blank, formattable tag.
+ *   peer <ndef|-> [dwell-ms] [rf-latency-us]
+ *       A peer brings up LLCP and, unless <ndef> is '-', pushes it to the
+ *       local SNEP server. It offers a SNEP server of its own.
+ *   wait <ms>
+ *       The field stays empty.
+ *   repeat <count>
+ *       Play the script count times, 0 loops until discovery is disabled.
+ *   presence <min-ms> <max-ms>
+ *       Presence-check intervals reported by the tags.
+ *   overlap <count>
+ *       Number of tags that may still be in use by nfcd when the next one
+ *       arrives (default 1). Above 1, taps are not held back by tag removal
+ *       detection and can follow each other at the scripted rate.
+ *   removal-timeout <ms>
+ *       Maximum wait for nfcd to deactivate a removed tag before its
+ *       INfcTag is reused (default 1000).
+ */
+class SimulatedField {
+public:
+  SimulatedField(DeviceHost* host, P2pDevice* p2pDevice);
+  ~SimulatedField();
+
+  /**
+   * Load a script, replacing the current one.
+   *
+   * @param  path Script file.
+   * @return      True if every line parsed.
+   */
+  bool loadScript(const char* path);
+
+  /**
+   * Load the built-in script: one NDEF tag tap.
+   *
+   * @return None.
+   */
+  void loadDefaultScript();
+
+  /**
+   * Start playing the script. Called when discovery is enabled.
+   *
+   * @return None.
+   */
+  void start();
+
+  /**
+   * Stop playing the script and clear the field.
+   *
+   * @return None.
+   */
+  void stop();
+
+  /**
+   * @return The tag that entered the field last.
+   */
+  NfcTagManager* getActiveTag();
+
+  /**
+   * Make a local LLCP service reachable by the simulated peer.
+   *
+   * @param  socket Server socket.
+   * @return        False if its SAP or service name is already in use.
+   */
+  bool registerService(LlcpServiceSocket* socket);
+
+  void unregisterService(LlcpServiceSocket* socket);
+
+  /**
+   * Connect a local socket to a service of the simulated peer.
+   *
+   * @param  sap Remote SAP, used when sn is NULL.
+   * @param  sn  Remote service name.
+   * @param  miu Local MIU.
+   * @param  rw  Local receive window.
+   * @return     Link owning one reference for the caller, or NULL.
+   */
+  SimulatedLink* connect(int sap, const char* sn, int miu, int rw);
+
+private:
+  enum StepType {
+    STEP_TAG,
+    STEP_PEER,
+    STEP_WAIT,
+  };
+
+  struct Step {
+    StepType type;
+    SimulatedTag tag;               // STEP_TAG.
+    std::vector<uint8_t> ndef;      // STEP_PEER; empty pushes nothing.
+    uint32_t dwellMs;
+    uint32_t latencyUs;
+  };
+
+  static void* threadFunc(void* arg);
+  static void* peerServerThreadFunc(void* arg);
+  void run();
+
+  bool runTag(const Step& step);
+  bool runPeer(const Step& step);
+  void pushToLocal(const std::vector<uint8_t>& ndef);
+  void closeLinks();
+
+  /**
+   * @return False if the field was stopped before ms elapsed.
+   */
+  bool sleepMs(uint32_t ms);
+
+  bool parseLine(char* line, std::vector<Step>& steps);
+  static bool parseHex(const char* str, std::vector<uint8_t>& buf);
+  static int parseProtocol(const char* str);
+
+  LlcpServiceSocket* findServiceLocked(int sap, const char* sn);
+
+  DeviceHost* mHost;
+  P2pDevice* mP2pDevice;
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  pthread_t mThread;
+  bool mHasThread;
+  bool mIsRunning;
+
+  // Script.
+  std::vector<Step> mSteps;
+  uint32_t mRepeatCount;
+  uint32_t mMinIntervalMs;
+  uint32_t mMaxIntervalMs;
+  uint32_t mRemovalTimeoutMs;
+
+  // Tags handed out in turn, so that up to "overlap" of them can be in use.
+  std::vector<NfcTagManager*> mTags;
+  uint32_t mNextTag;
+  NfcTagManager* mActiveTag;
+
+  // LLCP.
+  bool mIsLinkUp;
+  uint32_t mLinkLatencyUs;
+  std::list<LlcpServiceSocket*> mServices;
+  std::list<SimulatedLink*> mLinks;  // Open while the link is up.
+
+  uint32_t mTapCount;
+  uint32_t mPushCount;
+};
+
+#endif // mozilla_nfcd_SimulatedField_h
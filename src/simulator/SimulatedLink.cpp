@@ -0,0 +1,165 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "SimulatedLink.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "NfcCounters.h"
+#include "NfcDebug.h"
+
+SimulatedLink::SimulatedLink(int localMiu, int localRw, int peerMiu, int peerRw, uint32_t latencyUs)
+ : mIsClosed(false)
+ , mRefCount(1)
+ , mLatencyUs(latencyUs)
+{
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
+
+  mMiu[SIDE_LOCAL] = localMiu;
+  mRw[SIDE_LOCAL] = localRw > 0 ? localRw : 1;
+  mMiu[SIDE_PEER] = peerMiu;
+  mRw[SIDE_PEER] = peerRw > 0 ? peerRw : 1;
+  mIsCancelled[SIDE_LOCAL] = false;
+  mIsCancelled[SIDE_PEER] = false;
+}
+
+SimulatedLink::~SimulatedLink()
+{
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mMutex);
+}
+
+void SimulatedLink::acquire()
+{
+  __sync_fetch_and_add(&mRefCount, 1);
+}
+
+void SimulatedLink::release()
+{
+  if (__sync_sub_and_fetch(&mRefCount, 1) == 0) {
+    delete this;
+  }
+}
+
+static void getDeadline(int timeoutMs, struct timespec* deadline)
+{
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += timeoutMs / 1000;
+  deadline->tv_nsec += (timeoutMs % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+bool SimulatedLink::waitLocked(const struct timespec* deadline)
+{
+  if (!deadline) {
+    pthread_cond_wait(&mCond, &mMutex);
+    return true;
+  }
+  return pthread_cond_timedwait(&mCond, &mMutex, deadline) != ETIMEDOUT;
+}
+
+bool SimulatedLink::send(int side, const uint8_t* data, size_t length, int timeoutMs)
+{
+  int other = 1 - side;
+  if (length > (size_t)mMiu[other]) {
+    ALOGE("%s: %u bytes exceed the remote MIU %d", FUNC, (unsigned)length, mMiu[other]);
+    return false;
+  }
+
+  struct timespec deadline;
+  if (timeoutMs > 0) {
+    getDeadline(timeoutMs, &deadline);
+  }
+
+  // Time on air for the I-PDU.
+  if (mLatencyUs) {
+    usleep(mLatencyUs);
+  }
+
+  pthread_mutex_lock(&mMutex);
+  // Only nfcd's own side is counted, not the simulated peer.
+  if (side == SIDE_LOCAL && mQueue[other].size() >= (size_t)mRw[other]) {
+    NfcCounters::increment(NFC_STATS_LLCP_CONGESTION_WAITS);
+  }
+  while (!mIsClosed && !mIsCancelled[side] && mQueue[other].size() >= (size_t)mRw[other]) {
+    if (!waitLocked(timeoutMs > 0 ? &deadline : NULL)) {
+      ALOGE("%s: timed out after %d ms", FUNC, timeoutMs);
+      if (side == SIDE_LOCAL) {
+        NfcCounters::increment(NFC_STATS_LLCP_TIMEOUTS);
+      }
+      pthread_mutex_unlock(&mMutex);
+      return false;
+    }
+  }
+
+  if (mIsClosed || mIsCancelled[side]) {
+    pthread_mutex_unlock(&mMutex);
+    return false;
+  }
+
+  mQueue[other].push_back(std::vector<uint8_t>(data, data + length));
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+  return true;
+}
+
+int SimulatedLink::receive(int side, uint8_t* buffer, size_t length, int timeoutMs)
+{
+  struct timespec deadline;
+  if (timeoutMs > 0) {
+    getDeadline(timeoutMs, &deadline);
+  }
+
+  pthread_mutex_lock(&mMutex);
+  while (!mIsClosed && !mIsCancelled[side] && mQueue[side].empty()) {
+    if (!waitLocked(timeoutMs > 0 ? &deadline : NULL)) {
+      ALOGE("%s: timed out after %d ms", FUNC, timeoutMs);
+      if (side == SIDE_LOCAL) {
+        NfcCounters::increment(NFC_STATS_LLCP_TIMEOUTS);
+      }
+      pthread_mutex_unlock(&mMutex);
+      return -1;
+    }
+  }
+
+  if (mIsCancelled[side] || mQueue[side].empty()) {
+    pthread_mutex_unlock(&mMutex);
+    return -1;
+  }
+
+  std::vector<uint8_t>& pdu = mQueue[side].front();
+  size_t received = pdu.size() < length ? pdu.size() : length;
+  if (received) {
+    memcpy(buffer, &pdu[0], received);
+  }
+  mQueue[side].pop_front();
+
+  // Reopen the receive window.
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+  return received;
+}
+
+void SimulatedLink::close()
+{
+  pthread_mutex_lock(&mMutex);
+  mIsClosed = true;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+}
+
+void SimulatedLink::cancel(int side)
+{
+  pthread_mutex_lock(&mMutex);
+  mIsCancelled[side] = true;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
+}
@@ -0,0 +1,88 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_SimulatedLink_h
+#define mozilla_nfcd_SimulatedLink_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+/**
+ * One simulated LLCP data link connection between a local socket (side 0)
+ * and the simulated peer (side 1).
+ *
+ * Each side sends I-PDUs of at most the other side's MIU, and blocks while
+ * the other side has RW PDUs queued, like NFA does on congestion. The link
+ * is reference counted; each socket wrapping a side holds one reference.
+ */
+class SimulatedLink {
+public:
+  static const int SIDE_LOCAL = 0;
+  static const int SIDE_PEER = 1;
+
+  SimulatedLink(int localMiu, int localRw, int peerMiu, int peerRw, uint32_t latencyUs);
+
+  void acquire();
+  void release();
+
+  /**
+   * Queue one I-PDU for the other side.
+   *
+   * @param  side      Sending side.
+   * @param  data      Data to send.
+   * @param  length    Number of bytes, at most the other side's MIU.
+   * @param  timeoutMs Maximum time to wait for the receive window, 0 waits forever.
+   * @return           True if queued.
+   */
+  bool send(int side, const uint8_t* data, size_t length, int timeoutMs);
+
+  /**
+   * Take the next I-PDU sent to a side.
+   *
+   * @param  side      Receiving side.
+   * @param  buffer    Buffer to put received data; a longer PDU is truncated.
+   * @param  length    Size of the buffer.
+   * @param  timeoutMs Maximum time to wait, 0 waits forever.
+   * @return           Number of bytes received, or -1 on failure.
+   */
+  int receive(int side, uint8_t* buffer, size_t length, int timeoutMs);
+
+  /**
+   * Disconnect both sides. PDUs already queued can still be received.
+   *
+   * @return None.
+   */
+  void close();
+
+  /**
+   * Fail pending and later send and receive calls of one side.
+   *
+   * @param  side Side to cancel.
+   * @return      None.
+   */
+  void cancel(int side);
+
+  int getMiu(int side) const { return mMiu[side]; }
+  int getRw(int side) const { return mRw[side]; }
+
+private:
+  ~SimulatedLink();
+
+  bool waitLocked(const struct timespec* deadline);
+
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  std::deque<std::vector<uint8_t> > mQueue[2];  // PDUs waiting for each side.
+  int mMiu[2];
+  int mRw[2];
+  bool mIsCancelled[2];
+  bool mIsClosed;
+  int mRefCount;
+  uint32_t mLatencyUs;
+};
+
+#endif // mozilla_nfcd_SimulatedLink_h
@@ -0,0 +1,31 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_SimulatedTag_h
+#define mozilla_nfcd_SimulatedTag_h
+
+#include <stdint.h>
+#include <vector>
+
+// RF protocols, numbered as in NCI; reported by getTechLibNfcTypes().
+#define SIM_PROTOCOL_T1T       0x01
+#define SIM_PROTOCOL_T2T       0x02
+#define SIM_PROTOCOL_T3T       0x03
+#define SIM_PROTOCOL_ISO_DEP   0x04
+#define SIM_PROTOCOL_ISO15693  0x83
+
+/**
+ * A tag as scripted for the simulated RF field.
+ */
+struct SimulatedTag {
+  int protocol;                // SIM_PROTOCOL_*.
+  std::vector<uint8_t> uid;
+  bool isNdef;                 // False for a blank tag that can be formatted.
+  std::vector<uint8_t> ndef;   // Raw NDEF message.
+  uint32_t maxNdefSize;
+  bool isReadOnly;
+  uint32_t rfLatencyUs;        // Time of each RF exchange.
+};
+
+#endif // mozilla_nfcd_SimulatedTag_h
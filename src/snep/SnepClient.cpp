@@ -7,6 +7,7 @@
 #include "NfcService.h"
 #include "NfcManager.h"
 #include "SnepServer.h"
+#include "NfcCounters.h"
 #include "NfcDebug.h"
 
 SnepClient::SnepClient()
@@ -91,6 +92,7 @@ void SnepClient::put(NdefMessage& msg)
   if (snepRequest) {
     // Send request.
     mMessenger->sendMessage(*snepRequest);
+    NfcCounters::increment(NFC_STATS_SNEP_PUTS);
   } else {
     ALOGE("%s: get put request fail", FUNC);
   }
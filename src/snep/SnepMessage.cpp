@@ -42,10 +42,10 @@ SnepMessage::SnepMessage(std::vector<uint8_t>& buf)
     ndefLength = mLength;
   }
 
-  if (ndefLength > 0) {
+  // Parse only the announced information field, within the buffer.
+  if (ndefLength > 0 && (size_t)ndefOffset + ndefLength <= buf.size()) {
     mNdefMessage = new NdefMessage();
-    // TODO : Need to check idx is correct.
-    mNdefMessage->init(buf, idx);
+    mNdefMessage->init(&buf[ndefOffset], ndefLength);
   } else {
     mNdefMessage = NULL;
   }
@@ -63,16 +63,12 @@ SnepMessage::SnepMessage(uint8_t version, uint8_t field, int length,
 
 SnepMessage* SnepMessage::getGetRequest(int acceptableLength, NdefMessage& ndef)
 {
-  std::vector<uint8_t> buf;
-  ndef.toByteArray(buf);
-  return new SnepMessage(SnepMessage::VERSION, SnepMessage::REQUEST_GET, 4 + buf.size(), acceptableLength, &ndef);
+  return new SnepMessage(SnepMessage::VERSION, SnepMessage::REQUEST_GET, 4 + ndef.getEncodedSize(), acceptableLength, &ndef);
 }
 
 SnepMessage* SnepMessage::getPutRequest(NdefMessage& ndef)
 {
-  std::vector<uint8_t> buf;
-  ndef.toByteArray(buf);
-  return new SnepMessage(SnepMessage::VERSION, SnepMessage::REQUEST_PUT, buf.size(), 0, &ndef);
+  return new SnepMessage(SnepMessage::VERSION, SnepMessage::REQUEST_PUT, ndef.getEncodedSize(), 0, &ndef);
 }
 
 SnepMessage* SnepMessage::getMessage(uint8_t field)
@@ -85,53 +81,69 @@ SnepMessage* getSuccessResponse(NdefMessage* ndef)
   if (!ndef) {
     return new SnepMessage(SnepMessage::VERSION, SnepMessage::RESPONSE_SUCCESS, 0, 0, NULL);
   } else {
-    std::vector<uint8_t> buf;
-    ndef->toByteArray(buf);
-    return new SnepMessage(SnepMessage::VERSION, SnepMessage::RESPONSE_SUCCESS, buf.size(), 0, ndef);
+    return new SnepMessage(SnepMessage::VERSION, SnepMessage::RESPONSE_SUCCESS, ndef->getEncodedSize(), 0, ndef);
   }
 }
 
 SnepMessage* SnepMessage::fromByteArray(std::vector<uint8_t>& buf)
 {
+  if (buf.size() < (size_t)SnepMessage::HEADER_LENGTH ||
+      (buf[1] == SnepMessage::REQUEST_GET && buf.size() < (size_t)SnepMessage::HEADER_LENGTH + 4)) {
+    ALOGE("%s: SNEP message too short: %u", FUNC, (unsigned)buf.size());
+    return NULL;
+  }
   return new SnepMessage(buf);
 }
 
 SnepMessage* SnepMessage::fromByteArray(uint8_t* pBuf, int size)
 {
-  std::vector<uint8_t> buf;
-  for (int i = 0; i < size; i++)
-    buf[i] = pBuf[i];
+  std::vector<uint8_t> buf(pBuf, pBuf + size);
+  return fromByteArray(buf);
+}
 
-  return new SnepMessage(buf);
+uint32_t SnepMessage::getEncodedSize()
+{
+  uint32_t size = SnepMessage::HEADER_LENGTH;
+  if (mField == SnepMessage::REQUEST_GET) {
+    size += 4;
+  }
+  if (mNdefMessage) {
+    size += mNdefMessage->getEncodedSize();
+  }
+  return size;
+}
+
+static uint8_t* writeUint32(uint8_t* dest, uint32_t value)
+{
+  *dest++ = (value >> 24) & 0xFF;
+  *dest++ = (value >> 16) & 0xFF;
+  *dest++ = (value >>  8) & 0xFF;
+  *dest++ = value & 0xFF;
+  return dest;
 }
 
 void SnepMessage::toByteArray(std::vector<uint8_t>& buf)
 {
-  if (mNdefMessage) {
-    mNdefMessage->toByteArray(buf);
+  uint32_t ndefLength = mNdefMessage ? mNdefMessage->getEncodedSize() : 0;
+  uint32_t headerLength = SnepMessage::HEADER_LENGTH;
+  if (mField == SnepMessage::REQUEST_GET) {
+    headerLength += 4;
   }
 
-  std::vector<uint8_t> snepHeader;
+  size_t offset = buf.size();
+  buf.resize(offset + headerLength + ndefLength);
+  uint8_t* dest = &buf[offset];
 
-  snepHeader.push_back(mVersion);
-  snepHeader.push_back(mField);
+  *dest++ = mVersion;
+  *dest++ = mField;
   if (mField == SnepMessage::REQUEST_GET) {
-    uint32_t len = buf.size() + 4;
-    snepHeader.push_back((len >> 24) & 0xFF);
-    snepHeader.push_back((len >> 16) & 0xFF);
-    snepHeader.push_back((len >>  8) & 0xFF);
-    snepHeader.push_back( len & 0xFF);
-    snepHeader.push_back((mAcceptableLength >> 24) & 0xFF);
-    snepHeader.push_back((mAcceptableLength >> 16) & 0xFF);
-    snepHeader.push_back((mAcceptableLength >>  8) & 0xFF);
-    snepHeader.push_back( mAcceptableLength & 0xFF);
+    dest = writeUint32(dest, ndefLength + 4);
+    dest = writeUint32(dest, mAcceptableLength);
   } else {
-    uint32_t len = buf.size();
-    snepHeader.push_back((len >> 24) & 0xFF);
-    snepHeader.push_back((len >> 16) & 0xFF);
-    snepHeader.push_back((len >>  8) & 0xFF);
-    snepHeader.push_back( len & 0xFF);
+    dest = writeUint32(dest, ndefLength);
   }
 
-  buf.insert(buf.begin(), snepHeader.begin(), snepHeader.end());
+  if (mNdefMessage) {
+    mNdefMessage->writeTo(dest);
+  }
 }
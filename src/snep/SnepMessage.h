@@ -40,8 +40,20 @@ public:
   int getLength() { return mLength; }
   int getAcceptableLength() { return mField != REQUEST_GET ? 0 : mAcceptableLength; }
 
+  /**
+   * Write the SNEP header and the NDEF message into buf. The buffer is
+   * allocated once, at the exact encoded size.
+   *
+   * @param  buf Output raw buffer.
+   * @return     None.
+   */
   void toByteArray(std::vector<uint8_t>& buf);
 
+  /**
+   * @return Number of bytes toByteArray() writes, header included.
+   */
+  uint32_t getEncodedSize();
+
   static SnepMessage* getGetRequest(int acceptableLength, NdefMessage& ndef);
   static SnepMessage* getPutRequest(NdefMessage& ndef);
   static SnepMessage* getMessage(uint8_t field);
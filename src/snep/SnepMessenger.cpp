@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "ILlcpSocket.h"
+#include "NfcUtil.h"
 #include "NfcDebug.h"
 
 /**
@@ -14,7 +15,19 @@ SnepMessenger::SnepMessenger(bool isClient, ILlcpSocket* socket, uint32_t fragme
  : mSocket(socket)
  , mFragmentLength(fragmentLength)
  , mIsClient(isClient)
+ , mMaxReceiveLength(DEFAULT_MAX_RECEIVE_LENGTH)
+ , mErrorResponse(SnepMessage::RESPONSE_BAD_REQUEST)
+ , mTimeoutMs(DEFAULT_TIMEOUT_MS)
+ , mIdleTimeoutMs(0)
+ , mIsConnectionLost(false)
 {
+  mSocket->setTimeout(mTimeoutMs);
+}
+
+void SnepMessenger::setTimeout(int timeoutMs)
+{
+  mTimeoutMs = timeoutMs;
+  mSocket->setTimeout(mTimeoutMs);
 }
 
 SnepMessenger::~SnepMessenger()
@@ -35,17 +48,19 @@ void SnepMessenger::sendMessage(SnepMessage& msg)
 
   std::vector<uint8_t> buf;
   msg.toByteArray(buf);
-  uint32_t length = -1;
 
-  if (buf.size() <  mFragmentLength) {
-    length = buf.size();
-    mSocket->send(buf);
-  } else {
-    length = mFragmentLength;
-    std::vector<uint8_t> tmpBuf;
-    for (uint32_t i = 0; i < mFragmentLength; i++)
-      tmpBuf.push_back(buf[i]);
-    mSocket->send(tmpBuf);
+  // A fragment goes out as a single I-PDU, so it must fit the remote MIU.
+  uint32_t fragmentLength = mFragmentLength;
+  int remoteMiu = mSocket->getRemoteMiu();
+  if (remoteMiu > 0 && (uint32_t)remoteMiu < fragmentLength) {
+    fragmentLength = remoteMiu;
+  }
+
+  uint64_t start = NfcUtil::getMonotonicTimeUs();
+  uint32_t length = buf.size() < fragmentLength ? buf.size() : fragmentLength;
+  if (!mSocket->send(&buf[0], length)) {
+    ALOGE("%s: send failed", FUNC);
+    return;
   }
 
   if (length == buf.size()) {
@@ -70,18 +85,28 @@ void SnepMessenger::sendMessage(SnepMessage& msg)
     delete snepResponse;
     return;
   }
+  delete snepResponse;
 
-  // Send remaining fragments.
+  // Send remaining fragments back to back, straight from the serialized
+  // buffer. NFA queues I-PDUs until the remote receive window is full and
+  // only then reports congestion, on which send() blocks, so up to RW
+  // fragments stay in flight instead of one.
+  uint32_t fragments = 1;
   while (offset < buf.size()) {
-    std::vector<uint8_t> tmpBuf;
-    length = buf.size() - offset < mFragmentLength ? buf.size() - offset : mFragmentLength;
-    // TODO : Need check here
-    for(uint32_t i = offset; i < offset + length; i++)
-      tmpBuf.push_back(buf[i]);
-    mSocket->send(tmpBuf);
+    length = buf.size() - offset < fragmentLength ? buf.size() - offset : fragmentLength;
+    if (!mSocket->send(&buf[offset], length)) {
+      ALOGE("%s: send failed at offset %u", FUNC, offset);
+      return;
+    }
     offset += length;
+    fragments++;
   }
 
+  uint64_t elapsed = NfcUtil::getMonotonicTimeUs() - start;
+  ALOGD("%s: sent %u bytes in %u fragments (miu=%u rw=%d) in %llu us, %llu bytes/s",
+        FUNC, (unsigned)buf.size(), fragments, fragmentLength, mSocket->getRemoteRw(),
+        (unsigned long long)elapsed,
+        (unsigned long long)(elapsed ? (uint64_t)buf.size() * 1000000 / elapsed : 0));
   ALOGD("%s: exit", FUNC);
 }
 
@@ -124,16 +149,29 @@ SnepMessage* SnepMessenger::getMessage()
     fieldReject = SnepMessage::RESPONSE_REJECT;
   }
 
-  uint32_t readSize = 0;
+  mErrorResponse = SnepMessage::RESPONSE_BAD_REQUEST;
+  mIsConnectionLost = false;
+
+  // An idle server connection waits for the next request for the idle
+  // timeout; once a message has started, the rest must arrive in time.
+  if (!mIsClient) {
+    mSocket->setTimeout(mIdleTimeoutMs);
+  }
   int size = mSocket->receive(partial);
-  if (size < 0 || size < HEADER_LENGTH) {
+  if (!mIsClient) {
+    mSocket->setTimeout(mTimeoutMs);
+  }
+  if (size < 0) {
+    ALOGD("%s: connection broken or idle", FUNC);
+    mIsConnectionLost = true;
+    return NULL;
+  }
+  if (size < HEADER_LENGTH) {
+    ALOGE("%s: incomplete SNEP header (%d bytes)", FUNC, size);
     if (!socketSend(fieldReject)) {
       ALOGE("%s: snep message send fail", FUNC);
-      return NULL;
     }
-  } else {
-    readSize = size - HEADER_LENGTH;
-    buffer.insert(buffer.end(), partial.begin(), partial.end());
+    return NULL;
   }
 
   const uint8_t requestVersion = partial[0];
@@ -150,6 +188,28 @@ SnepMessage* SnepMessenger::getMessage()
     return new SnepMessage(requestVersion, requestField, 0, 0, NULL);
   }
 
+  // Refuse a message larger than we are willing to buffer before any of its
+  // remaining fragments is requested. A server answers EXCESS DATA instead
+  // of CONTINUE, a client rejects the response.
+  if (requestSize > mMaxReceiveLength) {
+    ALOGE("%s: message too large: %u > %u", FUNC, requestSize, mMaxReceiveLength);
+    if (mIsClient && !socketSend(fieldReject)) {
+      ALOGE("%s: snep message send fail", FUNC);
+    }
+    mErrorResponse = SnepMessage::RESPONSE_EXCESS_DATA;
+    return NULL;
+  }
+
+  uint32_t readSize = size - HEADER_LENGTH;
+  if (readSize > requestSize) {
+    ALOGE("%s: fragment exceeds message length: %u > %u", FUNC, readSize, requestSize);
+    return NULL;
+  }
+
+  // The whole message is received into a single allocation.
+  buffer.reserve(HEADER_LENGTH + requestSize);
+  buffer.insert(buffer.end(), partial.begin(), partial.end());
+
   bool doneReading = false;
   if (requestSize > readSize) {
     if (!socketSend(fieldContinue)) {
@@ -166,16 +226,23 @@ SnepMessage* SnepMessenger::getMessage()
     partial.clear();
     size = mSocket->receive(partial);
     if (size < 0) {
+      ALOGE("%s: connection broken after %u of %u bytes", FUNC, readSize, requestSize);
+      return NULL;
+    }
+
+    if ((uint32_t)size > requestSize - readSize) {
+      ALOGE("%s: peer sent more than announced: %u > %u",
+            FUNC, readSize + size, requestSize);
       if (!socketSend(fieldReject)) {
         ALOGE("%s: snep message send fail", FUNC);
-        return NULL;
-      }
-    } else {
-      readSize += size;
-      buffer.insert(buffer.end(), partial.begin(), partial.end());
-      if (readSize == requestSize) {
-        doneReading = true;
       }
+      return NULL;
+    }
+
+    readSize += size;
+    buffer.insert(buffer.end(), partial.begin(), partial.end());
+    if (readSize == requestSize) {
+      doneReading = true;
     }
   }
 
@@ -18,15 +18,72 @@ public:
   uint32_t mFragmentLength;
   bool mIsClient;
 
+  // Largest SNEP message accepted from the peer by default.
+  static const uint32_t DEFAULT_MAX_RECEIVE_LENGTH = 10 * (1 << 20);
+
+  // How long the peer may stay silent in the middle of an exchange.
+  static const int DEFAULT_TIMEOUT_MS = 5000;
+
   void sendMessage(SnepMessage& msg);
+
+  /**
+   * Receive a SNEP message, reassembling its fragments.
+   *
+   * @return The message, or NULL on error. A server should then answer with
+   *         getErrorResponse().
+   */
   SnepMessage* getMessage();
   void close();
 
+  /**
+   * Set the largest message getMessage() accepts. Larger messages are refused
+   * after their first fragment, before anything else is buffered.
+   *
+   * @param  length Maximum message length in bytes, header excluded.
+   * @return        None.
+   */
+  void setMaxReceiveLength(uint32_t length) { mMaxReceiveLength = length; }
+
+  /**
+   * Bound how long a send or receive may block. A server waits for the
+   * first fragment of a request for the idle timeout instead.
+   *
+   * @param  timeoutMs Timeout in milliseconds; 0 waits forever.
+   * @return           None.
+   */
+  void setTimeout(int timeoutMs);
+
+  /**
+   * Bound how long a server waits for the next request.
+   *
+   * @param  timeoutMs Timeout in milliseconds; 0, the default, waits as long
+   *                   as the connection is up.
+   * @return           None.
+   */
+  void setIdleTimeout(int timeoutMs) { mIdleTimeoutMs = timeoutMs; }
+
+  /**
+   * @return True if the last getMessage() failed because the connection
+   *         broke or the peer stayed idle. Nothing should be sent then.
+   */
+  bool isConnectionLost() { return mIsConnectionLost; }
+
+  /**
+   * @return Response code describing why the last getMessage() failed.
+   */
+  uint8_t getErrorResponse() { return mErrorResponse; }
+
   static SnepMessage* getPutRequest(NdefMessage& ndef);
 
 private:
   static const int HEADER_LENGTH = 6;
 
+  uint32_t mMaxReceiveLength;
+  uint8_t mErrorResponse;
+  int mTimeoutMs;
+  int mIdleTimeoutMs;
+  bool mIsConnectionLost;
+
   bool socketSend(uint8_t field);
 };
 
@@ -1,45 +1,18 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdlib.h>
+#include <vector>
 
 #include "NfcService.h"
 #include "NfcManager.h"
 #include "SnepServer.h"
 #include "ISnepCallback.h"
+#include "NfcCounters.h"
 #include "NfcDebug.h"
 
 // Well-known LLCP SAP Values defined by NFC forum.
 const char* SnepServer::DEFAULT_SERVICE_NAME = "urn:nfc:sn:snep";
 
-// Connection thread, used to handle incoming connections.
-void* SnepConnectionThreadFunc(void* arg)
-{
-  ALOGD("%s: connection thread enter", FUNC);
-
-  SnepConnectionThread* pConnectionThread = reinterpret_cast<SnepConnectionThread*>(arg);
-  if (!pConnectionThread) {
-    ALOGE("%s: invalid parameter", FUNC);
-    return NULL;
-  }
-
-  ISnepCallback* ICallback = pConnectionThread->mCallback;
-  while(pConnectionThread->isServerRunning()) {
-    // Handle message.
-    if (!SnepServer::handleRequest(pConnectionThread->mMessenger, ICallback)) {
-      break;
-    }
-  }
-
-  if (pConnectionThread->mSock)
-    pConnectionThread->mSock->close();
-
-  // TODO : is this correct ??
-  delete pConnectionThread;
-
-  ALOGD("%s: connection thread exit", FUNC);
-  return NULL;
-}
-
 /**
  * Connection thread is created when Snep server accept a connection request.
  */
@@ -50,20 +23,35 @@ SnepConnectionThread::SnepConnectionThread(
  , mServer(server)
 {
   mMessenger = new SnepMessenger(false, socket, fragmentLength);
+  mMessenger->setIdleTimeout(NfcWorkerPool::IDLE_TIMEOUT_MS);
 }
 
 SnepConnectionThread::~SnepConnectionThread()
 {
   delete mMessenger;
+  delete mSock;
 }
 
+// Runs on a worker thread, used to handle incoming connections.
 void SnepConnectionThread::run()
 {
-  pthread_t tid;
-  if(pthread_create(&tid, NULL, SnepConnectionThreadFunc, this) != 0) {
-    ALOGE("%s: pthread_create fail", FUNC);
-    abort();
+  ALOGD("%s: connection thread enter", FUNC);
+
+  while(isServerRunning()) {
+    // Handle message.
+    if (!SnepServer::handleRequest(mMessenger, mCallback)) {
+      break;
+    }
   }
+
+  if (mSock)
+    mSock->close();
+
+  // After this the server no longer refers to the connection; the pool
+  // deletes it.
+  mServer->removeConnection(this);
+
+  ALOGD("%s: connection thread exit", FUNC);
 }
 
 bool SnepConnectionThread::isServerRunning() const
@@ -105,7 +93,10 @@ void* snepServerThreadFunc(void* arg)
 
       SnepConnectionThread* pConnectionThread =
           new SnepConnectionThread(pSnepServer, communicationSocket, length, ICallback);
-      pConnectionThread->run();
+      if (!pSnepServer->addConnection(pConnectionThread)) {
+        communicationSocket->close();
+        delete pConnectionThread;
+      }
     }
   }
 
@@ -121,7 +112,10 @@ SnepServer::SnepServer(ISnepCallback* ICallback)
  , mFragmentLength(-1)
  , mMiu(DEFAULT_MIU)
  , mRwSize(DEFAULT_RW_SIZE)
+ , mThreadStarted(false)
 {
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
 }
 
 SnepServer::SnepServer(const char* serviceName, int serviceSap, ISnepCallback* ICallback)
@@ -133,7 +127,10 @@ SnepServer::SnepServer(const char* serviceName, int serviceSap, ISnepCallback* I
  , mFragmentLength(-1)
  , mMiu(DEFAULT_MIU)
  , mRwSize(DEFAULT_RW_SIZE)
+ , mThreadStarted(false)
 {
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
 }
 
 SnepServer::SnepServer(ISnepCallback* ICallback, int miu, int rwSize)
@@ -145,7 +142,10 @@ SnepServer::SnepServer(ISnepCallback* ICallback, int miu, int rwSize)
  , mFragmentLength(-1)
  , mMiu(miu)
  , mRwSize(rwSize)
+ , mThreadStarted(false)
 {
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
 }
 
 SnepServer::SnepServer(const char* serviceName, int serviceSap, int fragmentLength, ISnepCallback* ICallback)
@@ -157,12 +157,17 @@ SnepServer::SnepServer(const char* serviceName, int serviceSap, int fragmentLeng
  , mFragmentLength(fragmentLength)
  , mMiu(DEFAULT_MIU)
  , mRwSize(DEFAULT_RW_SIZE)
+ , mThreadStarted(false)
 {
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mCond, NULL);
 }
 
 SnepServer::~SnepServer()
 {
   stop();
+  pthread_cond_destroy(&mCond);
+  pthread_mutex_destroy(&mMutex);
 }
 
 void SnepServer::start()
@@ -177,28 +182,83 @@ void SnepServer::start()
     abort();
   }
 
-  pthread_t tid;
-  if(pthread_create(&tid, NULL, snepServerThreadFunc, this) != 0)
+  // Set before the thread starts, or it may see the server stopped.
+  mServerRunning = true;
+  if(pthread_create(&mThread, NULL, snepServerThreadFunc, this) != 0)
   {
     ALOGE("%s: pthread_create failed", FUNC);
     abort();
   }
-  mServerRunning = true;
+  mThreadStarted = true;
 
   ALOGD("%s: exit", FUNC);
 }
 
 void SnepServer::stop()
 {
-  // TODO : need to kill thread here
+  mServerRunning = false;
+
+  // Closing the server socket makes a pending accept() fail.
   if (mServerSocket) {
     mServerSocket->close();
-    delete mServerSocket;
-    mServerSocket = NULL;
   }
-  mServerRunning = false;
+  if (mThreadStarted) {
+    pthread_join(mThread, NULL);
+    mThreadStarted = false;
+  }
+  delete mServerSocket;
+  mServerSocket = NULL;
+
+  // Connections still waiting for a worker are taken back from the pool;
+  // the workers may all be held by another server's connections. Cancelling
+  // the sockets of the running ones makes pending sends and receives fail,
+  // so that they notice the server is stopping and close their sockets
+  // themselves.
+  std::vector<SnepConnectionThread*> queued;
+  pthread_mutex_lock(&mMutex);
+  std::set<SnepConnectionThread*>::iterator it;
+  for (it = mConnections.begin(); it != mConnections.end(); it++) {
+    if (NfcWorkerPool::Instance()->cancel(*it)) {
+      queued.push_back(*it);
+    } else {
+      (*it)->mSock->cancel();
+    }
+  }
+  for (size_t i = 0; i < queued.size(); i++) {
+    mConnections.erase(queued[i]);
+  }
+  while (!mConnections.empty()) {
+    pthread_cond_wait(&mCond, &mMutex);
+  }
+  pthread_mutex_unlock(&mMutex);
+
+  for (size_t i = 0; i < queued.size(); i++) {
+    queued[i]->mSock->close();
+    delete queued[i];
+  }
+}
 
-  // Use pthread_join here to make sure all thread is finished ?
+bool SnepServer::addConnection(SnepConnectionThread* connection)
+{
+  pthread_mutex_lock(&mMutex);
+  mConnections.insert(connection);
+  pthread_mutex_unlock(&mMutex);
+
+  if (!NfcWorkerPool::Instance()->submit(connection)) {
+    pthread_mutex_lock(&mMutex);
+    mConnections.erase(connection);
+    pthread_mutex_unlock(&mMutex);
+    return false;
+  }
+  return true;
+}
+
+void SnepServer::removeConnection(SnepConnectionThread* connection)
+{
+  pthread_mutex_lock(&mMutex);
+  mConnections.erase(connection);
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mMutex);
 }
 
 bool SnepServer::handleRequest(SnepMessenger* messenger, ISnepCallback* callback)
@@ -211,13 +271,20 @@ bool SnepServer::handleRequest(SnepMessenger* messenger, ISnepCallback* callback
   SnepMessage* request = messenger->getMessage();
   SnepMessage* response = NULL;
 
+  if (!request && messenger->isConnectionLost()) {
+    return false;
+  }
+
   if (!request) {
     /**
      * Response Codes : BAD REQUEST
      * The request could not be understood by the server due to malformed syntax.
+     *
+     * Response Codes : EXCESS DATA
+     * The server is unable to receive a request of the announced length.
      */
     ALOGE("%s: bad snep message", FUNC);
-    response = SnepMessage::getMessage(SnepMessage::RESPONSE_BAD_REQUEST);
+    response = SnepMessage::getMessage(messenger->getErrorResponse());
     if (response) {
       messenger->sendMessage(*response);
       delete response;
@@ -251,6 +318,7 @@ bool SnepServer::handleRequest(SnepMessenger* messenger, ISnepCallback* callback
   if (response) {
     messenger->sendMessage(*response);
     delete response;
+    NfcCounters::increment(NFC_STATS_SNEP_REQUESTS_SERVED);
   } else {
     ALOGE("%s: no response message is generated", FUNC);
     return false;
@@ -5,10 +5,15 @@
 #ifndef mozilla_nfcd_SnepServer_h
 #define mozilla_nfcd_SnepServer_h
 
+#include <pthread.h>
+#include <set>
+
 #include "SnepMessenger.h"
+#include "NfcWorkerPool.h"
 
 class ILlcpServerSocket;
 class ISnepCallback;
+class SnepConnectionThread;
 
 class SnepServer{
 public:
@@ -24,10 +29,18 @@ public:
   static const char* DEFAULT_SERVICE_NAME;
 
   void start();
+
+  /**
+   * Stop accepting connections, close the open ones and wait until the
+   * server thread and every connection have finished.
+   */
   void stop();
 
   static bool handleRequest(SnepMessenger* messenger, ISnepCallback* callback);
 
+  bool addConnection(SnepConnectionThread* connection);
+  void removeConnection(SnepConnectionThread* connection);
+
   ILlcpServerSocket* mServerSocket;
   ISnepCallback*     mCallback;
   bool               mServerRunning;
@@ -36,13 +49,28 @@ public:
   int                mFragmentLength;
   int                mMiu;
   int                mRwSize;
+
+private:
+  pthread_t mThread;
+  bool mThreadStarted;
+
+  // Connections being served; protected by mMutex.
+  pthread_mutex_t mMutex;
+  pthread_cond_t mCond;
+  std::set<SnepConnectionThread*> mConnections;
 };
 
-class SnepConnectionThread {
+/**
+ * An accepted SNEP connection. It is served on a NfcWorkerPool thread.
+ */
+class SnepConnectionThread : public NfcWorkerTask {
 public:
   SnepConnectionThread(SnepServer* server, ILlcpSocket* socket, int fragmentLength, ISnepCallback* callback);
   ~SnepConnectionThread();
 
+  /**
+   * Handle requests until the peer disconnects or the server stops.
+   */
   void run();
   bool isServerRunning() const;
 
@@ -0,0 +1,119 @@
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this file,
+# You can obtain one at http://mozilla.org/MPL/2.0/.
+
+LOCAL_PATH := $(call my-dir)
+NFCD_PATH := $(LOCAL_PATH)/..
+
+NFCD_NDEF_SRC_FILES := \
+    ../src/interface/NdefParser.cpp \
+    ../src/interface/NdefRecord.cpp \
+    ../src/interface/NdefMessage.cpp
+
+# Tap latency benchmark, run against nfcd built with NFC_VENDOR=SIMULATOR:
+#   nfcd_tap_latency_bench nfcd tap_latency.script 1000 baseline.json
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := TapLatencyBench.cpp
+LOCAL_C_INCLUDES := $(NFCD_PATH)/src
+
+LOCAL_MODULE := nfcd_tap_latency_bench
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# NdefParser benchmark over 1-record, 100-record and 10 MB-payload messages.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := NdefParserBench.cpp $(NFCD_NDEF_SRC_FILES)
+LOCAL_C_INCLUDES := \
+    $(NFCD_PATH)/src \
+    $(NFCD_PATH)/src/interface \
+    external/stlport/stlport \
+    bionic
+LOCAL_SHARED_LIBRARIES := liblog libstlport
+
+LOCAL_MODULE := nfcd_ndef_parser_bench
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# libFuzzer target for NdefParser; needs a clang with -fsanitize=fuzzer.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := NdefParserFuzzer.cpp $(NFCD_NDEF_SRC_FILES)
+LOCAL_C_INCLUDES := \
+    $(NFCD_PATH)/src \
+    $(NFCD_PATH)/src/interface
+LOCAL_SHARED_LIBRARIES := liblog
+
+LOCAL_CLANG := true
+LOCAL_CFLAGS := -fsanitize=fuzzer,address
+LOCAL_LDFLAGS := -fsanitize=fuzzer,address
+
+LOCAL_MODULE := nfcd_ndef_parser_fuzzer
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Round trips through the NDEF and SNEP serializers.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    NdefSerializerTest.cpp \
+    ../src/snep/SnepMessage.cpp \
+    $(NFCD_NDEF_SRC_FILES)
+LOCAL_C_INCLUDES := \
+    $(NFCD_PATH)/src \
+    $(NFCD_PATH)/src/interface \
+    $(NFCD_PATH)/src/snep \
+    external/stlport/stlport \
+    bionic
+LOCAL_SHARED_LIBRARIES := liblog libstlport
+
+LOCAL_MODULE := nfcd_ndef_serializer_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# NdefStreamDecoder fed fragmented and oversized messages.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    NdefStreamDecoderTest.cpp \
+    ../src/interface/NdefStreamDecoder.cpp \
+    $(NFCD_NDEF_SRC_FILES)
+LOCAL_C_INCLUDES := \
+    $(NFCD_PATH)/src \
+    $(NFCD_PATH)/src/interface \
+    external/stlport/stlport \
+    bionic
+LOCAL_SHARED_LIBRARIES := liblog libstlport
+
+LOCAL_MODULE := nfcd_ndef_stream_decoder_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# SnepMessenger fragmenting over a fake LLCP link with a given MIU, RW and
+# latency.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    SnepFragmentTest.cpp \
+    ../src/NfcUtil.cpp \
+    ../src/snep/SnepMessage.cpp \
+    ../src/snep/SnepMessenger.cpp \
+    $(NFCD_NDEF_SRC_FILES)
+LOCAL_C_INCLUDES := \
+    $(NFCD_PATH)/src \
+    $(NFCD_PATH)/src/interface \
+    $(NFCD_PATH)/src/snep \
+    external/stlport/stlport \
+    bionic
+LOCAL_SHARED_LIBRARIES := liblog libstlport
+
+LOCAL_MODULE := nfcd_snep_fragment_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,73 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * NdefParser benchmark over a 1-record, a 100-record and a 10 MB-payload
+ * message. Prints the time per parse, with and without materializing the
+ * records.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+#include "NdefMessage.h"
+#include "NdefParser.h"
+#include "NdefRecord.h"
+
+static uint64_t nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void buildMessage(std::vector<uint8_t>& buf, int recordCount, uint32_t payloadLength)
+{
+  NdefMessage message;
+  std::vector<uint8_t> type(1, 'U');
+  std::vector<uint8_t> id;
+  std::vector<uint8_t> payload(payloadLength, 'x');
+  for (int i = 0; i < recordCount; i++) {
+    message.mRecords.push_back(NdefRecord(NdefRecord::TNF_WELL_KNOWN, type, id, payload));
+  }
+
+  buf.resize(message.getEncodedSize());
+  message.writeTo(&buf[0]);
+}
+
+static void run(const char* name, int recordCount, uint32_t payloadLength, int iterations)
+{
+  std::vector<uint8_t> buf;
+  buildMessage(buf, recordCount, payloadLength);
+
+  uint64_t start = nowNs();
+  for (int i = 0; i < iterations; i++) {
+    NdefParser parser(&buf[0], buf.size());
+    if (!parser.parse(false)) {
+      printf("%s: parse failed\n", name);
+      return;
+    }
+  }
+  uint64_t viewNs = (nowNs() - start) / iterations;
+
+  start = nowNs();
+  for (int i = 0; i < iterations; i++) {
+    NdefMessage message;
+    message.init(&buf[0], buf.size());
+  }
+  uint64_t messageNs = (nowNs() - start) / iterations;
+
+  printf("%-12s %9u bytes  parse %10llu ns  parse+copy %10llu ns\n", name,
+         (unsigned)buf.size(), (unsigned long long)viewNs,
+         (unsigned long long)messageNs);
+}
+
+int main()
+{
+  run("1 record", 1, 16, 1000000);
+  run("100 records", 100, 16, 10000);
+  run("10 MB", 1, NdefParser::MAX_PAYLOAD_SIZE, 20);
+  return 0;
+}
@@ -0,0 +1,93 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * libFuzzer target for NdefParser.
+ *
+ * Every input is parsed as a message and as a single record. The views of
+ * a parsed message must lie inside the input, and encoding its records and
+ * parsing them again must give the same records back.
+ *
+ *   clang++ -fsanitize=fuzzer,address -Isrc/interface -Isrc \
+ *     tests/NdefParserFuzzer.cpp src/interface/Ndef{Parser,Record,Message}.cpp
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "NdefMessage.h"
+#include "NdefParser.h"
+#include "NdefRecord.h"
+
+static void check(bool condition)
+{
+  if (!condition) {
+    abort();
+  }
+}
+
+static bool isInside(const NdefSpan& span, size_t length)
+{
+  return span.offset <= length && span.length <= length - span.offset;
+}
+
+static bool isSameRecord(NdefRecord& a, NdefRecord& b)
+{
+  return a.mTnf == b.mTnf && a.mType == b.mType && a.mId == b.mId &&
+         a.mPayload == b.mPayload;
+}
+
+static void checkViews(NdefParser& parser, size_t length)
+{
+  check(parser.getParsedLength() <= length);
+  for (size_t i = 0; i < parser.getRecordCount(); i++) {
+    const NdefRecordView& view = parser.getRecordView(i);
+    check(isInside(view.type, length));
+    check(isInside(view.id, length));
+  }
+}
+
+static void checkRoundTrip(const uint8_t* data, size_t length)
+{
+  NdefMessage message;
+  if (!message.init(data, length)) {
+    return;
+  }
+
+  std::vector<uint8_t> encoded(message.getEncodedSize());
+  uint8_t* end = message.writeTo(encoded.empty() ? NULL : &encoded[0]);
+  check(end - (encoded.empty() ? NULL : &encoded[0]) == (ptrdiff_t)encoded.size());
+
+  // The one-pass writer and the vector writer produce the same bytes.
+  std::vector<uint8_t> appended;
+  message.toByteArray(appended);
+  check(appended == encoded);
+
+  NdefMessage decoded;
+  check(decoded.init(encoded.empty() ? NULL : &encoded[0], encoded.size()));
+  check(decoded.mRecords.size() == message.mRecords.size());
+  for (size_t i = 0; i < message.mRecords.size(); i++) {
+    check(isSameRecord(decoded.mRecords[i], message.mRecords[i]));
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t length)
+{
+  NdefParser parser(data, length);
+  if (parser.parse(false)) {
+    checkViews(parser, length);
+    std::vector<NdefRecord> records;
+    parser.getRecords(records);
+    check(records.size() == parser.getRecordCount());
+  }
+
+  NdefParser recordParser(data, length);
+  if (recordParser.parse(true)) {
+    checkViews(recordParser, length);
+  }
+
+  checkRoundTrip(data, length);
+  return 0;
+}
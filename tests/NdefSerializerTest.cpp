@@ -0,0 +1,156 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Round trips through the one-pass NDEF and SNEP serializers: the encoded
+ * size is exact, the bytes match the vector writers, and parsing the
+ * output gives the original message back.
+ */
+
+#include <vector>
+
+#include "NdefMessage.h"
+#include "NdefRecord.h"
+#include "SnepMessage.h"
+#include "NfcTest.h"
+
+static NdefRecord makeRecord(uint8_t tnf, size_t typeLength, size_t idLength,
+                             size_t payloadLength)
+{
+  std::vector<uint8_t> type(typeLength, 't');
+  std::vector<uint8_t> id(idLength, 'i');
+  std::vector<uint8_t> payload(payloadLength);
+  for (size_t i = 0; i < payloadLength; i++) {
+    payload[i] = i;
+  }
+  return NdefRecord(tnf, type, id, payload);
+}
+
+static bool isSameMessage(NdefMessage& a, NdefMessage& b)
+{
+  if (a.mRecords.size() != b.mRecords.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.mRecords.size(); i++) {
+    NdefRecord& x = a.mRecords[i];
+    NdefRecord& y = b.mRecords[i];
+    if (x.mTnf != y.mTnf || x.mType != y.mType || x.mId != y.mId ||
+        x.mPayload != y.mPayload) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testNdefRoundTrip(NdefMessage& message)
+{
+  uint32_t size = message.getEncodedSize();
+  std::vector<uint8_t> encoded(size);
+  uint8_t* end = message.writeTo(&encoded[0]);
+  NFC_CHECK(end == &encoded[0] + size);
+
+  std::vector<uint8_t> appended;
+  message.toByteArray(appended);
+  NFC_CHECK(appended == encoded);
+
+  NFC_CHECK(encoded[0] & NdefRecord::FLAG_MB);
+
+  NdefMessage decoded;
+  NFC_CHECK(decoded.init(&encoded[0], encoded.size()));
+  NFC_CHECK(isSameMessage(decoded, message));
+
+  // The parser rejects a message without ME on its last record, so encoding
+  // the decoded message again must give the same bytes.
+  std::vector<uint8_t> reencoded;
+  decoded.toByteArray(reencoded);
+  NFC_CHECK(reencoded == encoded);
+}
+
+static void testSnepRoundTrip(NdefMessage& message)
+{
+  SnepMessage* put = SnepMessage::getPutRequest(message);
+  std::vector<uint8_t> encoded;
+  put->toByteArray(encoded);
+  NFC_CHECK(encoded.size() == put->getEncodedSize());
+  NFC_CHECK(put->getLength() == (int)message.getEncodedSize());
+
+  SnepMessage* decoded = SnepMessage::fromByteArray(encoded);
+  NFC_CHECK(decoded != NULL);
+  if (decoded) {
+    NFC_CHECK(decoded->getField() == SnepMessage::REQUEST_PUT);
+    NFC_CHECK(decoded->getLength() == put->getLength());
+    NFC_CHECK(decoded->getNdefMessage() != NULL);
+    if (decoded->getNdefMessage()) {
+      NFC_CHECK(isSameMessage(*decoded->getNdefMessage(), message));
+    }
+  }
+  delete decoded;
+  delete put;
+
+  // toByteArray() appends to the buffer.
+  SnepMessage* get = SnepMessage::getGetRequest(1024, message);
+  encoded.clear();
+  get->toByteArray(encoded);
+  NFC_CHECK(encoded.size() == get->getEncodedSize());
+  decoded = SnepMessage::fromByteArray(encoded);
+  NFC_CHECK(decoded != NULL);
+  if (decoded) {
+    NFC_CHECK(decoded->getField() == SnepMessage::REQUEST_GET);
+    NFC_CHECK(decoded->getAcceptableLength() == 1024);
+    NFC_CHECK(decoded->getNdefMessage() != NULL);
+    if (decoded->getNdefMessage()) {
+      NFC_CHECK(isSameMessage(*decoded->getNdefMessage(), message));
+    }
+  }
+  delete decoded;
+  delete get;
+}
+
+static void testSnepHeaderOnly()
+{
+  SnepMessage* response = SnepMessage::getMessage(SnepMessage::RESPONSE_SUCCESS);
+  std::vector<uint8_t> encoded;
+  response->toByteArray(encoded);
+  NFC_CHECK(encoded.size() == response->getEncodedSize());
+
+  SnepMessage* decoded = SnepMessage::fromByteArray(encoded);
+  NFC_CHECK(decoded != NULL);
+  if (decoded) {
+    NFC_CHECK(decoded->getField() == SnepMessage::RESPONSE_SUCCESS);
+    NFC_CHECK(decoded->getLength() == 0);
+  }
+  delete decoded;
+  delete response;
+}
+
+int main()
+{
+  // Short records, with and without id, and an empty one.
+  NdefMessage small;
+  small.mRecords.push_back(makeRecord(NdefRecord::TNF_WELL_KNOWN, 1, 0, 12));
+  small.mRecords.push_back(makeRecord(NdefRecord::TNF_MIME_MEDIA, 10, 3, 0));
+  small.mRecords.push_back(makeRecord(NdefRecord::TNF_EMPTY, 0, 0, 0));
+  testNdefRoundTrip(small);
+  testSnepRoundTrip(small);
+
+  // A single record at the short record limit and just above it.
+  for (size_t length = 254; length <= 257; length++) {
+    NdefMessage message;
+    message.mRecords.push_back(makeRecord(NdefRecord::TNF_EXTERNAL_TYPE, 5, 1, length));
+    testNdefRoundTrip(message);
+    testSnepRoundTrip(message);
+  }
+
+  // Long records mixed with short ones, e.g. a photo in a vCard.
+  NdefMessage large;
+  large.mRecords.push_back(makeRecord(NdefRecord::TNF_MIME_MEDIA, 10, 0, 100));
+  large.mRecords.push_back(makeRecord(NdefRecord::TNF_MIME_MEDIA, 10, 255, 300000));
+  large.mRecords.push_back(makeRecord(NdefRecord::TNF_ABSOLUTE_URI, 255, 0, 1));
+  testNdefRoundTrip(large);
+  testSnepRoundTrip(large);
+
+  testSnepHeaderOnly();
+
+  return nfcTestResult("NdefSerializerTest");
+}
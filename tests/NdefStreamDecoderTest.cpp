@@ -0,0 +1,184 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * NdefStreamDecoder fed a message in LLCP-sized fragments and byte by byte:
+ * it completes on the last byte only, gives back the original message, keeps
+ * the bytes that follow it and refuses messages over its limit.
+ */
+
+#include <vector>
+
+#include "NdefMessage.h"
+#include "NdefParser.h"
+#include "NdefRecord.h"
+#include "NdefStreamDecoder.h"
+#include "NfcTest.h"
+
+// Default LLCP link MIU.
+#define MIU 128
+#define MAX_LENGTH (1024 * 1024)
+
+static void buildMessage(NdefMessage& message, std::vector<uint8_t>& encoded,
+                         uint32_t payloadLength)
+{
+  std::vector<uint8_t> type(10, 't');
+  std::vector<uint8_t> id(3, 'i');
+  std::vector<uint8_t> payload(payloadLength);
+  for (uint32_t i = 0; i < payloadLength; i++) {
+    payload[i] = i * 7;
+  }
+
+  // A short record around a long one, like a vCard with a photo.
+  std::vector<uint8_t> small(20, 's');
+  message.mRecords.push_back(NdefRecord(NdefRecord::TNF_WELL_KNOWN, type, id, small));
+  message.mRecords.push_back(NdefRecord(NdefRecord::TNF_MIME_MEDIA, type, id, payload));
+  message.mRecords.push_back(NdefRecord(NdefRecord::TNF_WELL_KNOWN, type, id, small));
+
+  encoded.clear();
+  message.toByteArray(encoded);
+}
+
+static bool isSameMessage(NdefMessage& a, NdefMessage& b)
+{
+  if (a.mRecords.size() != b.mRecords.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.mRecords.size(); i++) {
+    NdefRecord& x = a.mRecords[i];
+    NdefRecord& y = b.mRecords[i];
+    if (x.mTnf != y.mTnf || x.mType != y.mType || x.mId != y.mId ||
+        x.mPayload != y.mPayload) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testFragments(NdefMessage& message, std::vector<uint8_t>& encoded,
+                          size_t fragmentLength)
+{
+  NdefStreamDecoder decoder(MAX_LENGTH);
+  size_t size = encoded.size();
+
+  for (size_t offset = 0; offset < size; offset += fragmentLength) {
+    size_t length = size - offset < fragmentLength ? size - offset : fragmentLength;
+    NdefStreamDecoder::Status status = decoder.append(&encoded[offset], length);
+    size_t remaining = size - offset - length;
+
+    if (remaining) {
+      NFC_CHECK(status == NdefStreamDecoder::NEED_MORE);
+      // Never asks for more than what is left of the message.
+      NFC_CHECK(decoder.getNeededLength() > 0);
+      NFC_CHECK(decoder.getNeededLength() <= remaining);
+      NFC_CHECK(decoder.takeMessage() == NULL);
+      if (status != NdefStreamDecoder::NEED_MORE) {
+        return;
+      }
+    } else {
+      NFC_CHECK(status == NdefStreamDecoder::COMPLETE);
+    }
+  }
+
+  NdefMessage* decoded = decoder.takeMessage();
+  NFC_CHECK(decoded != NULL);
+  if (decoded) {
+    NFC_CHECK(isSameMessage(*decoded, message));
+  }
+  delete decoded;
+  NFC_CHECK(decoder.getBufferedLength() == 0);
+  NFC_CHECK(decoder.getStatus() == NdefStreamDecoder::NEED_MORE);
+}
+
+static void testTrailingBytes(NdefMessage& message, std::vector<uint8_t>& encoded)
+{
+  NdefStreamDecoder decoder(MAX_LENGTH);
+  size_t half = encoded.size() / 2;
+
+  // A whole message followed by the first half of the next one.
+  std::vector<uint8_t> stream(encoded);
+  stream.insert(stream.end(), encoded.begin(), encoded.begin() + half);
+  NFC_CHECK(decoder.append(&stream[0], stream.size()) == NdefStreamDecoder::COMPLETE);
+
+  NdefMessage* first = decoder.takeMessage();
+  NFC_CHECK(first != NULL && isSameMessage(*first, message));
+  delete first;
+  NFC_CHECK(decoder.getBufferedLength() == half);
+  NFC_CHECK(decoder.getStatus() == NdefStreamDecoder::NEED_MORE);
+
+  NFC_CHECK(decoder.append(&encoded[half], encoded.size() - half) ==
+            NdefStreamDecoder::COMPLETE);
+  NdefMessage* second = decoder.takeMessage();
+  NFC_CHECK(second != NULL && isSameMessage(*second, message));
+  delete second;
+}
+
+static void testChunkedRecord()
+{
+  // MB|CF|SR MIME chunk, then ME|SR TNF_UNCHANGED chunk.
+  const uint8_t first[] = { 0xb2, 0x01, 0x02, 'a', 0x01, 0x02 };
+  const uint8_t last[] = { 0x56, 0x00, 0x02, 0x03, 0x04 };
+
+  NdefStreamDecoder decoder(MAX_LENGTH);
+  NFC_CHECK(decoder.append(first, sizeof(first)) == NdefStreamDecoder::NEED_MORE);
+  NFC_CHECK(decoder.append(last, sizeof(last)) == NdefStreamDecoder::COMPLETE);
+
+  NdefMessage* decoded = decoder.takeMessage();
+  NFC_CHECK(decoded != NULL);
+  if (decoded) {
+    NFC_CHECK(decoded->mRecords.size() == 1 &&
+              decoded->mRecords[0].mPayload.size() == 4 &&
+              decoded->mRecords[0].mPayload[3] == 0x04);
+  }
+  delete decoded;
+}
+
+static void testOversized(std::vector<uint8_t>& encoded)
+{
+  // The long record header announces more than the limit, so the decoder
+  // gives up without buffering the payload.
+  NdefStreamDecoder decoder(encoded.size() / 2);
+  NdefStreamDecoder::Status status = NdefStreamDecoder::NEED_MORE;
+  for (size_t offset = 0; offset < encoded.size() && status == NdefStreamDecoder::NEED_MORE;
+       offset += MIU) {
+    size_t length = encoded.size() - offset < MIU ? encoded.size() - offset : MIU;
+    status = decoder.append(&encoded[offset], length);
+  }
+  NFC_CHECK(status == NdefStreamDecoder::ERROR);
+  NFC_CHECK(decoder.getBufferedLength() <= MIU);
+  NFC_CHECK(decoder.takeMessage() == NULL);
+
+  // One byte over the limit.
+  NdefStreamDecoder exact(encoded.size() - 1);
+  NFC_CHECK(exact.append(&encoded[0], encoded.size()) == NdefStreamDecoder::ERROR);
+
+  // A payload length above NdefParser::MAX_PAYLOAD_SIZE.
+  uint32_t payloadLength = NdefParser::MAX_PAYLOAD_SIZE + 1;
+  const uint8_t header[] = { 0xc2, 0x01,
+                             (uint8_t)(payloadLength >> 24), (uint8_t)(payloadLength >> 16),
+                             (uint8_t)(payloadLength >> 8), (uint8_t)payloadLength };
+  NdefStreamDecoder unbounded(0xffffffff);
+  NFC_CHECK(unbounded.append(header, sizeof(header)) == NdefStreamDecoder::ERROR);
+
+  // Stays in error until reset.
+  NFC_CHECK(unbounded.append(&encoded[0], encoded.size()) == NdefStreamDecoder::ERROR);
+  unbounded.reset();
+  NFC_CHECK(unbounded.append(&encoded[0], encoded.size()) == NdefStreamDecoder::COMPLETE);
+}
+
+int main()
+{
+  NdefMessage message;
+  std::vector<uint8_t> encoded;
+  buildMessage(message, encoded, 64 * 1024);
+
+  testFragments(message, encoded, MIU);
+  testFragments(message, encoded, 1);
+  testFragments(message, encoded, encoded.size());
+  testTrailingBytes(message, encoded);
+  testChunkedRecord();
+  testOversized(encoded);
+
+  return nfcTestResult("NdefStreamDecoderTest");
+}
@@ -0,0 +1,34 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_nfcd_NfcTest_h
+#define mozilla_nfcd_NfcTest_h
+
+#include <stdio.h>
+
+/**
+ * Minimal checks for the test executables: a failed check is printed and
+ * counted, and main() returns nfcTestResult().
+ */
+static int sNfcTestFailures = 0;
+
+#define NFC_CHECK(cond)                                              \
+  do {                                                               \
+    if (!(cond)) {                                                   \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      sNfcTestFailures++;                                            \
+    }                                                                \
+  } while (0)
+
+static inline int nfcTestResult(const char* name)
+{
+  if (sNfcTestFailures) {
+    fprintf(stderr, "%s: %d checks failed\n", name, sNfcTestFailures);
+    return 1;
+  }
+  printf("%s: passed\n", name);
+  return 0;
+}
+
+#endif // mozilla_nfcd_NfcTest_h
@@ -0,0 +1,246 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * SnepMessenger sending fragmented messages over a fake LLCP link with a
+ * given MIU, receive window and round-trip latency. Every fragment must fit
+ * the MIU, no more than RW fragments may be unacknowledged, and the peer must
+ * reassemble exactly the serialized message.
+ */
+
+#include <deque>
+#include <vector>
+
+#include "ILlcpSocket.h"
+#include "NdefMessage.h"
+#include "NdefRecord.h"
+#include "SnepMessage.h"
+#include "SnepMessenger.h"
+#include "NfcTest.h"
+
+/**
+ * LLCP data link on a virtual clock. An I-PDU is acknowledged by the peer
+ * one round trip after it is sent; send() blocks, i.e. moves the clock, while
+ * RW I-PDUs are unacknowledged, as NFA does when it reports congestion.
+ */
+class FakeLlcpSocket : public ILlcpSocket {
+public:
+  FakeLlcpSocket(int miu, int rw, uint64_t latencyUs)
+   : mMiu(miu)
+   , mRw(rw)
+   , mLatencyUs(latencyUs)
+   , mNowUs(0)
+   , mMaxInFlight(0)
+   , mOversizedPdus(0)
+  {
+  }
+
+  bool connectToSap(int sap) { return true; }
+  bool connectToService(const char* serviceName) { return true; }
+  void close() {}
+
+  bool send(std::vector<uint8_t>& sendBuff)
+  {
+    return send(sendBuff.empty() ? NULL : &sendBuff[0], sendBuff.size());
+  }
+
+  bool send(const uint8_t* data, size_t length)
+  {
+    if (length > (size_t)mMiu) {
+      mOversizedPdus++;
+    }
+
+    retire();
+    if (mInFlight.size() >= (size_t)mRw) {
+      // Congested until the oldest I-PDU is acknowledged.
+      mNowUs = mInFlight.front();
+      retire();
+    }
+
+    mInFlight.push_back(mNowUs + mLatencyUs);
+    if (mInFlight.size() > mMaxInFlight) {
+      mMaxInFlight = mInFlight.size();
+    }
+    mPdus.push_back(std::vector<uint8_t>(data, data + length));
+    return true;
+  }
+
+  int receive(std::vector<uint8_t>& recvBuff)
+  {
+    if (mReceiveQueue.empty()) {
+      return -1;
+    }
+    // The answer comes back after everything sent so far is acknowledged.
+    if (!mInFlight.empty()) {
+      mNowUs = mInFlight.back();
+      retire();
+    }
+    recvBuff = mReceiveQueue.front();
+    mReceiveQueue.pop_front();
+    return recvBuff.size();
+  }
+
+  int receive(uint8_t* buffer, size_t length)
+  {
+    std::vector<uint8_t> buf;
+    int size = receive(buf);
+    if (size > 0) {
+      memcpy(buffer, &buf[0], size < (int)length ? size : length);
+    }
+    return size;
+  }
+
+  void setTimeout(int timeoutMs) {}
+  void cancel() {}
+
+  int getRemoteMiu() const { return mMiu; }
+  int getRemoteRw() const { return mRw; }
+  int getLocalSap() const { return 0x20; }
+  int getLocalMiu() const { return mMiu; }
+  int getLocalRw() const { return mRw; }
+
+  /**
+   * Queue a SNEP message without information field for receive().
+   */
+  void queueMessage(uint8_t field)
+  {
+    std::vector<uint8_t> buf;
+    SnepMessage* msg = SnepMessage::getMessage(field);
+    msg->toByteArray(buf);
+    delete msg;
+    mReceiveQueue.push_back(buf);
+  }
+
+  /**
+   * @return Time on the virtual clock once every I-PDU is acknowledged.
+   */
+  uint64_t getDrainedTimeUs()
+  {
+    return mInFlight.empty() ? mNowUs : mInFlight.back();
+  }
+
+  int mMiu;
+  int mRw;
+  uint64_t mLatencyUs;
+  uint64_t mNowUs;
+  size_t mMaxInFlight;
+  int mOversizedPdus;
+
+  std::vector<std::vector<uint8_t> > mPdus;
+  std::deque<std::vector<uint8_t> > mReceiveQueue;
+
+private:
+  void retire()
+  {
+    while (!mInFlight.empty() && mInFlight.front() <= mNowUs) {
+      mInFlight.pop_front();
+    }
+  }
+
+  // Acknowledgement time of each unacknowledged I-PDU, oldest first.
+  std::deque<uint64_t> mInFlight;
+};
+
+static void buildMessage(NdefMessage& message, uint32_t payloadLength)
+{
+  std::vector<uint8_t> type(10, 't');
+  std::vector<uint8_t> id;
+  std::vector<uint8_t> payload(payloadLength);
+  for (uint32_t i = 0; i < payloadLength; i++) {
+    payload[i] = i * 13;
+  }
+  message.mRecords.push_back(NdefRecord(NdefRecord::TNF_MIME_MEDIA, type, id, payload));
+}
+
+static void testWindowedSend(NdefMessage& message, int miu, int rw,
+                             uint64_t latencyUs, uint32_t fragmentLength)
+{
+  SnepMessage* put = SnepMessage::getPutRequest(message);
+  std::vector<uint8_t> expected;
+  put->toByteArray(expected);
+
+  FakeLlcpSocket socket(miu, rw, latencyUs);
+  socket.queueMessage(SnepMessage::RESPONSE_CONTINUE);
+
+  SnepMessenger messenger(true, &socket, fragmentLength);
+  messenger.sendMessage(*put);
+
+  std::vector<uint8_t> received;
+  for (size_t i = 0; i < socket.mPdus.size(); i++) {
+    received.insert(received.end(), socket.mPdus[i].begin(), socket.mPdus[i].end());
+  }
+  NFC_CHECK(received == expected);
+  NFC_CHECK(socket.mOversizedPdus == 0);
+  NFC_CHECK(socket.mMaxInFlight <= (size_t)rw);
+
+  // After CONTINUE the window is kept full, so the transfer takes about one
+  // round trip per RW fragments rather than one per fragment.
+  size_t fragments = socket.mPdus.size() - 1;
+  if (fragments >= (size_t)rw) {
+    NFC_CHECK(socket.mMaxInFlight == (size_t)rw);
+    uint64_t rounds = (fragments + rw - 1) / rw;
+    // The first fragment and its CONTINUE take one round trip.
+    NFC_CHECK(socket.getDrainedTimeUs() <= (rounds + 1) * latencyUs);
+  }
+
+  // The receiving side reassembles the same message.
+  FakeLlcpSocket peer(miu, rw, latencyUs);
+  for (size_t i = 0; i < socket.mPdus.size(); i++) {
+    peer.mReceiveQueue.push_back(socket.mPdus[i]);
+  }
+  SnepMessenger server(false, &peer, fragmentLength);
+  SnepMessage* decoded = server.getMessage();
+  NFC_CHECK(decoded != NULL);
+  if (decoded) {
+    std::vector<uint8_t> reencoded;
+    decoded->toByteArray(reencoded);
+    NFC_CHECK(reencoded == expected);
+  }
+  delete decoded;
+
+  // A fragmented message is answered with a single CONTINUE.
+  if (socket.mPdus.size() > 1) {
+    NFC_CHECK(peer.mPdus.size() == 1 &&
+              peer.mPdus[0][1] == SnepMessage::RESPONSE_CONTINUE);
+  } else {
+    NFC_CHECK(peer.mPdus.empty());
+  }
+
+  delete put;
+}
+
+static void testReject(NdefMessage& message)
+{
+  SnepMessage* put = SnepMessage::getPutRequest(message);
+
+  FakeLlcpSocket socket(128, 4, 1000);
+  socket.queueMessage(SnepMessage::RESPONSE_REJECT);
+
+  SnepMessenger messenger(true, &socket, 1024);
+  messenger.sendMessage(*put);
+
+  // Nothing follows the first fragment.
+  NFC_CHECK(socket.mPdus.size() == 1);
+
+  delete put;
+}
+
+int main()
+{
+  NdefMessage large;
+  buildMessage(large, 64 * 1024);
+  NdefMessage small;
+  buildMessage(small, 16);
+
+  // Default MIU without windowing, a typical phone link, and the largest
+  // LLCP MIU and RW. The fragment length is capped by the remote MIU.
+  testWindowedSend(large, 128, 1, 5000, 1024);
+  testWindowedSend(large, 248, 4, 5000, 1024);
+  testWindowedSend(large, 2175, 15, 5000, 1024);
+  testWindowedSend(large, 2175, 15, 5000, 2175);
+  testWindowedSend(small, 128, 4, 5000, 1024);
+  testReject(large);
+
+  return nfcTestResult("SnepFragmentTest");
+}
@@ -0,0 +1,264 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Tap-to-notification latency benchmark.
+ *
+ * Starts nfcd, built with NFC_VENDOR=SIMULATOR, on a script of tag taps and
+ * connects to it as an IPC client. Once the client has received the given
+ * number of TECH_DISCOVERED notifications it turns NFC off, which makes nfcd
+ * write p50/p99/p999 of every tap stage as JSON; see
+ * TapLatencyTracker::writeReport(). Keep the report as the baseline that
+ * later runs are compared against.
+ *
+ *   nfcd_tap_latency_bench <nfcd> <script> <taps> <report.json>
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include "NfcGonkMessage.h"
+
+// See NfcIpcSocket::getListenSocket().
+#define NFCD_SOCKET_ENV "ANDROID_SOCKET_nfcd"
+#define SIM_SCRIPT_ENV "NFCD_SIM_SCRIPT"
+#define TAP_LATENCY_REPORT_ENV "NFCD_TAP_LATENCY_REPORT"
+
+#define CONNECT_TIMEOUT_MS 5000
+// Longest silence from nfcd before the run is given up.
+#define RECEIVE_TIMEOUT_MS 10000
+
+static int sendConfig(int fd, int32_t powerLevel)
+{
+  // Parcel size (big-endian), then request type and power level.
+  uint8_t buf[12];
+  uint32_t size = 8;
+  int32_t request = NFC_REQUEST_CONFIG;
+  buf[0] = size >> 24;
+  buf[1] = size >> 16;
+  buf[2] = size >> 8;
+  buf[3] = size;
+  memcpy(buf + 4, &request, sizeof(request));
+  memcpy(buf + 8, &powerLevel, sizeof(powerLevel));
+  return write(fd, buf, sizeof(buf)) == sizeof(buf) ? 0 : -1;
+}
+
+static int readFully(int fd, uint8_t* buf, size_t length)
+{
+  while (length > 0) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    int ret = poll(&pfd, 1, RECEIVE_TIMEOUT_MS);
+    if (ret <= 0) {
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "timed out waiting for nfcd\n");
+      return -1;
+    }
+
+    ssize_t got = read(fd, buf, length);
+    if (got <= 0) {
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "nfcd closed the connection\n");
+      return -1;
+    }
+    buf += got;
+    length -= got;
+  }
+  return 0;
+}
+
+/**
+ * Read one message and return its type, without the token flag.
+ */
+static int readMessage(int fd, int32_t& type)
+{
+  uint8_t header[4];
+  if (readFully(fd, header, sizeof(header)) < 0) {
+    return -1;
+  }
+
+  uint32_t size = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+  if (size < sizeof(type)) {
+    fprintf(stderr, "invalid message of %u bytes\n", size);
+    return -1;
+  }
+
+  std::vector<uint8_t> body(size);
+  if (readFully(fd, &body[0], size) < 0) {
+    return -1;
+  }
+  memcpy(&type, &body[0], sizeof(type));
+  type &= ~NFC_MESSAGE_TOKEN_FLAG;
+  return 0;
+}
+
+static int connectToNfcd(const char* path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  // nfcd listens on the socket once it is up.
+  for (int waitedMs = 0; waitedMs < CONNECT_TIMEOUT_MS; waitedMs += 10) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+      return fd;
+    }
+    close(fd);
+    usleep(10000);
+  }
+  fprintf(stderr, "cannot connect to nfcd: %s\n", strerror(errno));
+  return -1;
+}
+
+static pid_t startNfcd(const char* nfcd, const char* script, const char* report,
+                       const char* path)
+{
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    fprintf(stderr, "socket failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "bind %s failed: %s\n", path, strerror(errno));
+    close(listenFd);
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Hand the socket over the way init does.
+    char fdString[16];
+    snprintf(fdString, sizeof(fdString), "%d", listenFd);
+    setenv(NFCD_SOCKET_ENV, fdString, 1);
+    setenv(SIM_SCRIPT_ENV, script, 1);
+    setenv(TAP_LATENCY_REPORT_ENV, report, 1);
+    execl(nfcd, nfcd, (char*)NULL);
+    fprintf(stderr, "cannot run %s: %s\n", nfcd, strerror(errno));
+    _exit(1);
+  }
+
+  close(listenFd);
+  if (pid < 0) {
+    fprintf(stderr, "fork failed: %s\n", strerror(errno));
+  }
+  return pid;
+}
+
+static int run(int fd, int taps)
+{
+  bool isDisabling = false;
+  int tapCount = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (true) {
+    int32_t type;
+    if (readMessage(fd, type) < 0) {
+      return -1;
+    }
+
+    switch (type) {
+      case NFC_NOTIFICATION_INITIALIZED:
+        if (sendConfig(fd, NFC_POWER_FULL) < 0) {
+          return -1;
+        }
+        break;
+      case NFC_NOTIFICATION_TECH_DISCOVERED:
+        tapCount++;
+        if (tapCount == taps) {
+          // nfcd writes the report before it answers.
+          if (sendConfig(fd, NFC_POWER_OFF) < 0) {
+            return -1;
+          }
+          isDisabling = true;
+        }
+        break;
+      case NFC_RESPONSE_CONFIG:
+        if (isDisabling) {
+          struct timespec end;
+          clock_gettime(CLOCK_MONOTONIC, &end);
+          double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+          printf("%d taps in %.2f s, %.0f taps/s\n", tapCount, secs, tapCount / secs);
+          return 0;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void printReport(const char* report)
+{
+  FILE* file = fopen(report, "r");
+  if (!file) {
+    fprintf(stderr, "nfcd wrote no report to %s\n", report);
+    return;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    fputs(line, stdout);
+  }
+  fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 5 || atoi(argv[3]) <= 0) {
+    fprintf(stderr, "usage: %s <nfcd> <script> <taps> <report.json>\n", argv[0]);
+    return 2;
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/nfcd-bench-%d", (int)getpid());
+
+  pid_t pid = startNfcd(argv[1], argv[2], argv[4], path);
+  if (pid < 0) {
+    return 1;
+  }
+
+  int result = 1;
+  int fd = connectToNfcd(path);
+  if (fd >= 0) {
+    result = run(fd, atoi(argv[3])) == 0 ? 0 : 1;
+    close(fd);
+  }
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  unlink(path);
+
+  if (result == 0) {
+    printReport(argv[4]);
+  }
+  return result;
+}